@@ -0,0 +1,505 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "mdm-config-snapshot.h"
+
+struct _MdmConfigSnapshot {
+	char                          *filename;
+	GMappedFile                   *file;
+
+	dev_t                          dev;
+	ino_t                          ino;
+	time_t                         mtime;
+	off_t                          size;
+
+	const MdmConfigSnapshotHeader *header;
+	const MdmConfigSnapshotRecord *records;
+	const char                    *strings;
+};
+
+typedef struct {
+	char              *display;
+	char              *key;
+	char              *value;
+	MdmConfigValueType type;
+} BuilderRecord;
+
+struct _MdmConfigSnapshotBuilder {
+	GPtrArray *records;
+};
+
+static void
+builder_record_free (BuilderRecord *record)
+{
+	g_free (record->display);
+	g_free (record->key);
+	g_free (record->value);
+	g_free (record);
+}
+
+static int
+compare_display_key (const char *display_a,
+		     const char *key_a,
+		     const char *display_b,
+		     const char *key_b)
+{
+	int res;
+
+	res = strcmp (display_a, display_b);
+	if (res != 0) {
+		return res;
+	}
+
+	return strcmp (key_a, key_b);
+}
+
+static int
+compare_builder_records (gconstpointer a,
+			 gconstpointer b)
+{
+	const BuilderRecord *ra = *(const BuilderRecord **)a;
+	const BuilderRecord *rb = *(const BuilderRecord **)b;
+
+	return compare_display_key (ra->display, ra->key, rb->display, rb->key);
+}
+
+MdmConfigSnapshotBuilder *
+mdm_config_snapshot_builder_new (void)
+{
+	MdmConfigSnapshotBuilder *builder;
+
+	builder = g_new0 (MdmConfigSnapshotBuilder, 1);
+	builder->records = g_ptr_array_new ();
+
+	return builder;
+}
+
+void
+mdm_config_snapshot_builder_free (MdmConfigSnapshotBuilder *builder)
+{
+	if (builder == NULL) {
+		return;
+	}
+
+	g_ptr_array_foreach (builder->records, (GFunc)builder_record_free, NULL);
+	g_ptr_array_free (builder->records, TRUE);
+	g_free (builder);
+}
+
+/*
+ * Adds the value of key, in "group/key" form, for display, or for
+ * every display if display is NULL.
+ */
+void
+mdm_config_snapshot_builder_add (MdmConfigSnapshotBuilder *builder,
+				 const char               *display,
+				 const char               *key,
+				 MdmConfigValueType        type,
+				 const char               *value)
+{
+	BuilderRecord *record;
+
+	g_return_if_fail (builder != NULL);
+	g_return_if_fail (key != NULL);
+
+	record = g_new0 (BuilderRecord, 1);
+	record->display = g_strdup (display != NULL ? display : "");
+	record->key = g_strdup (key);
+	record->value = g_strdup (value != NULL ? value : "");
+	record->type = type;
+
+	g_ptr_array_add (builder->records, record);
+}
+
+/*
+ * Records the state of the per-display file display's values come
+ * from, so that readers can tell when it changed under the snapshot.
+ */
+void
+mdm_config_snapshot_builder_add_file (MdmConfigSnapshotBuilder *builder,
+				      const char               *display,
+				      const char               *filename)
+{
+	struct stat  s;
+	char        *value;
+
+	g_return_if_fail (builder != NULL);
+	g_return_if_fail (display != NULL);
+	g_return_if_fail (filename != NULL);
+
+	if (g_stat (filename, &s) != 0) {
+		memset (&s, 0, sizeof (s));
+	}
+
+	value = g_strdup_printf ("%ld %ld %ld %lu %s",
+				 (long)s.st_mtim.tv_sec,
+				 (long)s.st_mtim.tv_nsec,
+				 (long)s.st_size,
+				 (unsigned long)s.st_ino,
+				 filename);
+	mdm_config_snapshot_builder_add (builder, display,
+					 MDM_CONFIG_SNAPSHOT_FILE_KEY,
+					 MDM_CONFIG_VALUE_STRING, value);
+	g_free (value);
+}
+
+static guint32
+add_string (GString    *strings,
+	    GHashTable *offsets,
+	    const char *str)
+{
+	gpointer offset;
+
+	if (g_hash_table_lookup_extended (offsets, str, NULL, &offset)) {
+		return GPOINTER_TO_UINT (offset);
+	}
+
+	offset = GUINT_TO_POINTER (strings->len);
+	g_string_append_len (strings, str, strlen (str) + 1);
+	g_hash_table_insert (offsets, (gpointer)str, offset);
+
+	return GPOINTER_TO_UINT (offset);
+}
+
+/*
+ * Writes the snapshot to filename.  The file is replaced atomically,
+ * so a reader either sees the old snapshot or the new one.
+ */
+gboolean
+mdm_config_snapshot_builder_write (MdmConfigSnapshotBuilder *builder,
+				   const char               *filename,
+				   guint32                   serial,
+				   GError                  **error)
+{
+	MdmConfigSnapshotHeader  header;
+	MdmConfigSnapshotRecord *records;
+	GString                 *strings;
+	GHashTable              *offsets;
+	GString                 *contents;
+	guint                    n_records;
+	guint                    i;
+	gboolean                 ret;
+
+	g_return_val_if_fail (builder != NULL, FALSE);
+	g_return_val_if_fail (filename != NULL, FALSE);
+
+	g_ptr_array_sort (builder->records, compare_builder_records);
+
+	strings = g_string_new (NULL);
+	offsets = g_hash_table_new (g_str_hash, g_str_equal);
+	records = g_new0 (MdmConfigSnapshotRecord, builder->records->len);
+
+	/* offset 0 is the empty string, used for global values */
+	add_string (strings, offsets, "");
+
+	n_records = 0;
+	for (i = 0; i < builder->records->len; i++) {
+		BuilderRecord *record = g_ptr_array_index (builder->records, i);
+
+		/* the first value added for a display and key wins */
+		if (i > 0 &&
+		    compare_builder_records (&builder->records->pdata[i - 1],
+					     &builder->records->pdata[i]) == 0) {
+			continue;
+		}
+
+		records[n_records].display = add_string (strings, offsets, record->display);
+		records[n_records].key = add_string (strings, offsets, record->key);
+		records[n_records].value = add_string (strings, offsets, record->value);
+		records[n_records].type = record->type;
+		n_records++;
+	}
+
+	memset (&header, 0, sizeof (header));
+	header.magic = MDM_CONFIG_SNAPSHOT_MAGIC;
+	header.version = MDM_CONFIG_SNAPSHOT_VERSION;
+	header.serial = serial;
+	header.n_records = n_records;
+	header.strings_offset = sizeof (header) + n_records * sizeof (MdmConfigSnapshotRecord);
+	header.strings_size = strings->len;
+
+	contents = g_string_sized_new (header.strings_offset + strings->len);
+	g_string_append_len (contents, (const char *)&header, sizeof (header));
+	g_string_append_len (contents, (const char *)records,
+			     n_records * sizeof (MdmConfigSnapshotRecord));
+	g_string_append_len (contents, strings->str, strings->len);
+
+	ret = g_file_set_contents (filename, contents->str, contents->len, error);
+	if (ret) {
+		g_chmod (filename, 0644);
+	}
+
+	g_string_free (contents, TRUE);
+	g_hash_table_destroy (offsets);
+	g_string_free (strings, TRUE);
+	g_free (records);
+
+	return ret;
+}
+
+static gboolean
+snapshot_is_valid (const char *contents,
+		   gsize       length)
+{
+	const MdmConfigSnapshotHeader *header;
+	const MdmConfigSnapshotRecord *records;
+	guint32                        i;
+
+	if (length < sizeof (MdmConfigSnapshotHeader)) {
+		return FALSE;
+	}
+
+	header = (const MdmConfigSnapshotHeader *)contents;
+	if (header->magic != MDM_CONFIG_SNAPSHOT_MAGIC ||
+	    header->version != MDM_CONFIG_SNAPSHOT_VERSION) {
+		return FALSE;
+	}
+
+	if (header->n_records > (length - sizeof (MdmConfigSnapshotHeader)) / sizeof (MdmConfigSnapshotRecord) ||
+	    header->strings_offset != sizeof (MdmConfigSnapshotHeader) + header->n_records * sizeof (MdmConfigSnapshotRecord) ||
+	    header->strings_size == 0 ||
+	    header->strings_size > length - header->strings_offset ||
+	    contents[header->strings_offset + header->strings_size - 1] != '\0') {
+		return FALSE;
+	}
+
+	records = (const MdmConfigSnapshotRecord *)(contents + sizeof (MdmConfigSnapshotHeader));
+	for (i = 0; i < header->n_records; i++) {
+		if (records[i].display >= header->strings_size ||
+		    records[i].key >= header->strings_size ||
+		    records[i].value >= header->strings_size) {
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/*
+ * Maps the snapshot in filename.  Returns NULL if there is none, or
+ * if it was written in a format this reader does not understand.
+ */
+MdmConfigSnapshot *
+mdm_config_snapshot_open (const char *filename)
+{
+	MdmConfigSnapshot *snapshot;
+	GMappedFile       *file;
+	struct stat        s;
+	const char        *contents;
+
+	g_return_val_if_fail (filename != NULL, NULL);
+
+	if (g_stat (filename, &s) != 0) {
+		return NULL;
+	}
+
+	file = g_mapped_file_new (filename, FALSE, NULL);
+	if (file == NULL) {
+		return NULL;
+	}
+
+	contents = g_mapped_file_get_contents (file);
+	if (contents == NULL ||
+	    ! snapshot_is_valid (contents, g_mapped_file_get_length (file))) {
+		g_mapped_file_unref (file);
+		return NULL;
+	}
+
+	snapshot = g_new0 (MdmConfigSnapshot, 1);
+	snapshot->filename = g_strdup (filename);
+	snapshot->file = file;
+	snapshot->dev = s.st_dev;
+	snapshot->ino = s.st_ino;
+	snapshot->mtime = s.st_mtime;
+	snapshot->size = s.st_size;
+	snapshot->header = (const MdmConfigSnapshotHeader *)contents;
+	snapshot->records = (const MdmConfigSnapshotRecord *)(contents + sizeof (MdmConfigSnapshotHeader));
+	snapshot->strings = contents + snapshot->header->strings_offset;
+
+	return snapshot;
+}
+
+void
+mdm_config_snapshot_close (MdmConfigSnapshot *snapshot)
+{
+	if (snapshot == NULL) {
+		return;
+	}
+
+	g_mapped_file_unref (snapshot->file);
+	g_free (snapshot->filename);
+	g_free (snapshot);
+}
+
+/*
+ * Returns TRUE if the daemon has published a new snapshot, or removed
+ * it, since this one was mapped.
+ */
+gboolean
+mdm_config_snapshot_is_stale (MdmConfigSnapshot *snapshot)
+{
+	struct stat s;
+
+	g_return_val_if_fail (snapshot != NULL, TRUE);
+
+	if (g_stat (snapshot->filename, &s) != 0) {
+		return TRUE;
+	}
+
+	return (s.st_dev != snapshot->dev ||
+		s.st_ino != snapshot->ino ||
+		s.st_mtime != snapshot->mtime ||
+		s.st_size != snapshot->size);
+}
+
+guint32
+mdm_config_snapshot_get_serial (MdmConfigSnapshot *snapshot)
+{
+	g_return_val_if_fail (snapshot != NULL, 0);
+
+	return snapshot->header->serial;
+}
+
+static const MdmConfigSnapshotRecord *
+find_record (MdmConfigSnapshot *snapshot,
+	     const char        *display,
+	     const char        *key)
+{
+	guint32 low;
+	guint32 high;
+
+	low = 0;
+	high = snapshot->header->n_records;
+
+	while (low < high) {
+		const MdmConfigSnapshotRecord *record;
+		guint32                        mid;
+		int                            res;
+
+		mid = low + (high - low) / 2;
+		record = &snapshot->records[mid];
+
+		res = compare_display_key (display,
+					   key,
+					   snapshot->strings + record->display,
+					   snapshot->strings + record->key);
+		if (res == 0) {
+			return record;
+		} else if (res < 0) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Returns TRUE if the per-display values for display can be trusted,
+ * that is the display's per-display file is still in the state the
+ * snapshot was built from.  Displays the daemon did not know about
+ * when it wrote the snapshot are never current.
+ */
+gboolean
+mdm_config_snapshot_display_is_current (MdmConfigSnapshot *snapshot,
+					const char        *display)
+{
+	const MdmConfigSnapshotRecord *record;
+	const char                    *value;
+	struct stat                    s;
+	long                           mtime;
+	long                           mtime_nsec;
+	long                           size;
+	unsigned long                  ino;
+	int                            path;
+
+	g_return_val_if_fail (snapshot != NULL, FALSE);
+
+	if (display == NULL || display[0] == '\0') {
+		return TRUE;
+	}
+
+	record = find_record (snapshot, display, MDM_CONFIG_SNAPSHOT_FILE_KEY);
+	if (record == NULL) {
+		return FALSE;
+	}
+
+	value = snapshot->strings + record->value;
+	path = 0;
+	if (sscanf (value, "%ld %ld %ld %lu %n",
+		    &mtime, &mtime_nsec, &size, &ino, &path) != 4 ||
+	    path == 0) {
+		return FALSE;
+	}
+
+	if (g_stat (value + path, &s) != 0) {
+		return (mtime == 0 && mtime_nsec == 0 && size == 0 && ino == 0);
+	}
+
+	return (mtime == (long)s.st_mtim.tv_sec &&
+		mtime_nsec == (long)s.st_mtim.tv_nsec &&
+		size == (long)s.st_size &&
+		ino == (unsigned long)s.st_ino);
+}
+
+/*
+ * Returns the value of key, in "group/key" form, for display, falling
+ * back to the global value.  The string points into the mapping and
+ * stays valid until the snapshot is closed.  Returns NULL if the
+ * snapshot does not have the key.
+ */
+const char *
+mdm_config_snapshot_lookup (MdmConfigSnapshot  *snapshot,
+			    const char         *display,
+			    const char         *key,
+			    MdmConfigValueType *type)
+{
+	const MdmConfigSnapshotRecord *record;
+
+	g_return_val_if_fail (snapshot != NULL, NULL);
+	g_return_val_if_fail (key != NULL, NULL);
+
+	record = NULL;
+	if (display != NULL && display[0] != '\0') {
+		record = find_record (snapshot, display, key);
+	}
+	if (record == NULL) {
+		record = find_record (snapshot, "", key);
+	}
+	if (record == NULL) {
+		return NULL;
+	}
+
+	if (type != NULL) {
+		*type = record->type;
+	}
+
+	return snapshot->strings + record->value;
+}
@@ -0,0 +1,95 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MDM_CONFIG_SNAPSHOT_H
+#define _MDM_CONFIG_SNAPSHOT_H
+
+#include <glib.h>
+
+#include "mdm-config.h"
+
+G_BEGIN_DECLS
+
+/*
+ * A config snapshot is a read-only binary file holding the effective
+ * value of every key the greeters read, written by the daemon and
+ * mapped by the greeters.  Readers ask the daemon for keys it does
+ * not have.  The layout, in host byte order, is a header, the records
+ * sorted by display and then key, and a block of NUL terminated
+ * strings the records point into.  Global values have an empty
+ * display name.  Readers reject files whose magic or format version
+ * they do not know.
+ */
+#define MDM_CONFIG_SNAPSHOT_MAGIC   0x534d444d /* "MDMS" */
+#define MDM_CONFIG_SNAPSHOT_VERSION 2
+
+/*
+ * Pseudo key holding "<mtime> <mtime nsec> <size> <inode> <path>" of the
+ * per-display file a display's values were read from, all zero if it
+ * did not exist.
+ */
+#define MDM_CONFIG_SNAPSHOT_FILE_KEY "-/file"
+
+typedef struct {
+	guint32 magic;
+	guint32 version;
+	guint32 serial;
+	guint32 n_records;
+	guint32 strings_offset;
+	guint32 strings_size;
+} MdmConfigSnapshotHeader;
+
+typedef struct {
+	guint32 display;	/* offsets into the string block */
+	guint32 key;
+	guint32 value;
+	guint32 type;		/* MdmConfigValueType */
+} MdmConfigSnapshotRecord;
+
+typedef struct _MdmConfigSnapshot        MdmConfigSnapshot;
+typedef struct _MdmConfigSnapshotBuilder MdmConfigSnapshotBuilder;
+
+MdmConfigSnapshotBuilder * mdm_config_snapshot_builder_new   (void);
+void                       mdm_config_snapshot_builder_free  (MdmConfigSnapshotBuilder *builder);
+void                       mdm_config_snapshot_builder_add   (MdmConfigSnapshotBuilder *builder,
+								const char               *display,
+								const char               *key,
+								MdmConfigValueType        type,
+								const char               *value);
+void                       mdm_config_snapshot_builder_add_file (MdmConfigSnapshotBuilder *builder,
+								   const char               *display,
+								   const char               *filename);
+gboolean                   mdm_config_snapshot_builder_write (MdmConfigSnapshotBuilder *builder,
+								const char               *filename,
+								guint32                   serial,
+								GError                  **error);
+
+MdmConfigSnapshot *        mdm_config_snapshot_open          (const char               *filename);
+void                       mdm_config_snapshot_close         (MdmConfigSnapshot        *snapshot);
+gboolean                   mdm_config_snapshot_is_stale      (MdmConfigSnapshot        *snapshot);
+guint32                    mdm_config_snapshot_get_serial    (MdmConfigSnapshot        *snapshot);
+gboolean                   mdm_config_snapshot_display_is_current (MdmConfigSnapshot *snapshot,
+								     const char        *display);
+const char *               mdm_config_snapshot_lookup        (MdmConfigSnapshot        *snapshot,
+								const char               *display,
+								const char               *key,
+								MdmConfigValueType       *type);
+
+G_END_DECLS
+
+#endif /* _MDM_CONFIG_SNAPSHOT_H */
@@ -54,7 +54,14 @@ struct _MdmConfig
 
 	GPtrArray       *entries;
 
+	/* group -> (key -> MdmConfigEntry), and id -> MdmConfigEntry */
+	GHashTable      *entry_hash;
+	GHashTable      *entry_id_hash;
+
+	/* group -> (key -> MdmConfigValue) */
 	GHashTable      *value_hash;
+	/* id -> MdmConfigValue, borrowed from value_hash */
+	GPtrArray       *id_values;
 
 	MdmConfigFunc    validate_func;
 	gpointer         validate_func_data;
@@ -566,14 +573,43 @@ mdm_config_value_to_string (const MdmConfigValue *value)
 	return ret;
 }
 
+static GHashTable *
+group_hash_new (void)
+{
+	return g_hash_table_new_full (g_str_hash,
+				      g_str_equal,
+				      (GDestroyNotify)g_free,
+				      (GDestroyNotify)g_hash_table_destroy);
+}
+
+/*
+ * Both the entries and the values are stored in two levels of hash
+ * tables, first by group and then by key, so that looking something
+ * up by group and key never has to build a "group/key" string.
+ */
+static gpointer
+group_hash_lookup (GHashTable *hash,
+		   const char *group,
+		   const char *key)
+{
+	GHashTable *keys;
+
+	keys = g_hash_table_lookup (hash, group);
+	if (keys == NULL) {
+		return NULL;
+	}
+
+	return g_hash_table_lookup (keys, key);
+}
+
 static void
 mdm_config_init (MdmConfig *config)
 {
 	config->entries = g_ptr_array_new ();
-	config->value_hash = g_hash_table_new_full (g_str_hash,
-						    g_str_equal,
-						    (GDestroyNotify)g_free,
-						    (GDestroyNotify)mdm_config_value_free);
+	config->entry_hash = group_hash_new ();
+	config->entry_id_hash = g_hash_table_new (g_direct_hash, g_direct_equal);
+	config->value_hash = group_hash_new ();
+	config->id_values = g_ptr_array_new ();
 }
 
 MdmConfig *
@@ -602,6 +638,8 @@ mdm_config_free (MdmConfig *config)
 	MdmConfigEntry *e;
 	GKeyFile       *mkf, *dkf, *ckf;
 	GHashTable     *hash;
+	GHashTable     *ehash, *idhash;
+	GPtrArray      *idvals;
 
 	g_return_if_fail (config != NULL);
 
@@ -616,8 +654,14 @@ mdm_config_free (MdmConfig *config)
 	mkf  = config->distro_key_file;
 	ckf  = config->custom_key_file;
 	hash = config->value_hash;
+	ehash  = config->entry_hash;
+	idhash = config->entry_id_hash;
+	idvals = config->id_values;
 
 	config->entries            = NULL;	
+	config->entry_hash         = NULL;
+	config->entry_id_hash      = NULL;
+	config->id_values          = NULL;
 	config->default_key_file   = NULL;
 	config->distro_key_file    = NULL;
 	config->custom_key_file    = NULL;
@@ -629,6 +673,13 @@ mdm_config_free (MdmConfig *config)
 
 	g_slice_free (MdmConfig, config);
 
+	/* the indexes only point into the entries, so drop them first */
+	if (ehash != NULL)
+		g_hash_table_destroy (ehash);
+	if (idhash != NULL)
+		g_hash_table_destroy (idhash);
+	if (idvals != NULL)
+		g_ptr_array_free (idvals, TRUE);
 	if (e != NULL) {
 		g_ptr_array_foreach (e, (GFunc)mdm_config_entry_free, NULL);
 		g_ptr_array_free (e, TRUE);
@@ -713,49 +764,55 @@ mdm_config_lookup_entry (MdmConfig  *config,
 			 const char *group,
 			 const char *key)
 {
-	int                   i;
-	const MdmConfigEntry *entry;
-
 	g_return_val_if_fail (config != NULL, NULL);
 	g_return_val_if_fail (group != NULL, NULL);
 	g_return_val_if_fail (key != NULL, NULL);
 
-	entry = NULL;
-
-	for (i = 0; i < config->entries->len; i++) {
-		MdmConfigEntry *this;
-		this = g_ptr_array_index (config->entries, i);
-		if (strcmp (this->group, group) == 0
-		    && strcmp (this->key, key) == 0) {
-			entry = (const MdmConfigEntry *)this;
-			break;
-		}
-	}
-
-	return entry;
+	return group_hash_lookup (config->entry_hash, group, key);
 }
 
 const MdmConfigEntry *
 mdm_config_lookup_entry_for_id (MdmConfig  *config,
 				int         id)
 {
-	int                   i;
-	const MdmConfigEntry *entry;
-
 	g_return_val_if_fail (config != NULL, NULL);
 
-	entry = NULL;
+	return g_hash_table_lookup (config->entry_id_hash, GINT_TO_POINTER (id));
+}
 
-	for (i = 0; i < config->entries->len; i++) {
-		MdmConfigEntry *this;
-		this = g_ptr_array_index (config->entries, i);
-		if (this->id == id) {
-			entry = (const MdmConfigEntry *)this;
-			break;
-		}
+/*
+ * The first entry added for a given group/key or id wins, which is
+ * what the lookups used to return when they walked the entries array.
+ */
+static void
+index_entry (MdmConfig      *config,
+	     MdmConfigEntry *entry)
+{
+	GHashTable *keys;
+
+	if (! g_hash_table_lookup_extended (config->entry_id_hash,
+					    GINT_TO_POINTER (entry->id),
+					    NULL,
+					    NULL)) {
+		g_hash_table_insert (config->entry_id_hash,
+				     GINT_TO_POINTER (entry->id),
+				     entry);
+	}
+
+	if (entry->group == NULL || entry->key == NULL) {
+		return;
+	}
+
+	keys = g_hash_table_lookup (config->entry_hash, entry->group);
+	if (keys == NULL) {
+		/* keys are owned by the entries themselves */
+		keys = g_hash_table_new (g_str_hash, g_str_equal);
+		g_hash_table_insert (config->entry_hash, g_strdup (entry->group), keys);
 	}
 
-	return entry;
+	if (g_hash_table_lookup (keys, entry->key) == NULL) {
+		g_hash_table_insert (keys, entry->key, entry);
+	}
 }
 
 void
@@ -769,6 +826,7 @@ mdm_config_add_entry (MdmConfig            *config,
 
 	new_entry = mdm_config_entry_copy (entry);
 	g_ptr_array_add (config->entries, new_entry);
+	index_entry (config, new_entry);
 }
 
 void
@@ -1003,21 +1061,29 @@ load_value_entry (MdmConfig            *config,
 	return ret;
 }
 
-static int
-lookup_id_for_key (MdmConfig  *config,
-		   const char *group,
-		   const char *key)
+/*
+ * Only the entry that owns an id gets the id slot, so that group/key
+ * pairs which merely share the id (such as the per server entries)
+ * do not clobber it.
+ */
+static void
+set_id_value (MdmConfig            *config,
+	      const MdmConfigEntry *entry,
+	      MdmConfigValue       *value)
 {
-	int                   id;
-	const MdmConfigEntry *entry;
+	if (entry == NULL || entry->id < 0) {
+		return;
+	}
 
-	id = MDM_CONFIG_INVALID_ID;
-	entry = mdm_config_lookup_entry (config, group, key);
-	if (entry != NULL) {
-		id = entry->id;
+	if (mdm_config_lookup_entry_for_id (config, entry->id) != entry) {
+		return;
 	}
 
-	return id;
+	if (entry->id >= config->id_values->len) {
+		g_ptr_array_set_size (config->id_values, entry->id + 1);
+	}
+
+	g_ptr_array_index (config->id_values, entry->id) = value;
 }
 
 static void
@@ -1027,39 +1093,41 @@ internal_set_value (MdmConfig          *config,
 		    const char         *key,
 		    MdmConfigValue     *value)
 {
-	char           *key_path;
-	int             id;
-	MdmConfigValue *v;
-	gboolean        res;
+	GHashTable           *keys;
+	const MdmConfigEntry *entry;
+	int                   id;
+	MdmConfigValue       *v;
 
 	g_return_if_fail (config != NULL);
 
-	key_path = g_strdup_printf ("%s/%s", group, key);
-
-	v = NULL;
-	res = g_hash_table_lookup_extended (config->value_hash,
-					    key_path,
-					    NULL,
-					    (gpointer *)&v);
+	keys = g_hash_table_lookup (config->value_hash, group);
+	if (keys == NULL) {
+		keys = g_hash_table_new_full (g_str_hash,
+					      g_str_equal,
+					      (GDestroyNotify)g_free,
+					      (GDestroyNotify)mdm_config_value_free);
+		g_hash_table_insert (config->value_hash, g_strdup (group), keys);
+	}
 
-	if (res) {
-		if (v != NULL && mdm_config_value_compare (v, value) == 0) {
-			/* value is the same - don't update */
-			goto out;
-		}
+	v = g_hash_table_lookup (keys, key);
+	if (v != NULL && mdm_config_value_compare (v, value) == 0) {
+		/* value is the same - don't update */
+		return;
 	}
 
-	g_hash_table_insert (config->value_hash,
-			     g_strdup (key_path),
-			     mdm_config_value_copy (value));
+	v = mdm_config_value_copy (value);
+	g_hash_table_insert (keys, g_strdup (key), v);
 
-	id = lookup_id_for_key (config, group, key);
+	id = MDM_CONFIG_INVALID_ID;
+	entry = mdm_config_lookup_entry (config, group, key);
+	if (entry != NULL) {
+		id = entry->id;
+		set_id_value (config, entry, v);
+	}
 
 	if (config->notify_func) {
 		(* config->notify_func) (config, source, group, key, value, id, config->notify_func_data);
 	}
- out:
-	g_free (key_path);
 }
 
 static void
@@ -1341,29 +1409,17 @@ mdm_config_peek_value (MdmConfig             *config,
 		       const char            *key,
 		       const MdmConfigValue **valuep)
 {
-	gboolean              ret;
-	char                 *key_path;
 	const MdmConfigValue *value;
 
 	g_return_val_if_fail (config != NULL, FALSE);
 
-	key_path = g_strdup_printf ("%s/%s", group, key);
-	value = NULL;
-	ret = g_hash_table_lookup_extended (config->value_hash,
-					    key_path,
-					    NULL,
-					    (gpointer *)&value);
-	g_free (key_path);
+	value = group_hash_lookup (config->value_hash, group, key);
 
 	if (valuep != NULL) {
-		if (ret) {
-			*valuep = value;
-		} else {
-			*valuep = NULL;
-		}
+		*valuep = value;
 	}
 
-	return ret;
+	return value != NULL;
 }
 
 gboolean
@@ -1383,6 +1439,59 @@ mdm_config_get_value (MdmConfig       *config,
 	return res;
 }
 
+/*
+ * Returns the translation of key for the first language in langs
+ * that has one.  Files are searched in the same order values are
+ * loaded in: custom file, distro file, default file.  The value
+ * without a locale is not considered.
+ */
+gboolean
+mdm_config_get_translation (MdmConfig          *config,
+			    const char         *group,
+			    const char         *key,
+			    const char * const *langs,
+			    char              **valuep)
+{
+	GKeyFile *key_files[3];
+	char     *val;
+	int       i;
+	int       j;
+
+	g_return_val_if_fail (config != NULL, FALSE);
+	g_return_val_if_fail (group != NULL, FALSE);
+	g_return_val_if_fail (key != NULL, FALSE);
+
+	key_files[0] = config->custom_filename != NULL ? config->custom_key_file : NULL;
+	key_files[1] = config->distro_filename != NULL ? config->distro_key_file : NULL;
+	key_files[2] = config->default_filename != NULL ? config->default_key_file : NULL;
+
+	val = NULL;
+	for (i = 0; langs != NULL && langs[i] != NULL && val == NULL; i++) {
+		char *localized_key;
+
+		localized_key = g_strdup_printf ("%s[%s]", key, langs[i]);
+
+		for (j = 0; j < G_N_ELEMENTS (key_files) && val == NULL; j++) {
+			if (key_files[j] != NULL) {
+				val = g_key_file_get_string (key_files[j],
+							     group,
+							     localized_key,
+							     NULL);
+			}
+		}
+
+		g_free (localized_key);
+	}
+
+	if (valuep != NULL) {
+		*valuep = val;
+	} else {
+		g_free (val);
+	}
+
+	return val != NULL;
+}
+
 gboolean
 mdm_config_set_value (MdmConfig       *config,
 		      const char      *group,
@@ -1399,7 +1508,7 @@ mdm_config_set_value (MdmConfig       *config,
 	return TRUE;
 }
 
-static gboolean
+gboolean
 mdm_config_peek_value_for_id (MdmConfig             *config,
 			      int                    id,
 			      const MdmConfigValue **valuep)
@@ -1408,6 +1517,18 @@ mdm_config_peek_value_for_id (MdmConfig             *config,
 
 	g_return_val_if_fail (config != NULL, FALSE);
 
+	if (id >= 0 && id < config->id_values->len) {
+		const MdmConfigValue *value;
+
+		value = g_ptr_array_index (config->id_values, id);
+		if (value != NULL) {
+			if (valuep != NULL) {
+				*valuep = value;
+			}
+			return TRUE;
+		}
+	}
+
 	entry = mdm_config_lookup_entry_for_id (config, id);
 	if (entry == NULL) {
 		return FALSE;
@@ -1495,13 +1616,13 @@ mdm_config_get_bool_for_id (MdmConfig       *config,
 			    int              id,
 			    gboolean        *boolp)
 {
-	MdmConfigValue *value;
-	gboolean        bool;
-	gboolean        res;
+	const MdmConfigValue *value;
+	gboolean              bool;
+	gboolean              res;
 
 	g_return_val_if_fail (config != NULL, FALSE);
 
-	res = mdm_config_get_value_for_id (config, id, &value);
+	res = mdm_config_peek_value_for_id (config, id, &value);
 	if (! res) {
 		return FALSE;
 	}
@@ -1511,8 +1632,6 @@ mdm_config_get_bool_for_id (MdmConfig       *config,
 		*boolp = bool;
 	}
 
-	mdm_config_value_free (value);
-
 	return res;
 }
 
@@ -1521,13 +1640,13 @@ mdm_config_get_int_for_id (MdmConfig       *config,
 			   int              id,
 			   int             *integerp)
 {
-	MdmConfigValue *value;
-	gboolean        integer;
-	gboolean        res;
+	const MdmConfigValue *value;
+	int                   integer;
+	gboolean              res;
 
 	g_return_val_if_fail (config != NULL, FALSE);
 
-	res = mdm_config_get_value_for_id (config, id, &value);
+	res = mdm_config_peek_value_for_id (config, id, &value);
 	if (! res) {
 		return FALSE;
 	}
@@ -1537,8 +1656,6 @@ mdm_config_get_int_for_id (MdmConfig       *config,
 		*integerp = integer;
 	}
 
-	mdm_config_value_free (value);
-
 	return res;
 }
 
@@ -140,8 +140,16 @@ gboolean               mdm_config_set_value              (MdmConfig       *confi
 							  const char      *group,
 							  const char      *key,
 							  MdmConfigValue  *value);
+gboolean               mdm_config_get_translation        (MdmConfig          *config,
+							  const char         *group,
+							  const char         *key,
+							  const char * const *langs,
+							  char              **value);
 
 /* convenience functions */
+gboolean               mdm_config_peek_value_for_id      (MdmConfig             *config,
+							  int                    id,
+							  const MdmConfigValue **value);
 gboolean               mdm_config_get_value_for_id       (MdmConfig       *config,
 							  int              id,
 							  MdmConfigValue **value);
@@ -201,6 +201,96 @@ load_servers_group (MdmConfig *config)
 	g_ptr_array_free ((GPtrArray*) keys, TRUE);
 }
 
+#define BENCHMARK_ROUNDS 1000
+
+/* The pre-index lookup, kept here to compare against */
+static const MdmConfigEntry *
+linear_lookup_entry (const MdmConfigEntry *entries,
+                     const char           *group,
+                     const char           *key)
+{
+        int i;
+
+        for (i = 0; entries[i].group != NULL; i++) {
+                if (strcmp (entries[i].group, group) == 0
+                    && strcmp (entries[i].key, key) == 0) {
+                        return &entries[i];
+                }
+        }
+
+        return NULL;
+}
+
+static void
+benchmark_lookups (MdmConfig *config)
+{
+        GTimer               *timer;
+        const MdmConfigEntry *entry;
+        const MdmConfigValue *value;
+        double                elapsed;
+        int                   n_entries;
+        int                   n_lookups;
+        int                   i;
+        int                   j;
+
+        for (n_entries = 0; mdm_daemon_config_entries [n_entries].group != NULL; n_entries++)
+                ;
+        n_lookups = n_entries * BENCHMARK_ROUNDS;
+
+        g_message ("Benchmarking %d lookups over %d entries", n_lookups, n_entries);
+
+        timer = g_timer_new ();
+
+        g_timer_start (timer);
+        for (j = 0; j < BENCHMARK_ROUNDS; j++) {
+                for (i = 0; i < n_entries; i++) {
+                        entry = linear_lookup_entry (mdm_daemon_config_entries,
+                                                     mdm_daemon_config_entries [i].group,
+                                                     mdm_daemon_config_entries [i].key);
+                        g_assert (entry != NULL);
+                }
+        }
+        elapsed = g_timer_elapsed (timer, NULL);
+        g_print ("linear scan by group/key: %.1f ns/lookup\n", elapsed * 1e9 / n_lookups);
+
+        g_timer_start (timer);
+        for (j = 0; j < BENCHMARK_ROUNDS; j++) {
+                for (i = 0; i < n_entries; i++) {
+                        entry = mdm_config_lookup_entry (config,
+                                                         mdm_daemon_config_entries [i].group,
+                                                         mdm_daemon_config_entries [i].key);
+                        g_assert (entry != NULL);
+                }
+        }
+        elapsed = g_timer_elapsed (timer, NULL);
+        g_print ("mdm_config_lookup_entry: %.1f ns/lookup\n", elapsed * 1e9 / n_lookups);
+
+        g_timer_start (timer);
+        for (j = 0; j < BENCHMARK_ROUNDS; j++) {
+                for (i = 0; i < n_entries; i++) {
+                        entry = mdm_config_lookup_entry_for_id (config,
+                                                                mdm_daemon_config_entries [i].id);
+                        g_assert (entry != NULL);
+                }
+        }
+        elapsed = g_timer_elapsed (timer, NULL);
+        g_print ("mdm_config_lookup_entry_for_id: %.1f ns/lookup\n", elapsed * 1e9 / n_lookups);
+
+        g_timer_start (timer);
+        for (j = 0; j < BENCHMARK_ROUNDS; j++) {
+                for (i = 0; i < n_entries; i++) {
+                        mdm_config_peek_value (config,
+                                               mdm_daemon_config_entries [i].group,
+                                               mdm_daemon_config_entries [i].key,
+                                               &value);
+                }
+        }
+        elapsed = g_timer_elapsed (timer, NULL);
+        g_print ("mdm_config_peek_value: %.1f ns/lookup\n", elapsed * 1e9 / n_lookups);
+
+        g_timer_destroy (timer);
+}
+
 static void
 test_config (void)
 {
@@ -255,6 +345,8 @@ test_config (void)
                 mdm_config_value_free (value);
         }
 
+        benchmark_lookups (config);
+
         g_message ("Setting values");
         /* now test setting a few values */
         {
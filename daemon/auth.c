@@ -854,36 +854,77 @@ mdm_auth_user_remove (MdmDisplay *d, uid_t user)
 	d->userauth = NULL;
 }
 
-static gboolean
-memory_same (const char *sa, int lena, const char *sb, int lenb)
+/*
+ * Everything in an Xauth entry except the cookie itself, so that
+ * entries for the same display compare equal no matter what cookie
+ * they carry.
+ */
+static GBytes *
+auth_key (Xauth *xa)
 {
-	if (lena == lenb) {
-		if (lena == 0)
-			return TRUE;
-		/* sanity */
-		if G_UNLIKELY (sa == NULL || sb == NULL)
-			return FALSE;
-		return memcmp (sa, sb, lena) == 0;
-	} else {
-		return FALSE;
-	}
+	GString *key;
+	gsize len;
+
+	key = g_string_sized_new (32 + xa->address_length +
+				  xa->number_length + xa->name_length);
+	g_string_append_printf (key, "%u:%u:", (guint)xa->family,
+				(guint)xa->address_length);
+	g_string_append_len (key, xa->address, xa->address_length);
+	g_string_append_printf (key, ":%u:", (guint)xa->number_length);
+	g_string_append_len (key, xa->number, xa->number_length);
+	g_string_append_printf (key, ":%u:", (guint)xa->name_length);
+	g_string_append_len (key, xa->name, xa->name_length);
+
+	len = key->len;
+	return g_bytes_new_take (g_string_free (key, FALSE), len);
 }
 
+/*
+ * TRUE for an entry of ours, that is one with the same family, address
+ * and cookie type as the ones we write, for a display that has no
+ * X server running any more.
+ */
 static gboolean
-auth_same_except_data (Xauth *xa, Xauth *xb)
+auth_is_stale (MdmDisplay *d, Xauth *xa)
 {
-	if (xa->family == xb->family &&
-	    memory_same (xa->number, xa->number_length,
-			 xb->number, xb->number_length) &&
-	    memory_same (xa->name, xa->name_length,
-			 xb->name, xb->name_length) &&
-	    memory_same (xa->address, xa->address_length,
-			 xb->address, xb->address_length))
-		return TRUE;
-	else
+	GSList *li;
+	char number[16];
+	char buf[32];
+	char *end;
+	long n;
+
+	if (xa->number_length <= 0 ||
+	    xa->number_length >= (int) sizeof (number))
 		return FALSE;
-}
 
+	for (li = d->local_auths; li != NULL; li = li->next) {
+		Xauth *xb = li->data;
+
+		if (xa->family == xb->family &&
+		    xa->address_length == xb->address_length &&
+		    xa->name_length == xb->name_length &&
+		    memcmp (xa->address, xb->address, xa->address_length) == 0 &&
+		    memcmp (xa->name, xb->name, xa->name_length) == 0)
+			break;
+	}
+	if (li == NULL)
+		return FALSE;
+
+	memcpy (number, xa->number, xa->number_length);
+	number[xa->number_length] = '\0';
+	n = strtol (number, &end, 10);
+	if (end == number || *end != '\0' || n < 0)
+		return FALSE;
+
+	g_snprintf (buf, sizeof (buf), "/tmp/.X%ld-lock", n);
+	if (g_access (buf, F_OK) == 0)
+		return FALSE;
+	g_snprintf (buf, sizeof (buf), "/tmp/.X11-unix/X%ld", n);
+	if (g_access (buf, F_OK) == 0)
+		return FALSE;
+
+	return TRUE;
+}
 
 /**
  * mdm_auth_purge:
@@ -892,75 +933,112 @@ auth_same_except_data (Xauth *xa, Xauth *xb)
  * @remove_when_empty: remove the file when empty
  *
  * Remove all cookies referring to this display a cookie file.
+ *
+ * The entries we keep are copied to a new file next to the old one,
+ * which then replaces it, so readers never see a half written file.
+ * Returns the new file, open for appending, or NULL if it was removed
+ * for being empty.
  */
 
 static FILE *
 mdm_auth_purge (MdmDisplay *d, FILE *af, gboolean remove_when_empty)
 {
 	Xauth *xa;
-	GSList *keep = NULL, *li;
-	int cnt;
+	GHashTable *purge;
+	GSList *li;
+	gboolean compact;
+	char *tmpname;
+	FILE *tmpf;
+	int tmpfd;
+	int kept = 0, dropped = 0;
+	gboolean ok = TRUE;
 
 	if G_UNLIKELY (!d || !af)
 		return af;
 
 	mdm_debug ("mdm_auth_purge: %s", d->name);
 
-	fseek (af, 0L, SEEK_SET);
+	tmpname = g_strconcat (d->userauth, "-mdmXXXXXX", NULL);
+	VE_IGNORE_EINTR (tmpfd = g_mkstemp_full (tmpname, O_RDWR, 0600));
+	tmpf = NULL;
+	if (tmpfd >= 0)
+		VE_IGNORE_EINTR (tmpf = fdopen (tmpfd, "w+"));
+	if G_UNLIKELY (tmpf == NULL) {
+		/* Leave the old entries be, we just append to them */
+		mdm_error ("mdm_auth_purge: Cannot create %s: %s", tmpname, strerror (errno));
+		if (tmpfd >= 0) {
+			VE_IGNORE_EINTR (close (tmpfd));
+			VE_IGNORE_EINTR (g_unlink (tmpname));
+		}
+		g_free (tmpname);
+		return af;
+	}
+
+	/* We look at the current auths, but those may have different
+	   cookies then what is in the file, so don't compare those, but
+	   we wish to purge all the entries that we'd normally write */
+	purge = g_hash_table_new_full (g_bytes_hash, g_bytes_equal,
+				       (GDestroyNotify) g_bytes_unref, NULL);
+	for (li = d->local_auths; li != NULL; li = li->next)
+		g_hash_table_add (purge, auth_key (li->data));
 
-	/* Read the user's entire Xauth file into memory to avoid
-	 * temporary file issues. Then remove any instance of this display
-	 * in the cookie jar... */
+	compact = mdm_daemon_config_get_value_bool (MDM_KEY_PURGE_STALE_USER_AUTH);
 
-	cnt = 0;
+	fseek (af, 0L, SEEK_SET);
 
 	while ( (xa = XauReadAuth (af)) != NULL ) {
-		GSList *li;
-		/* We look at the current auths, but those may
-		   have different cookies then what is in the file,
-		   so don't compare those, but we wish to purge all
-		   the entries that we'd normally write */
-		for (li = d->local_auths; li != NULL; li = li->next) {
-			Xauth *xb = li->data;
-			if (auth_same_except_data (xa, xb)) {
-				XauDisposeAuth (xa);
-				xa = NULL;
-				break;
-			}
+		GBytes *key = auth_key (xa);
+
+		if (g_hash_table_contains (purge, key) ||
+		    (compact && auth_is_stale (d, xa))) {
+			dropped++;
+		} else {
+			if G_UNLIKELY ( ! XauWriteAuth (tmpf, xa))
+				ok = FALSE;
+			kept++;
 		}
-		if (xa != NULL)
-			keep = g_slist_append (keep, xa);
 
-		/* just being ultra anal */
-		cnt++;
-		if (cnt > 500)
-			break;
+		g_bytes_unref (key);
+		XauDisposeAuth (xa);
+	}
+
+	g_hash_table_destroy (purge);
+
+	if G_UNLIKELY (fflush (tmpf) != 0 || ferror (tmpf))
+		ok = FALSE;
+
+	mdm_debug ("mdm_auth_purge: Kept %d entries, dropped %d", kept, dropped);
+
+	if G_UNLIKELY ( ! ok) {
+		mdm_error ("mdm_auth_purge: Could not write %s: %s", tmpname, strerror (errno));
+		VE_IGNORE_EINTR (fclose (tmpf));
+		VE_IGNORE_EINTR (g_unlink (tmpname));
+		g_free (tmpname);
+		return af;
 	}
 
 	VE_IGNORE_EINTR (fclose (af));
 
 	if (remove_when_empty &&
-	    keep == NULL) {
+	    kept == 0) {
+		VE_IGNORE_EINTR (fclose (tmpf));
+		VE_IGNORE_EINTR (g_unlink (tmpname));
 		VE_IGNORE_EINTR (g_remove (d->userauth));
+		g_free (tmpname);
 		return NULL;
 	}
 
-	af = mdm_safe_fopen_w (d->userauth, 0600);
-
-	/* Write out remaining entries */
-	for (li = keep; li != NULL; li = li->next) {
-		/* FIXME: is this correct, if we can't open
-		 * this is quite bad isn't it ... */
-		if G_LIKELY (af != NULL)
-			XauWriteAuth (af, li->data);
-		/* FIXME: what about errors? */
-		XauDisposeAuth (li->data);
-		li->data = NULL;
+	if G_UNLIKELY (g_rename (tmpname, d->userauth) != 0) {
+		mdm_error ("mdm_auth_purge: Could not replace %s: %s", d->userauth, strerror (errno));
+		VE_IGNORE_EINTR (fclose (tmpf));
+		VE_IGNORE_EINTR (g_unlink (tmpname));
+		g_free (tmpname);
+		return mdm_safe_fopen_ap (d->userauth, 0600);
 	}
 
-	g_slist_free (keep);
+	g_free (tmpname);
 
-	return af;
+	return tmpf;
 }
 
 void
@@ -36,8 +36,12 @@
 #include <string.h>
 #include <fcntl.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <errno.h>
+#ifdef HAVE_SYS_RANDOM_H
+#include <sys/random.h>
+#endif
 
 #include "mdm.h"
 #include "md5.h"
@@ -162,20 +166,75 @@ data_seems_random (const char buf[], int size)
 	return FALSE;
 }
 
-static unsigned char old_cookie[16];
+/* Cookies normally come out of a pool that getrandom () fills in one
+ * go.  The pool is locked in memory so that cookies never hit swap,
+ * and every process starts its own so a forked slave never hands out
+ * the cookies of the daemon. */
+#define COOKIE_POOL_SIZE 4096 /* 256 cookies */
+
+static unsigned char cookie_pool[COOKIE_POOL_SIZE];
+static gsize cookie_pool_left = 0;
+static pid_t cookie_pool_pid = 0;
+static gboolean cookie_pool_enabled = TRUE;
+
+static gboolean
+cookie_pool_get (unsigned char cookie[16])
+{
+#ifdef HAVE_GETRANDOM
+	ssize_t r;
+
+	if ( ! cookie_pool_enabled)
+		return FALSE;
+
+	if (cookie_pool_pid != getpid ()) {
+		memset (cookie_pool, 0, sizeof (cookie_pool));
+		cookie_pool_left = 0;
+		cookie_pool_pid = getpid ();
+		/* not fatal, we just may end up in swap */
+		mlock (cookie_pool, sizeof (cookie_pool));
+	}
+
+	if (cookie_pool_left < 16) {
+		/* Never block, before the kernel pool is ready (early
+		 * boot) we rather take the slow way */
+		VE_IGNORE_EINTR (r = getrandom (cookie_pool, sizeof (cookie_pool), GRND_NONBLOCK));
+		if (r < 16) {
+			if (r < 0 && errno == ENOSYS)
+				cookie_pool_enabled = FALSE;
+			return FALSE;
+		}
+		cookie_pool_left = r - (r % 16);
+	}
+
+	cookie_pool_left -= 16;
+	memcpy (cookie, cookie_pool + cookie_pool_left, 16);
+	memset (cookie_pool + cookie_pool_left, 0, 16);
+
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
 
 void
-mdm_cookie_generate (char **cookiep,
-		     char **bcookiep)
+mdm_cookie_set_pool (gboolean enabled)
+{
+	cookie_pool_enabled = enabled;
+}
+
+static unsigned char old_cookie[16];
+
+/* The old way, mix whatever we can find that looks random */
+static void
+cookie_generate_mixed (unsigned char digest[16])
 {
 	int i;
 	struct MdmMD5Context ctx;
-	unsigned char digest[16];
 	unsigned char buf[MAXBUFFERSIZE];
 	int fd;
 	pid_t pid;
 	int r;
-	char cookie[40]; /* 2*16 == 32, so 40 is enough */
+	char cookie[40];
 
 	cookie[0] = '\0';
 
@@ -252,15 +311,26 @@ mdm_cookie_generate (char **cookiep,
 	}
 
 	mdm_md5_final (digest, &ctx);
+}
 
-	for (i = 0; i < 16; i++) {
-		char sub[3];
-		g_snprintf (sub, sizeof (sub), "%02x", (guint)digest[i]);
-		strcat (cookie, sub);
-	}
+void
+mdm_cookie_generate (char **cookiep,
+		     char **bcookiep)
+{
+	static const char hexdigits[] = "0123456789abcdef";
+	unsigned char digest[16];
+	int i;
+
+	if ( ! cookie_pool_get (digest))
+		cookie_generate_mixed (digest);
 
 	if (cookiep != NULL) {
-		*cookiep = g_strdup (cookie);
+		*cookiep = g_new (char, 2*16 + 1);
+		for (i = 0; i < 16; i++) {
+			(*cookiep)[2*i] = hexdigits[digest[i] >> 4];
+			(*cookiep)[2*i + 1] = hexdigits[digest[i] & 0xf];
+		}
+		(*cookiep)[2*16] = '\0';
 	}
 
 	if (bcookiep != NULL) {
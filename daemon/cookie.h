@@ -22,6 +22,10 @@
 void mdm_cookie_generate (char **cookie,
                           char **bcookie);
 
+/* The getrandom () pool is on by default, turning it off makes
+ * mdm_cookie_generate always take the old slow path */
+void mdm_cookie_set_pool (gboolean enabled);
+
 /* Add some more time based randomness, should be done
  * at less predictable events */
 void mdm_random_tick (void);
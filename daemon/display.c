@@ -88,6 +88,8 @@ mdm_display_alloc (gint id, const gchar *command, const gchar *device)
     d->servstat = SERVER_DEAD;
     d->sesspid = 0;
     d->slavepid = 0;
+    d->slave_pidfd = -1;
+    d->slave_watch = 0;
     d->type = TYPE_STATIC;
     d->attached = TRUE;
     d->dsp = NULL;
@@ -241,6 +243,71 @@ mdm_display_check_loop (MdmDisplay *disp)
   return TRUE;
 }
 
+/*
+ * The slave exited, reap it right away instead of waiting for the
+ * SIGCHLD to get through the mainloop.
+ */
+static gboolean
+slave_pidfd_handler (GIOChannel   *source,
+		     GIOCondition  cond,
+		     gpointer      data)
+{
+    MdmDisplay *d = data;
+    pid_t pid = d->slavepid;
+    int exitstatus;
+    pid_t ret;
+
+    VE_IGNORE_EINTR (ret = waitpid (pid, &exitstatus, WNOHANG));
+    if (ret == 0)
+	    return TRUE;
+
+    /* this source goes away as we return */
+    d->slave_watch = 0;
+    mdm_display_unwatch_slave (d);
+
+    if (ret == pid)
+	    mdm_cleanup_child (pid, exitstatus);
+
+    return FALSE;
+}
+
+static void
+watch_slave (MdmDisplay *d)
+{
+    GIOChannel *channel;
+
+    d->slave_pidfd = mdm_pidfd_open (d->slavepid);
+    if (d->slave_pidfd < 0)
+	    return;
+
+    channel = g_io_channel_unix_new (d->slave_pidfd);
+    d->slave_watch = g_io_add_watch_full (channel, G_PRIORITY_DEFAULT,
+					  G_IO_IN | G_IO_HUP | G_IO_ERR,
+					  slave_pidfd_handler, d, NULL);
+    g_io_channel_unref (channel);
+}
+
+/**
+ * mdm_display_unwatch_slave:
+ * @d: Pointer to a MdmDisplay struct
+ *
+ * Forget the pidfd of a slave that was reaped
+ */
+
+void
+mdm_display_unwatch_slave (MdmDisplay *d)
+{
+    if (d->slave_watch != 0) {
+	    g_source_remove (d->slave_watch);
+	    d->slave_watch = 0;
+    }
+
+    if (d->slave_pidfd >= 0) {
+	    VE_IGNORE_EINTR (close (d->slave_pidfd));
+	    d->slave_pidfd = -1;
+    }
+}
+
 static void
 whack_old_slave (MdmDisplay *d, gboolean kill_connection)
 {
@@ -274,8 +341,8 @@ wait_again:
 		
 	    if (waitsleep) {
 		    /* wait for some signal, yes this is a race */
-		    mdm_debug ("mdm whack_old_slave: sleeping for 10 seconds");
-		    sleep (10);
+		    mdm_debug ("mdm whack_old_slave: waiting up to 10 seconds");
+		    mdm_pidfd_sleep (d->slave_pidfd, 10);
 		  }
 	    waitsleep = TRUE;
 	    errno = 0;
@@ -313,7 +380,8 @@ wait_again:
 		    d->servpid = 0;
 	    }
     }
-    d->slavepid = 0;
+    mdm_display_unwatch_slave (d);
+    mdm_display_set_slavepid (d, 0);
 }
 
 /**
@@ -355,10 +423,15 @@ mdm_display_manage (MdmDisplay *d)
 
     d->managetime = time (NULL);
 
+    /* Find out once here whether the X server takes -displayfd, so
+     * that every slave does not have to */
+    if (SERVER_IS_LOCAL (d))
+	    mdm_server_probe_displayfd (d);
+
     mdm_debug ("Forking slave process");
 
     /* Fork slave process */
-    pid = d->slavepid = fork ();
+    pid = fork ();
 
     switch (pid) {
 
@@ -375,7 +448,7 @@ mdm_display_manage (MdmDisplay *d)
 	 * default values, we'll make them more fun later */
 	mdm_unset_signals ();
 
-	d->slavepid = getpid ();
+	mdm_display_set_slavepid (d, getpid ());
 	
 	mdm_connection_close (pipeconn);
 	pipeconn = NULL;
@@ -418,15 +491,16 @@ mdm_display_manage (MdmDisplay *d)
 	break;
 
     case -1:
-	d->slavepid = 0;
 	mdm_error ("mdm_display_manage: Failed forking MDM slave process for %s", d->name);
 
 	return FALSE;
 
     default:
 	mdm_debug ("mdm_display_manage: Forked slave: %d", (int)pid);
+	mdm_display_set_slavepid (d, pid);
 	d->master_notify_fd = fds[1];
 	VE_IGNORE_EINTR (close (fds[0]));
+	watch_slave (d);
 	break;
     }
 
@@ -474,6 +548,8 @@ mdm_display_unmanage (MdmDisplay *d)
     whack_old_slave (d, TRUE /* kill_connection */);
     
     d->dispstat = DISPLAY_DEAD;
+    /* it will never send START_NEXT_LOCAL now */
+    d->starting = FALSE;
     if (d->type != TYPE_STATIC)
 		mdm_display_dispose (d);
 
@@ -481,28 +557,6 @@ mdm_display_unmanage (MdmDisplay *d)
 }
 
 
-/* Why recount?  It's just a lot more robust this way and
-   gets around those nasty one off errors and races.  And we never
-   have so many displays that this would get too slow. */
-static void
-count_session_limits (void)
-{
-	GSList *li;
-	GSList *displays;
-
-	displays = mdm_daemon_config_get_display_list ();
-
-	flexi_servers = 0;
-
-	for (li = displays; li != NULL; li = li->next) {
-		MdmDisplay *d = li->data;
-
-		if (SERVER_IS_FLEXI (d)) {
-			flexi_servers++;
-		}
-	}
-}
-
 /**
  * mdm_display_dispose:
  * @d: Pointer to a MdmDisplay struct
@@ -537,13 +591,13 @@ mdm_display_dispose (MdmDisplay *d)
 	    d->master_notify_fd = -1;
     }
 
+    mdm_display_unwatch_slave (d);
+
     mdm_daemon_config_display_list_remove (d);
 
     d->dispstat = DISPLAY_DEAD;
     d->type = -1;
 
-    count_session_limits ();
-
     if (d->name) {
 	mdm_debug ("mdm_display_dispose: Disposing %s", d->name);
 	g_free (d->name);
@@ -636,6 +690,157 @@ mdm_display_dispose (MdmDisplay *d)
 }
 
 
+/*
+ * Indexes of the display list, so that the slave messages and the
+ * flexi server allocation do not have to walk it.  Displays enter them
+ * when they are put in the list, and the setters below keep the keys
+ * up to date while they are there.  Only local displays have their
+ * display number indexed, and only VTs that are set.
+ */
+static GHashTable *displays_by_slavepid = NULL;
+static GHashTable *displays_by_dispnum  = NULL;
+static GHashTable *displays_by_vt       = NULL;
+/* keyed by d->name itself, so take it out before the name changes */
+static GHashTable *displays_by_name     = NULL;
+
+static void
+index_insert (GHashTable **index, int key, MdmDisplay *d)
+{
+    if (*index == NULL)
+	    *index = g_hash_table_new (NULL, NULL);
+
+    g_hash_table_insert (*index, GINT_TO_POINTER (key), d);
+}
+
+static void
+index_remove (GHashTable *index, int key, MdmDisplay *d)
+{
+    /* some other display may have taken over the key */
+    if (index != NULL &&
+	g_hash_table_lookup (index, GINT_TO_POINTER (key)) == d)
+	    g_hash_table_remove (index, GINT_TO_POINTER (key));
+}
+
+static MdmDisplay *
+index_lookup (GHashTable *index, int key)
+{
+    if (index == NULL)
+	    return NULL;
+
+    return g_hash_table_lookup (index, GINT_TO_POINTER (key));
+}
+
+/**
+ * mdm_display_index_add:
+ * @d: Pointer to a MdmDisplay struct
+ *
+ * Called when d is put in the display list
+ */
+
+void
+mdm_display_index_add (MdmDisplay *d)
+{
+    if (d->indexed)
+	    return;
+    d->indexed = TRUE;
+
+    if (d->slavepid > 0)
+	    index_insert (&displays_by_slavepid, d->slavepid, d);
+    if (SERVER_IS_LOCAL (d))
+	    index_insert (&displays_by_dispnum, d->dispnum, d);
+    if (d->vt > 0)
+	    index_insert (&displays_by_vt, d->vt, d);
+    if (d->name != NULL) {
+	    if (displays_by_name == NULL)
+		    displays_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+	    g_hash_table_insert (displays_by_name, d->name, d);
+    }
+
+    if (SERVER_IS_FLEXI (d))
+	    flexi_servers++;
+}
+
+/**
+ * mdm_display_index_remove:
+ * @d: Pointer to a MdmDisplay struct
+ *
+ * Called when d is taken out of the display list
+ */
+
+void
+mdm_display_index_remove (MdmDisplay *d)
+{
+    if ( ! d->indexed)
+	    return;
+    d->indexed = FALSE;
+
+    if (d->slavepid > 0)
+	    index_remove (displays_by_slavepid, d->slavepid, d);
+    if (SERVER_IS_LOCAL (d))
+	    index_remove (displays_by_dispnum, d->dispnum, d);
+    if (d->vt > 0)
+	    index_remove (displays_by_vt, d->vt, d);
+    if (d->name != NULL && displays_by_name != NULL &&
+	g_hash_table_lookup (displays_by_name, d->name) == d)
+	    g_hash_table_remove (displays_by_name, d->name);
+
+    if (SERVER_IS_FLEXI (d))
+	    flexi_servers--;
+}
+
+void
+mdm_display_set_slavepid (MdmDisplay *d, pid_t pid)
+{
+    if (d->indexed && d->slavepid > 0)
+	    index_remove (displays_by_slavepid, d->slavepid, d);
+
+    d->slavepid = pid;
+
+    if (d->indexed && d->slavepid > 0)
+	    index_insert (&displays_by_slavepid, d->slavepid, d);
+}
+
+void
+mdm_display_set_dispnum (MdmDisplay *d, int dispnum)
+{
+    if (d->indexed && SERVER_IS_LOCAL (d))
+	    index_remove (displays_by_dispnum, d->dispnum, d);
+
+    d->dispnum = dispnum;
+
+    if (d->indexed && SERVER_IS_LOCAL (d))
+	    index_insert (&displays_by_dispnum, d->dispnum, d);
+}
+
+void
+mdm_display_set_name (MdmDisplay *d, const char *name)
+{
+    if (d->indexed && d->name != NULL && displays_by_name != NULL &&
+	g_hash_table_lookup (displays_by_name, d->name) == d)
+	    g_hash_table_remove (displays_by_name, d->name);
+
+    g_free (d->name);
+    d->name = g_strdup (name);
+
+    if (d->indexed && d->name != NULL) {
+	    if (displays_by_name == NULL)
+		    displays_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+	    g_hash_table_insert (displays_by_name, d->name, d);
+    }
+}
+
+void
+mdm_display_set_vt (MdmDisplay *d, int vt)
+{
+    if (d->indexed && d->vt > 0)
+	    index_remove (displays_by_vt, d->vt, d);
+
+    d->vt = vt;
+
+    if (d->indexed && d->vt > 0)
+	    index_insert (&displays_by_vt, d->vt, d);
+}
+
 /**
  * mdm_display_lookup:
  * @pid: pid of slave process to look up
@@ -646,22 +851,55 @@ mdm_display_dispose (MdmDisplay *d)
 MdmDisplay *
 mdm_display_lookup (pid_t pid)
 {
-    GSList *li;
-    GSList *displays;
+    if (pid <= 0)
+	    return NULL;
+
+    return index_lookup (displays_by_slavepid, pid);
+}
 
-    displays = mdm_daemon_config_get_display_list ();
+/**
+ * mdm_display_lookup_dispnum:
+ * @dispnum: display number to look up
+ *
+ * Return the local display with that number
+ */
 
-    /* Find slave in display list */
-    for (li = displays; li != NULL; li = li->next) {
-	    MdmDisplay *d = li->data;
+MdmDisplay *
+mdm_display_lookup_dispnum (int dispnum)
+{
+    return index_lookup (displays_by_dispnum, dispnum);
+}
 
-	    if (d != NULL &&
-		pid == d->slavepid)
-		    return d;
-    }
-     
-    /* Slave not found */
-    return NULL;
+/**
+ * mdm_display_lookup_name:
+ * @name: display name to look up
+ *
+ * Return the display with that name
+ */
+
+MdmDisplay *
+mdm_display_lookup_name (const char *name)
+{
+    if (name == NULL || displays_by_name == NULL)
+	    return NULL;
+
+    return g_hash_table_lookup (displays_by_name, name);
+}
+
+/**
+ * mdm_display_lookup_vt:
+ * @vt: virtual terminal to look up
+ *
+ * Return the display running on vt
+ */
+
+MdmDisplay *
+mdm_display_lookup_vt (int vt)
+{
+    if (vt <= 0)
+	    return NULL;
+
+    return index_lookup (displays_by_vt, vt);
 }
 
 
@@ -63,12 +63,14 @@ struct _MdmDisplay
 	char *windowpath; /* path to server "window" */
 
 	guint8 dispstat;
-	guint16 dispnum;
+	guint16 dispnum;  /* set with mdm_display_set_dispnum */
+	gboolean indexed; /* in the display list indexes */
 
 	gboolean logged_in; /* TRUE if someone is logged in */
 	char *login;
 
 	gboolean attached;  /* Display is physically attached to the machine. */
+	gboolean pooled;    /* Spare flexi display nobody has claimed yet */
 
 	gboolean handled;
 	gboolean tcp_disallowed;
@@ -106,7 +108,9 @@ struct _MdmDisplay
 	int lrh_offsetx; /* lower right hand corner x offset */
 	int lrh_offsety; /* lower right hand corner y offset */
 
-	pid_t slavepid;
+	pid_t slavepid;   /* set with mdm_display_set_slavepid */
+	int slave_pidfd;  /* -1 where the kernel has no pidfds */
+	guint slave_watch;
 	pid_t greetpid;
 	pid_t sesspid;
 	pid_t fbconsolepid;
@@ -159,12 +163,14 @@ struct _MdmDisplay
 
 	/* ALL LOCAL TYPE (static, flexi) */
 
-	int vt;     /* The VT number used when starting via MDM */
+	int vt;     /* The VT number used when starting via MDM,
+		       set with mdm_display_set_vt */
 	int vtnum;  /* The VT number of the display */
 	pid_t servpid;
 	guint8 servstat;
 	gchar *command;
 	time_t starttime;
+	gint64 servstart_usec; /* how long the last X server took to get ready */
 	/* order in the Xservers file for sessreg, -1 if unset yet */
 	int x_servers_order;
 
@@ -173,6 +179,9 @@ struct _MdmDisplay
 	gboolean busy_display; /* only needed on static displays since flexi try another */
 	time_t last_x_failed;
 	int x_faileds;
+	gboolean starting;   /* started and has not yet sent START_NEXT_LOCAL */
+	int start_vt;        /* VT the daemon picked for a parallel start */
+	gint64 bringup_time; /* when it was started, for the bring-up stats */
 
 	/* FLEXI TYPE */
 
@@ -187,6 +196,16 @@ gboolean    mdm_display_manage   (MdmDisplay *d);
 void        mdm_display_dispose  (MdmDisplay *d);
 void        mdm_display_unmanage (MdmDisplay *d);
 MdmDisplay *mdm_display_lookup   (pid_t pid);
+MdmDisplay *mdm_display_lookup_dispnum (int dispnum);
+MdmDisplay *mdm_display_lookup_vt (int vt);
+MdmDisplay *mdm_display_lookup_name (const char *name);
+void        mdm_display_index_add    (MdmDisplay *d);
+void        mdm_display_index_remove (MdmDisplay *d);
+void        mdm_display_set_slavepid (MdmDisplay *d, pid_t pid);
+void        mdm_display_set_dispnum  (MdmDisplay *d, int dispnum);
+void        mdm_display_set_name     (MdmDisplay *d, const char *name);
+void        mdm_display_set_vt       (MdmDisplay *d, int vt);
+void        mdm_display_unwatch_slave (MdmDisplay *d);
 
 #endif /* _MDM_DISPLAY_H */
 
@@ -298,6 +298,63 @@ mdm_get_empty_vt_argument (int *fd, int *vt)
 		return g_strdup_printf ("vt%d", *vt);
 }
 
+char *
+mdm_get_vt_argument (int vtno, int *fd, int *vt)
+{
+	*fd = -1;
+
+	if ( ! mdm_daemon_config_get_value_bool (MDM_KEY_VT_ALLOCATION) ||
+	    mdm_get_free_vt_from (vtno) != vtno)
+		return NULL;
+
+	*fd = open_vt (vtno);
+	if (*fd < 0)
+		return NULL;
+
+	*vt = vtno;
+	return g_strdup_printf ("vt%d", vtno);
+}
+
+int
+mdm_get_free_vt_from (int vtno)
+{
+#if defined (MDM_USE_SYS_VT)
+	int fd;
+	unsigned short vtmask;
+	struct vt_stat vtstat;
+
+	if (vtno <= 0)
+		return -1;
+
+	do {
+		errno = 0;
+		fd = open (MDMCONSOLEDEVICE,
+			   O_WRONLY
+#ifdef O_NOCTTY
+			   |O_NOCTTY
+#endif
+			   , 0);
+	} while G_UNLIKELY (errno == EINTR);
+	if (fd < 0)
+		return -1;
+
+	if (ioctl (fd, VT_GETSTATE, &vtstat) < 0) {
+		VE_IGNORE_EINTR (close (fd));
+		return -1;
+	}
+	VE_IGNORE_EINTR (close (fd));
+
+	for (vtmask = 1 << vtno; vtstat.v_state & vtmask; vtno++, vtmask <<= 1);
+	if (!vtmask)
+		return -1;
+
+	return vtno;
+#else
+	/* VT_OPENQRY only ever tells us the first free one */
+	return -1;
+#endif
+}
+
 /* change to an existing vt */
 void
 mdm_change_vt (int vt)
@@ -387,6 +444,20 @@ mdm_get_empty_vt_argument (int *fd, int *vt)
 	return NULL;
 }
 
+char *
+mdm_get_vt_argument (int vtno, int *fd, int *vt)
+{
+	*fd = -1;
+	*vt = -1;
+	return NULL;
+}
+
+int
+mdm_get_free_vt_from (int vtno)
+{
+	return -1;
+}
+
 void
 mdm_change_vt (int vt)
 {
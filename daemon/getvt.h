@@ -43,6 +43,13 @@
  * It can be set to -1 if nothing could be opened. */
 char *	mdm_get_empty_vt_argument	(int *fd,
 					 int *vt);
+/* Same as above but for a given vt, returns NULL if it is taken */
+char *	mdm_get_vt_argument		(int vtno,
+					 int *fd,
+					 int *vt);
+/* Returns the first vt from vtno on that nothing has open, or -1
+ * if we can't tell */
+int	mdm_get_free_vt_from		(int vtno);
 
 /* Change to the specified virtual terminal */
 void	mdm_change_vt			(int vt);
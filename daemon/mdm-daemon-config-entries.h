@@ -72,6 +72,7 @@ typedef enum {
 	MDM_ID_USER_AUTHDIR,
 	MDM_ID_USER_AUTHDIR_FALLBACK,
 	MDM_ID_USER_AUTHFILE,
+	MDM_ID_PURGE_STALE_USER_AUTH,
 	MDM_ID_USER,
 	MDM_ID_CONSOLE_NOTIFY,
 	MDM_ID_DOUBLE_LOGIN_WARNING,
@@ -85,10 +86,13 @@ typedef enum {
 	MDM_ID_FLEXI_REAP_DELAY_MINUTES,
 	MDM_ID_STANDARD_XSERVER,
 	MDM_ID_FLEXIBLE_XSERVERS,
+	MDM_ID_FLEXI_POOL_SIZE,
+	MDM_ID_STATIC_START_CONCURRENCY,
 	MDM_ID_FIRST_VT,
 	MDM_ID_VT_ALLOCATION,
 	MDM_ID_CONSOLE_CANNOT_HANDLE,
 	MDM_ID_XSERVER_TIMEOUT,
+	MDM_ID_SLAVE_ACK_TIMEOUT,
 	MDM_ID_SERVER_PREFIX,
 	MDM_ID_SERVER_NAME,
 	MDM_ID_SERVER_COMMAND,
@@ -119,6 +123,8 @@ typedef enum {
 	MDM_ID_EXCLUDE,
 	MDM_ID_INCLUDE_ALL,
 	MDM_ID_MINIMAL_UID,
+	MDM_ID_MAX_USERS,
+	MDM_ID_USER_LIST_CACHE_TTL,
 	MDM_ID_DEFAULT_FACE,
 	MDM_ID_GLOBAL_FACE_DIR,
     MDM_ID_GNOME_ACCOUNTS_SERVICE_FACE_DIR,
@@ -280,6 +286,7 @@ static const MdmConfigEntry mdm_daemon_config_entries [] = {
 	{ MDM_CONFIG_GROUP_DAEMON, "UserAuthDir", MDM_CONFIG_VALUE_STRING, "", MDM_ID_USER_AUTHDIR },
 	{ MDM_CONFIG_GROUP_DAEMON, "UserAuthFBDir", MDM_CONFIG_VALUE_STRING, "/tmp", MDM_ID_USER_AUTHDIR_FALLBACK },
 	{ MDM_CONFIG_GROUP_DAEMON, "UserAuthFile", MDM_CONFIG_VALUE_STRING, ".Xauthority", MDM_ID_USER_AUTHFILE },
+	{ MDM_CONFIG_GROUP_DAEMON, "PurgeStaleUserAuth", MDM_CONFIG_VALUE_BOOL, "false", MDM_ID_PURGE_STALE_USER_AUTH },
 	{ MDM_CONFIG_GROUP_DAEMON, "ConsoleNotify", MDM_CONFIG_VALUE_BOOL, "true", MDM_ID_CONSOLE_NOTIFY },
 
 	{ MDM_CONFIG_GROUP_DAEMON, "DoubleLoginWarning", MDM_CONFIG_VALUE_BOOL, "true", MDM_ID_DOUBLE_LOGIN_WARNING },
@@ -297,6 +304,8 @@ static const MdmConfigEntry mdm_daemon_config_entries [] = {
 
 	{ MDM_CONFIG_GROUP_DAEMON, "StandardXServer", MDM_CONFIG_VALUE_STRING, X_SERVER, MDM_ID_STANDARD_XSERVER },
 	{ MDM_CONFIG_GROUP_DAEMON, "FlexibleXServers", MDM_CONFIG_VALUE_INT, "5", MDM_ID_FLEXIBLE_XSERVERS },
+	{ MDM_CONFIG_GROUP_DAEMON, "FlexiPoolSize", MDM_CONFIG_VALUE_INT, "0", MDM_ID_FLEXI_POOL_SIZE },
+	{ MDM_CONFIG_GROUP_DAEMON, "StaticStartConcurrency", MDM_CONFIG_VALUE_INT, "1", MDM_ID_STATIC_START_CONCURRENCY },
 
 	/* Keys for automatic VT allocation rather then letting it up to the X server */
 	{ MDM_CONFIG_GROUP_DAEMON, "FirstVT", MDM_CONFIG_VALUE_INT, "7", MDM_ID_FIRST_VT },
@@ -307,6 +316,9 @@ static const MdmConfigEntry mdm_daemon_config_entries [] = {
 	/* How long to wait before assuming an Xserver has timed out */
 	{ MDM_CONFIG_GROUP_DAEMON, "MdmXserverTimeout", MDM_CONFIG_VALUE_INT, "10", MDM_ID_XSERVER_TIMEOUT },
 
+	/* How long a slave waits for the daemon to ack a message */
+	{ MDM_CONFIG_GROUP_DAEMON, "SlaveAckTimeout", MDM_CONFIG_VALUE_INT, "10", MDM_ID_SLAVE_ACK_TIMEOUT },
+
 	{ MDM_CONFIG_GROUP_DAEMON, "SystemCommandsInMenu", MDM_CONFIG_VALUE_STRING_ARRAY, "HALT;REBOOT;SUSPEND", MDM_ID_SYSTEM_COMMANDS_IN_MENU },
 	{ MDM_CONFIG_GROUP_DAEMON, "AllowLogoutActions", MDM_CONFIG_VALUE_STRING_ARRAY, "HALT;REBOOT;SUSPEND", MDM_ID_ALLOW_LOGOUT_ACTIONS },
 	{ MDM_CONFIG_GROUP_DAEMON, "RBACSystemCommandKeys", MDM_CONFIG_VALUE_STRING_ARRAY, MDM_RBAC_SYSCMD_KEYS, MDM_ID_RBAC_SYSTEM_COMMAND_KEYS },
@@ -338,6 +350,8 @@ static const MdmConfigEntry mdm_daemon_config_entries [] = {
 	{ MDM_CONFIG_GROUP_GREETER, "Exclude", MDM_CONFIG_VALUE_STRING, "bin,daemon,adm,lp,sync,shutdown,halt,mail,news,uucp,operator,nobody,mdm,postgres,pvm,rpm,nfsnobody,pcap", MDM_ID_EXCLUDE },
 	{ MDM_CONFIG_GROUP_GREETER, "IncludeAll", MDM_CONFIG_VALUE_BOOL, "false", MDM_ID_INCLUDE_ALL },
 	{ MDM_CONFIG_GROUP_GREETER, "MinimalUID", MDM_CONFIG_VALUE_INT, "100", MDM_ID_MINIMAL_UID },
+	{ MDM_CONFIG_GROUP_GREETER, "MaxUsers", MDM_CONFIG_VALUE_INT, "0", MDM_ID_MAX_USERS },
+	{ MDM_CONFIG_GROUP_GREETER, "UserListCacheTTL", MDM_CONFIG_VALUE_INT, "3600", MDM_ID_USER_LIST_CACHE_TTL },
 	{ MDM_CONFIG_GROUP_GREETER, "DefaultFace", MDM_CONFIG_VALUE_STRING, PIXMAPDIR "/nobody.png", MDM_ID_DEFAULT_FACE },
 	{ MDM_CONFIG_GROUP_GREETER, "GlobalFaceDir", MDM_CONFIG_VALUE_STRING, DATADIR "/pixmaps/faces/", MDM_ID_GLOBAL_FACE_DIR },
     { MDM_CONFIG_GROUP_GREETER, "GnomeFaceDir", MDM_CONFIG_VALUE_STRING, "/var/lib/AccountsService/icons/", MDM_ID_GNOME_ACCOUNTS_SERVICE_FACE_DIR },
@@ -69,6 +69,7 @@ G_BEGIN_DECLS
 #define MDM_KEY_USER_AUTHDIR "daemon/UserAuthDir="
 #define MDM_KEY_USER_AUTHDIR_FALLBACK "daemon/UserAuthFBDir=/tmp"
 #define MDM_KEY_USER_AUTHFILE "daemon/UserAuthFile=.Xauthority"
+#define MDM_KEY_PURGE_STALE_USER_AUTH "daemon/PurgeStaleUserAuth=false"
 #define MDM_KEY_USER "daemon/User=mdm"
 #define MDM_KEY_CONSOLE_NOTIFY "daemon/ConsoleNotify=true"
 #define MDM_KEY_DOUBLE_LOGIN_WARNING "daemon/DoubleLoginWarning=true"
@@ -82,10 +83,13 @@ G_BEGIN_DECLS
 #define MDM_KEY_FLEXI_REAP_DELAY_MINUTES "daemon/FlexiReapDelayMinutes=0"
 #define MDM_KEY_STANDARD_XSERVER "daemon/StandardXServer=" X_SERVER
 #define MDM_KEY_FLEXIBLE_XSERVERS "daemon/FlexibleXServers=5"
+#define MDM_KEY_FLEXI_POOL_SIZE "daemon/FlexiPoolSize=0"
+#define MDM_KEY_STATIC_START_CONCURRENCY "daemon/StaticStartConcurrency=1"
 #define MDM_KEY_FIRST_VT "daemon/FirstVT=7"
 #define MDM_KEY_VT_ALLOCATION "daemon/VTAllocation=true"
 #define MDM_KEY_CONSOLE_CANNOT_HANDLE "daemon/ConsoleCannotHandle=am,ar,az,bn,el,fa,gu,hi,ja,ko,ml,mr,pa,ta,zh"
 #define MDM_KEY_XSERVER_TIMEOUT "daemon/MdmXserverTimeout=10"
+#define MDM_KEY_SLAVE_ACK_TIMEOUT "daemon/SlaveAckTimeout=10"
 #define MDM_KEY_SYSTEM_COMMANDS_IN_MENU "daemon/SystemCommandsInMenu=HALT;REBOOT;SUSPEND"
 #define MDM_KEY_ALLOW_LOGOUT_ACTIONS "daemon/AllowLogoutActions=HALT;REBOOT;SUSPEND"
 #define MDM_KEY_RBAC_SYSTEM_COMMAND_KEYS "daemon/RBACSystemCommandKeys=" MDM_RBAC_SYSCMD_KEYS
@@ -121,6 +125,8 @@ G_BEGIN_DECLS
 #define MDM_KEY_EXCLUDE "greeter/Exclude=bin,daemon,adm,lp,sync,shutdown,halt,mail,news,uucp,operator,nobody,mdm,postgres,pvm,rpm,nfsnobody,pcap"
 #define MDM_KEY_INCLUDE_ALL "greeter/IncludeAll=false"
 #define MDM_KEY_MINIMAL_UID "greeter/MinimalUID=100"
+#define MDM_KEY_MAX_USERS "greeter/MaxUsers=0"
+#define MDM_KEY_USER_LIST_CACHE_TTL "greeter/UserListCacheTTL=3600"
 #define MDM_KEY_DEFAULT_FACE "greeter/DefaultFace=" PIXMAPDIR "/nobody.png"
 #define MDM_KEY_GLOBAL_FACE_DIR "greeter/GlobalFaceDir=" DATADIR "/pixmaps/faces/"
 #define MDM_KEY_GNOME_ACCOUNTS_SERVICE_FACE_DIR "greeter/GnomeFaceDir=/var/lib/AccountsService/icons/"
@@ -185,6 +191,36 @@ G_BEGIN_DECLS
 #define MDM_NOTIFY_SOFT_RESTART_SERVERS "SOFT_RESTART_SERVERS"
 #define MDM_NOTIFY_GO "GO"
 #define MDM_NOTIFY_TWIDDLE_POINTER "TWIDDLE_POINTER"
+#define MDM_NOTIFY_CLAIMED "CLAIMED" /* a spare flexi display was claimed */
+
+/*
+ * Keys outside the greeter and gui groups that the greeters read.
+ * Together with those two groups this is all the configuration that
+ * is handed out in bulk, through GET_CONFIG_ALL / GET_CONFIG_MULTI
+ * and the snapshot.
+ */
+#define MDM_GREETER_DAEMON_KEYS \
+	MDM_KEY_ADD_GTK_MODULES, \
+	MDM_KEY_ALLOW_ROOT, \
+	MDM_KEY_AUTOMATIC_LOGIN, \
+	MDM_KEY_AUTOMATIC_LOGIN_ENABLE, \
+	MDM_KEY_CONFIGURATOR, \
+	MDM_KEY_DEBUG, \
+	MDM_KEY_DEFAULT_SESSION, \
+	MDM_KEY_FLEXI_REAP_DELAY_MINUTES, \
+	MDM_KEY_HALT, \
+	MDM_KEY_NUMLOCK, \
+	MDM_KEY_RBAC_SYSTEM_COMMAND_KEYS, \
+	MDM_KEY_REBOOT, \
+	MDM_KEY_SELECT_LAST_LOGIN, \
+	MDM_KEY_SERV_AUTHDIR, \
+	MDM_KEY_SESSION_DESKTOP_DIR, \
+	MDM_KEY_SOUND_PROGRAM, \
+	MDM_KEY_SUSPEND, \
+	MDM_KEY_SYSTEM_COMMANDS_IN_MENU, \
+	MDM_KEY_TIMED_LOGIN, \
+	MDM_KEY_TIMED_LOGIN_DELAY, \
+	MDM_KEY_TIMED_LOGIN_ENABLE
 
 G_END_DECLS
 
@@ -60,6 +60,7 @@
 
 #include "mdm-common.h"
 #include "mdm-config.h"
+#include "mdm-config-snapshot.h"
 #include "mdm-log.h"
 #include "mdm-daemon-config.h"
 
@@ -71,6 +72,12 @@ static GSList *displays = NULL;
 static GSList *xservers = NULL;
 
 static gint high_display_num = 0;
+
+static gboolean snapshot_published = FALSE;
+static gboolean snapshot_publishing = FALSE;
+static pid_t snapshot_pid = 0;
+static guint snapshot_republish_id = 0;
+static guint32 snapshot_serial = 0;
 static const char *default_config_file = NULL;
 static char *custom_config_file = NULL;
 
@@ -127,6 +134,184 @@ mdm_daemon_config_get_per_display_custom_config_file (const gchar *display)
 	return g_strdup_printf ("%s%s", custom_config_file, display);
 }
 
+/*
+ * Per-display overlays are parsed once and kept until the file changes.
+ * Every lookup only has to stat the file to revalidate the cached copy.
+ * Only displays we manage, and that have a file, are cached: the name
+ * may come from any client of the socket.  Other names share a single
+ * scratch overlay.
+ */
+typedef struct {
+	char     *file;
+	GKeyFile *key_file;
+	struct timespec mtime;
+	off_t     size;
+	ino_t     ino;
+} MdmDisplayOverlay;
+
+static GHashTable *display_overlays = NULL;
+static MdmDisplayOverlay *scratch_overlay = NULL;
+
+static void
+display_overlay_free (MdmDisplayOverlay *overlay)
+{
+	g_free (overlay->file);
+	if (overlay->key_file != NULL)
+		g_key_file_free (overlay->key_file);
+	g_slice_free (MdmDisplayOverlay, overlay);
+}
+
+static gboolean
+display_is_managed (const char *name)
+{
+	return mdm_display_lookup_name (name) != NULL;
+}
+
+/* Editors can write a file twice within a second, so go by nanoseconds */
+static gboolean
+display_overlay_stamp_equal (const MdmDisplayOverlay *overlay,
+			     const struct timespec   *mtime,
+			     off_t                    size,
+			     ino_t                    ino)
+{
+	return overlay->mtime.tv_sec == mtime->tv_sec &&
+	       overlay->mtime.tv_nsec == mtime->tv_nsec &&
+	       overlay->size == size &&
+	       overlay->ino == ino;
+}
+
+static gboolean
+republish_snapshot_idle (gpointer data)
+{
+	snapshot_republish_id = 0;
+	mdm_daemon_config_republish_snapshot ();
+	return FALSE;
+}
+
+/*
+ * A per-display file was created, edited or removed behind the
+ * snapshot's back.  Greeters notice from the file stamp and fall back
+ * to GET_CONFIG, rewrite the snapshot so they can stop doing that.
+ */
+static void
+schedule_snapshot_republish (void)
+{
+	if (! snapshot_published ||
+	    snapshot_publishing ||
+	    snapshot_pid != getpid () ||
+	    snapshot_republish_id != 0)
+		return;
+
+	snapshot_republish_id = g_idle_add (republish_snapshot_idle, NULL);
+}
+
+/* Reparses the overlay if its file changed, returns FALSE if it is gone */
+static gboolean
+display_overlay_revalidate (MdmDisplayOverlay *overlay)
+{
+	struct stat s;
+
+	if (stat (overlay->file, &s) != 0) {
+		if (overlay->key_file != NULL) {
+			g_key_file_free (overlay->key_file);
+			overlay->key_file = NULL;
+		}
+		overlay->mtime.tv_sec = 0;
+		overlay->mtime.tv_nsec = 0;
+		return FALSE;
+	}
+
+	if (overlay->key_file != NULL &&
+	    display_overlay_stamp_equal (overlay, &s.st_mtim, s.st_size, s.st_ino)) {
+		return TRUE;
+	}
+
+	mdm_debug ("Loading per display config file %s", overlay->file);
+
+	if (overlay->key_file != NULL)
+		g_key_file_free (overlay->key_file);
+
+	overlay->key_file = mdm_common_config_load (overlay->file, NULL);
+	overlay->mtime = s.st_mtim;
+	overlay->size = s.st_size;
+	overlay->ino = s.st_ino;
+
+	return TRUE;
+}
+
+/**
+ * mdm_daemon_config_get_display_overlay
+ *
+ * Returns the parsed per-display config file for a display, or NULL
+ * if there is none.  The key file is owned by the cache, and for a
+ * display we do not manage it is only good until the next call.
+ */
+static GKeyFile *
+mdm_daemon_config_get_display_overlay (const char *display)
+{
+	MdmDisplayOverlay *overlay;
+	char              *file;
+
+	if (display_overlays == NULL) {
+		display_overlays = g_hash_table_new_full (g_str_hash,
+							  g_str_equal,
+							  (GDestroyNotify)g_free,
+							  (GDestroyNotify)display_overlay_free);
+	}
+
+	overlay = g_hash_table_lookup (display_overlays, display);
+	if (overlay != NULL) {
+		struct timespec mtime = overlay->mtime;
+		off_t  size = overlay->size;
+		ino_t  ino = overlay->ino;
+
+		if (display_overlay_revalidate (overlay)) {
+			if (! display_overlay_stamp_equal (overlay, &mtime, size, ino))
+				schedule_snapshot_republish ();
+			return overlay->key_file;
+		}
+
+		/* File was removed */
+		g_hash_table_remove (display_overlays, display);
+		schedule_snapshot_republish ();
+		return NULL;
+	}
+
+	file = mdm_daemon_config_get_per_display_custom_config_file (display);
+	if (g_access (file, F_OK) != 0) {
+		g_free (file);
+		return NULL;
+	}
+
+	if (display_is_managed (display)) {
+		overlay = g_slice_new0 (MdmDisplayOverlay);
+		overlay->file = file;
+		g_hash_table_insert (display_overlays, g_strdup (display), overlay);
+		/* File was created */
+		schedule_snapshot_republish ();
+	} else {
+		if (scratch_overlay == NULL)
+			scratch_overlay = g_slice_new0 (MdmDisplayOverlay);
+		if (scratch_overlay->file == NULL ||
+		    strcmp (scratch_overlay->file, file) != 0) {
+			g_free (scratch_overlay->file);
+			scratch_overlay->file = file;
+			if (scratch_overlay->key_file != NULL) {
+				g_key_file_free (scratch_overlay->key_file);
+				scratch_overlay->key_file = NULL;
+			}
+		} else {
+			g_free (file);
+		}
+		overlay = scratch_overlay;
+	}
+
+	if (! display_overlay_revalidate (overlay))
+		return NULL;
+
+	return overlay->key_file;
+}
+
 /**
  * mdm_daemon_config_get_custom_config_file
  *
@@ -153,6 +338,8 @@ GSList *
 mdm_daemon_config_display_list_append (MdmDisplay *display)
 {
 	displays = g_slist_append (displays, display);
+	mdm_display_index_add (display);
+	mdm_daemon_config_republish_snapshot ();
 	return displays;
 }
 
@@ -162,6 +349,8 @@ mdm_daemon_config_display_list_insert (MdmDisplay *display)
         displays = g_slist_insert_sorted (displays,
                                           display,
                                           mdm_daemon_config_compare_displays);
+	mdm_display_index_add (display);
+	mdm_daemon_config_republish_snapshot ();
 	return displays;
 }
 
@@ -169,57 +358,129 @@ GSList *
 mdm_daemon_config_display_list_remove (MdmDisplay *display)
 {
 	displays = g_slist_remove (displays, display);
+	mdm_display_index_remove (display);
+	if (display_overlays != NULL && display->name != NULL)
+		g_hash_table_remove (display_overlays, display->name);
+	mdm_daemon_config_republish_snapshot ();
 
 	return displays;
 }
 
-/**
- * mdm_daemon_config_get_value_int
- *
- * Gets an integer configuration option by key.  The option must
- * first be loaded, say, by calling mdm_config_parse.
+/*
+ * Keys are resolved to a handle the first time they are used, so that
+ * the getters below do not have to split the "group/key=default"
+ * string on every call.  Keys that belong to an entry with an id are
+ * then read straight from the id slot of the config.
  */
-gint
-mdm_daemon_config_get_value_int (const char *keystring)
-{
-	gboolean res;
-	MdmConfigValue *value;
+typedef struct {
 	char *group;
 	char *key;
-	int   result;
+	int   id;
+} MdmConfigKeyHandle;
 
-	result = 0;
+static GHashTable *key_handles = NULL;
 
-	res = mdm_common_config_parse_key_string (keystring,
-						  &group,
-						  &key,
-						  NULL,
-						  NULL);
-	if (! res) {
+static void
+key_handle_free (MdmConfigKeyHandle *handle)
+{
+	g_free (handle->group);
+	g_free (handle->key);
+	g_slice_free (MdmConfigKeyHandle, handle);
+}
+
+static const MdmConfigKeyHandle *
+lookup_key_handle (const char *keystring)
+{
+	MdmConfigKeyHandle   *handle;
+	const MdmConfigEntry *entry;
+	char                 *group;
+	char                 *key;
+
+	if (key_handles == NULL) {
+		key_handles = g_hash_table_new_full (g_str_hash,
+						     g_str_equal,
+						     (GDestroyNotify)g_free,
+						     (GDestroyNotify)key_handle_free);
+	}
+
+	handle = g_hash_table_lookup (key_handles, keystring);
+	if (handle != NULL) {
+		return handle;
+	}
+
+	if (! mdm_common_config_parse_key_string (keystring, &group, &key, NULL, NULL)) {
+		g_free (group);
+		g_free (key);
+		return NULL;
+	}
+
+	handle = g_slice_new0 (MdmConfigKeyHandle);
+	handle->group = group;
+	handle->key = key;
+	handle->id = MDM_CONFIG_INVALID_ID;
+
+	entry = mdm_config_lookup_entry (daemon_config, group, key);
+	if (entry != NULL &&
+	    mdm_config_lookup_entry_for_id (daemon_config, entry->id) == entry) {
+		handle->id = entry->id;
+	}
+
+	g_hash_table_insert (key_handles, g_strdup (keystring), handle);
+
+	return handle;
+}
+
+static const MdmConfigValue *
+lookup_value (const char        *keystring,
+	      MdmConfigValueType type,
+	      const char        *type_name)
+{
+	const MdmConfigKeyHandle *handle;
+	const MdmConfigValue     *value;
+	gboolean                  res;
+
+	handle = lookup_key_handle (keystring);
+	if (handle == NULL) {
 		mdm_error ("Could not parse configuration key %s", keystring);
-		goto out;
+		return NULL;
+	}
+
+	if (handle->id != MDM_CONFIG_INVALID_ID) {
+		res = mdm_config_peek_value_for_id (daemon_config, handle->id, &value);
+	} else {
+		res = mdm_config_peek_value (daemon_config, handle->group, handle->key, &value);
 	}
 
-	res = mdm_config_get_value (daemon_config,
-				    group,
-				    key,
-				    &value);
 	if (! res) {
 		mdm_error ("Request for invalid configuration key %s", keystring);
-		goto out;
+		return NULL;
 	}
 
-	if (value->type != MDM_CONFIG_VALUE_INT) {
-		mdm_error ("Request for configuration key %s, but not type INT", keystring);
-		goto out;
+	if (value->type != type) {
+		mdm_error ("Request for configuration key %s, but not type %s", keystring, type_name);
+		return NULL;
 	}
 
-	result = mdm_config_value_get_int (value);
- out:
-	g_free (group);
-	g_free (key);
+	return value;
+}
+
+/**
+ * mdm_daemon_config_get_value_int
+ *
+ * Gets an integer configuration option by key.  The option must
+ * first be loaded, say, by calling mdm_config_parse.
+ */
+gint
+mdm_daemon_config_get_value_int (const char *keystring)
+{
+	const MdmConfigValue *value;
 
-	return result;
+	value = lookup_value (keystring, MDM_CONFIG_VALUE_INT, "INT");
+	if (value == NULL) {
+		return 0;
+	}
+
+	return mdm_config_value_get_int (value);
 }
 
 /**
@@ -231,44 +492,14 @@ mdm_daemon_config_get_value_int (const char *keystring)
 const char *
 mdm_daemon_config_get_value_string (const char *keystring)
 {
-	gboolean res;
-	MdmConfigValue *value;
-	char *group;
-	char *key;
-	const char *result;
-
-	result = NULL;
-
-	res = mdm_common_config_parse_key_string (keystring,
-						  &group,
-						  &key,
-						  NULL,
-						  NULL);
-	if (! res) {
-		mdm_error ("Could not parse configuration key %s", keystring);
-		goto out;
-	}
+	const MdmConfigValue *value;
 
-	res = mdm_config_get_value (daemon_config,
-				    group,
-				    key,
-				    &value);
-	if (! res) {
-		mdm_error ("Request for invalid configuration key %s", keystring);
-		goto out;
-	}
-
-	if (value->type != MDM_CONFIG_VALUE_STRING) {
-		mdm_error ("Request for configuration key %s, but not type STRING", keystring);
-		goto out;
+	value = lookup_value (keystring, MDM_CONFIG_VALUE_STRING, "STRING");
+	if (value == NULL) {
+		return NULL;
 	}
 
-	result = mdm_config_value_get_string (value);
- out:
-	g_free (group);
-	g_free (key);
-
-	return result;
+	return mdm_config_value_get_string (value);
 }
 
 /**
@@ -280,44 +511,14 @@ mdm_daemon_config_get_value_string (const char *keystring)
 const char **
 mdm_daemon_config_get_value_string_array (const char *keystring)
 {
-	gboolean res;
-	MdmConfigValue *value;
-	char *group;
-	char *key;
-	const char **result;
-
-	result = NULL;
-
-	res = mdm_common_config_parse_key_string (keystring,
-						  &group,
-						  &key,
-						  NULL,
-						  NULL);
-	if (! res) {
-		mdm_error ("Could not parse configuration key %s", keystring);
-		goto out;
-	}
-
-	res = mdm_config_get_value (daemon_config,
-				    group,
-				    key,
-				    &value);
-	if (! res) {
-		mdm_error ("Request for invalid configuration key %s", keystring);
-		goto out;
-	}
+	const MdmConfigValue *value;
 
-	if (value->type != MDM_CONFIG_VALUE_STRING_ARRAY) {
-		mdm_error ("Request for configuration key %s, but not type STRING-ARRAY", keystring);
-		goto out;
+	value = lookup_value (keystring, MDM_CONFIG_VALUE_STRING_ARRAY, "STRING-ARRAY");
+	if (value == NULL) {
+		return NULL;
 	}
 
-	result = mdm_config_value_get_string_array (value);
- out:
-	g_free (group);
-	g_free (key);
-
-	return result;
+	return mdm_config_value_get_string_array (value);
 }
 
 /**
@@ -380,44 +581,122 @@ mdm_daemon_config_get_string_for_id (int id)
 gboolean
 mdm_daemon_config_get_value_bool (const char *keystring)
 {
-	gboolean res;
-	MdmConfigValue *value;
-	char *group;
-	char *key;
-	gboolean result;
+	const MdmConfigValue *value;
+
+	value = lookup_value (keystring, MDM_CONFIG_VALUE_BOOL, "BOOLEAN");
+	if (value == NULL) {
+		return FALSE;
+	}
+
+	return mdm_config_value_get_bool (value);
+}
+
+/*
+ * Gets a specific key from an already loaded key file, see
+ * mdm_daemon_config_key_to_string.
+ */
+static gboolean
+key_file_to_string (GKeyFile   *config,
+		    const char *keystring,
+		    char      **retval)
+{
+	MdmConfigValueType    type;
+	gboolean              res;
+	gboolean              ret;
+	char                 *group;
+	char                 *key;
+	char                 *locale;
+	char                 *result;
+	const MdmConfigEntry *entry;
+
+	if (retval != NULL) {
+		*retval = NULL;
+	}
 
-	result = FALSE;
+	ret = FALSE;
+	result = NULL;
 
+	group = key = locale = NULL;
 	res = mdm_common_config_parse_key_string (keystring,
 						  &group,
 						  &key,
-						  NULL,
+						  &locale,
 						  NULL);
+	mdm_debug ("Requesting group=%s key=%s locale=%s", group, key, locale ? locale : "(null)");
+
 	if (! res) {
 		mdm_error ("Could not parse configuration key %s", keystring);
 		goto out;
 	}
 
-	res = mdm_config_get_value (daemon_config,
-				    group,
-				    key,
-				    &value);
-	if (! res) {
+	entry = mdm_config_lookup_entry (daemon_config, group, key);
+	if (entry == NULL) {
 		mdm_error ("Request for invalid configuration key %s", keystring);
 		goto out;
 	}
+	type = entry->type;
 
-	if (value->type != MDM_CONFIG_VALUE_BOOL) {
-		mdm_error ("Request for configuration key %s, but not type BOOLEAN", keystring);
-		goto out;
+	mdm_debug ("Returning value for key <%s>\n", keystring);
+
+	switch (type) {
+	case MDM_CONFIG_VALUE_BOOL:
+		{
+			gboolean value;
+			res = mdm_common_config_get_boolean (config, keystring, &value, NULL);
+			if (res) {
+				if (value) {
+					result = g_strdup ("true");
+				} else {
+					result = g_strdup ("false");
+				}
+			}
+		}
+		break;
+	case MDM_CONFIG_VALUE_INT:
+		{
+			int value;
+			res = mdm_common_config_get_int (config, keystring, &value, NULL);
+			if (res) {
+				result = g_strdup_printf ("%d", value);
+			}
+		}
+		break;
+	case MDM_CONFIG_VALUE_STRING:
+		{
+			char *value;
+			res = mdm_common_config_get_string (config, keystring, &value, NULL);
+			if (res) {
+				result = value;
+			}
+		}
+		break;
+	case MDM_CONFIG_VALUE_LOCALE_STRING:
+		{
+			char *value;
+			res = mdm_common_config_get_string (config, keystring, &value, NULL);
+			if (res) {
+				result = value;
+			}
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (res) {
+		if (retval != NULL) {
+			*retval = g_strdup (result);
+		}
+		ret = TRUE;
 	}
 
-	result = mdm_config_value_get_bool (value);
  out:
+	g_free (result);
 	g_free (group);
 	g_free (key);
+	g_free (locale);
 
-	return result;
+	return ret;
 }
 
 /**
@@ -523,47 +802,45 @@ mdm_daemon_config_key_to_string_per_display (const char *keystring,
 					     const char *display,
 					     char      **retval)
 {
-	char    *file;
-	char    *group;
-	char    *key;
-	gboolean res;
-	gboolean ret;
-
-	ret = FALSE;
+	GKeyFile *config;
+	char     *group;
+	gboolean  per_display;
 
 	*retval = NULL;
-	group = key = NULL;
 
 	if (display == NULL) {
-		goto out;
+		return FALSE;
 	}
 
 	mdm_debug ("Looking up per display value for %s", keystring);
 
-	res = mdm_common_config_parse_key_string (keystring,
-						  &group,
-						  &key,
-						  NULL,
-						  NULL);
-	if (! res) {
-		goto out;
+	/*
+	 * The key may come straight off the socket, so parse it here
+	 * rather than going through lookup_key_handle, which would let
+	 * a client grow the handle cache with arbitrary strings.
+	 */
+	group = NULL;
+	if (! mdm_common_config_parse_key_string (keystring, &group, NULL, NULL, NULL)) {
+		g_free (group);
+		return FALSE;
 	}
 
-	file = mdm_daemon_config_get_per_display_custom_config_file (display);
+	per_display = (strcmp (group, "greeter") == 0 ||
+		       strcmp (group, "gui") == 0 ||
+		       is_key (keystring, MDM_KEY_PAM_STACK));
+	g_free (group);
 
-	if (strcmp (group, "greeter") == 0 ||
-	    strcmp (group, "gui") == 0 ||
-	    is_key (keystring, MDM_KEY_PAM_STACK)) {
-		ret = mdm_daemon_config_key_to_string (file, keystring, retval);
+	if (! per_display) {
+		return FALSE;
 	}
 
-	g_free (file);
-
- out:
-	g_free (group);
-	g_free (key);
+	config = mdm_daemon_config_get_display_overlay (display);
+	/* If file doesn't exist, then just return */
+	if (config == NULL) {
+		return FALSE;
+	}
 
-	return ret;
+	return key_file_to_string (config, keystring, retval);
 }
 
 /**
@@ -580,109 +857,22 @@ mdm_daemon_config_key_to_string (const char *file,
 				 const char *keystring,
 				 char      **retval)
 {
-	GKeyFile             *config;
-	MdmConfigValueType    type;
-	gboolean              res;
-	gboolean              ret;
-	char                 *group;
-	char                 *key;
-	char                 *locale;
-	char                 *result;
-	const MdmConfigEntry *entry;
+	GKeyFile *config;
+	gboolean  ret;
 
 	if (retval != NULL) {
 		*retval = NULL;
 	}
 
-	ret = FALSE;
-	result = NULL;
-
-	group = key = locale = NULL;
-	res = mdm_common_config_parse_key_string (keystring,
-						  &group,
-						  &key,
-						  &locale,
-						  NULL);
-	mdm_debug ("Requesting group=%s key=%s locale=%s", group, key, locale ? locale : "(null)");
-
-	if (! res) {
-		mdm_error ("Could not parse configuration key %s", keystring);
-		goto out;
-	}
-
-	entry = mdm_config_lookup_entry (daemon_config, group, key);
-	if (entry == NULL) {
-		mdm_error ("Request for invalid configuration key %s", keystring);
-		goto out;
-	}
-	type = entry->type;
-
 	config = mdm_common_config_load (file, NULL);
 	/* If file doesn't exist, then just return */
 	if (config == NULL) {
-		goto out;
-	}
-
-	mdm_debug ("Returning value for key <%s>\n", keystring);
-
-	switch (type) {
-	case MDM_CONFIG_VALUE_BOOL:
-		{
-			gboolean value;
-			res = mdm_common_config_get_boolean (config, keystring, &value, NULL);
-			if (res) {
-				if (value) {
-					result = g_strdup ("true");
-				} else {
-					result = g_strdup ("false");
-				}
-			}
-		}
-		break;
-	case MDM_CONFIG_VALUE_INT:
-		{
-			int value;
-			res = mdm_common_config_get_int (config, keystring, &value, NULL);
-			if (res) {
-				result = g_strdup_printf ("%d", value);
-			}
-		}
-		break;
-	case MDM_CONFIG_VALUE_STRING:
-		{
-			char *value;
-			res = mdm_common_config_get_string (config, keystring, &value, NULL);
-			if (res) {
-				result = value;
-			}
-		}
-		break;
-	case MDM_CONFIG_VALUE_LOCALE_STRING:
-		{
-			char *value;
-			res = mdm_common_config_get_string (config, keystring, &value, NULL);
-			if (res) {
-				result = value;
-			}
-		}
-		break;
-	default:
-		break;
+		return FALSE;
 	}
 
-	if (res) {
-		if (retval != NULL) {
-			*retval = g_strdup (result);
-		}
-		ret = TRUE;
-	}
+	ret = key_file_to_string (config, keystring, retval);
 
 	g_key_file_free (config);
- out:
-	g_free (result);
-	g_free (group);
-	g_free (key);
-	g_free (locale);
 
 	return ret;
 }
@@ -775,6 +965,215 @@ mdm_daemon_config_to_string (const char *keystring,
 	return ret;
 }
 
+/**
+ * mdm_daemon_config_to_translated_string
+ *
+ * Returns the best translation of a configuration option for langs,
+ * which lists the languages most preferred first.  A per-display file
+ * is searched before the global configuration, and within each of
+ * them a translation wins over the untranslated value.  Used by MDM's
+ * GET_CONFIG_TRANSLATED socket command.
+ */
+gboolean
+mdm_daemon_config_to_translated_string (const char         *keystring,
+					const char         *display,
+					const char * const *langs,
+					char              **retval)
+{
+	GKeyFile *config;
+	char     *group;
+	char     *key;
+	char     *basekey;
+	gboolean  ret;
+	int       i;
+
+	*retval = NULL;
+	ret = FALSE;
+	basekey = NULL;
+
+	group = key = NULL;
+	if (! mdm_common_config_parse_key_string (keystring, &group, &key, NULL, NULL) ||
+	    group == NULL || key == NULL) {
+		mdm_error ("Could not parse configuration key %s", keystring);
+		goto out;
+	}
+
+	if (mdm_config_lookup_entry (daemon_config, group, key) == NULL) {
+		mdm_error ("Request for invalid configuration key %s", keystring);
+		goto out;
+	}
+
+	basekey = g_strdup_printf ("%s/%s", group, key);
+
+	if (display != NULL &&
+	    (strcmp (group, "greeter") == 0 || strcmp (group, "gui") == 0)) {
+		config = mdm_daemon_config_get_display_overlay (display);
+
+		for (i = 0; config != NULL && langs[i] != NULL; i++) {
+			char *localized_key;
+
+			localized_key = g_strdup_printf ("%s[%s]", key, langs[i]);
+			*retval = g_key_file_get_string (config, group, localized_key, NULL);
+			g_free (localized_key);
+
+			if (*retval != NULL) {
+				mdm_debug ("Using per display %s value for key: %s", langs[i], basekey);
+				ret = TRUE;
+				goto out;
+			}
+		}
+
+		if (mdm_daemon_config_key_to_string_per_display (basekey, display, retval)) {
+			mdm_debug ("Using per display value for key: %s", basekey);
+			ret = TRUE;
+			goto out;
+		}
+	}
+
+	if (mdm_config_get_translation (daemon_config, group, key, langs, retval)) {
+		ret = TRUE;
+		goto out;
+	}
+
+	ret = mdm_daemon_config_to_string (basekey, NULL, retval);
+
+ out:
+	g_free (basekey);
+	g_free (group);
+	g_free (key);
+
+	return ret;
+}
+
+/**
+ * mdm_daemon_config_publish_snapshot
+ *
+ * Writes the effective configuration to MDM_CONFIG_SNAPSHOT, so that
+ * greeters can map it and read their values without a round trip to
+ * the daemon.  Only the keys the greeters read are written, anything
+ * else is not in the snapshot and the greeters ask the daemon for it.
+ * Per-display values are included for every display in
+ * the display list, along with the stamp of its per-display file.
+ * Once published, the snapshot is rewritten when a key is updated, a
+ * display is added or removed, or a per-display file is seen to change.
+ */
+void
+mdm_daemon_config_publish_snapshot (void)
+{
+	MdmConfigSnapshotBuilder *builder;
+	GError                   *error;
+	GSList                   *li;
+	int                       i;
+
+	snapshot_publishing = TRUE;
+	builder = mdm_config_snapshot_builder_new ();
+
+	for (i = 0; mdm_daemon_config_entries[i].group != NULL; i++) {
+		const MdmConfigEntry *entry = &mdm_daemon_config_entries[i];
+		const MdmConfigValue *value;
+		char                 *keystring;
+		char                 *str;
+
+		/*
+		 * The file is world readable, so it only gets what the
+		 * greeters read.  The prefetch program is handed out
+		 * once through GET_CONFIG, see mdm.c.
+		 */
+		if (entry->id == MDM_ID_PRE_FETCH_PROGRAM ||
+		    ! mdm_daemon_config_is_greeter_key (entry->group, entry->key) ||
+		    ! mdm_config_peek_value (daemon_config, entry->group, entry->key, &value)) {
+			continue;
+		}
+
+		keystring = g_strdup_printf ("%s/%s", entry->group, entry->key);
+		str = mdm_config_value_to_string (value);
+		mdm_config_snapshot_builder_add (builder, NULL, keystring, entry->type, str);
+		g_free (str);
+		g_free (keystring);
+	}
+
+	for (li = displays; li != NULL; li = li->next) {
+		MdmDisplay *disp = li->data;
+		char       *file;
+
+		if (disp->name == NULL) {
+			continue;
+		}
+
+		/* stamped even if missing, so greeters see it being created */
+		file = mdm_daemon_config_get_per_display_custom_config_file (disp->name);
+		mdm_config_snapshot_builder_add_file (builder, disp->name, file);
+		g_free (file);
+
+		/* most displays do not have a per-display file */
+		if (mdm_daemon_config_get_display_overlay (disp->name) == NULL) {
+			continue;
+		}
+
+		for (i = 0; mdm_daemon_config_entries[i].group != NULL; i++) {
+			const MdmConfigEntry *entry = &mdm_daemon_config_entries[i];
+			char                 *keystring;
+			char                 *str;
+
+			if (entry->id == MDM_ID_PRE_FETCH_PROGRAM ||
+			    ! mdm_daemon_config_is_greeter_key (entry->group, entry->key)) {
+				continue;
+			}
+
+			keystring = g_strdup_printf ("%s/%s", entry->group, entry->key);
+			if (mdm_daemon_config_key_to_string_per_display (keystring, disp->name, &str)) {
+				mdm_config_snapshot_builder_add (builder, disp->name, keystring, entry->type, str);
+				g_free (str);
+			}
+			g_free (keystring);
+		}
+	}
+
+	error = NULL;
+	if (mdm_config_snapshot_builder_write (builder, MDM_CONFIG_SNAPSHOT,
+					       ++snapshot_serial, &error)) {
+		mdm_debug ("Published configuration snapshot %u", snapshot_serial);
+		snapshot_published = TRUE;
+		snapshot_pid = getpid ();
+	} else {
+		mdm_error ("Could not write configuration snapshot %s: %s",
+			   MDM_CONFIG_SNAPSHOT, error->message);
+		g_error_free (error);
+	}
+
+	mdm_config_snapshot_builder_free (builder);
+	snapshot_publishing = FALSE;
+}
+
+/**
+ * mdm_daemon_config_republish_snapshot
+ *
+ * Rewrites the configuration snapshot if it has been published.
+ */
+void
+mdm_daemon_config_republish_snapshot (void)
+{
+	/* slaves inherit the flag, but only the daemon writes the file */
+	if (snapshot_published && snapshot_pid == getpid ()) {
+		mdm_daemon_config_publish_snapshot ();
+	}
+}
+
+/**
+ * mdm_daemon_config_unpublish_snapshot
+ *
+ * Removes the configuration snapshot, so greeters go back to asking
+ * the daemon.
+ */
+void
+mdm_daemon_config_unpublish_snapshot (void)
+{
+	if (snapshot_published && snapshot_pid == getpid ()) {
+		VE_IGNORE_EINTR (g_unlink (MDM_CONFIG_SNAPSHOT));
+		snapshot_published = FALSE;
+	}
+}
+
 /**
  * mdm_daemon_config_compare_displays
  *
@@ -1384,6 +1783,7 @@ mdm_daemon_config_load_displays (MdmConfig *config)
 
 		displays = g_slist_insert_sorted (displays, disp,
 			mdm_daemon_config_compare_displays);
+		mdm_display_index_add (disp);
 		if (keynum > high_display_num) {
 			high_display_num = keynum;
 		}
@@ -1807,6 +2207,7 @@ handle_no_displays (MdmConfig *config,
 		d->is_emergency_server = TRUE;
 
 		displays = g_slist_append (displays, d);
+		mdm_display_index_add (d);
 
 		/* ALWAYS run the greeter and don't log anyone in,
 		 * this is just an emergency session */
@@ -2103,6 +2504,8 @@ mdm_daemon_config_update_key (const char *keystring)
 	mdm_config_get_value_for_id (temp_config, entry->id, &value);
 	mdm_config_set_value_for_id (daemon_config, entry->id, value);
 
+	mdm_daemon_config_republish_snapshot ();
+
  out:
 	if (temp_config != NULL)
 		mdm_config_free (temp_config);
@@ -2215,9 +2618,69 @@ mdm_daemon_config_set_high_display_num (gint val)
 void
 mdm_daemon_config_close (void)
 {
+	if (snapshot_republish_id != 0) {
+		g_source_remove (snapshot_republish_id);
+		snapshot_republish_id = 0;
+	}
+	if (display_overlays != NULL) {
+		g_hash_table_destroy (display_overlays);
+		display_overlays = NULL;
+	}
+	if (scratch_overlay != NULL) {
+		display_overlay_free (scratch_overlay);
+		scratch_overlay = NULL;
+	}
+	if (key_handles != NULL) {
+		g_hash_table_destroy (key_handles);
+		key_handles = NULL;
+	}
 	mdm_config_free (daemon_config);
 }
 
+/**
+ * mdm_daemon_config_is_greeter_group
+ *
+ * Returns TRUE for the groups that only hold greeter settings.  Only
+ * these are handed out whole, see GET_CONFIG_ALL.
+ */
+gboolean
+mdm_daemon_config_is_greeter_group (const char *group)
+{
+	return (strcmp (group, "greeter") == 0 ||
+		strcmp (group, "gui") == 0);
+}
+
+/**
+ * mdm_daemon_config_is_greeter_key
+ *
+ * Returns TRUE if the greeters read group/key, that is it is in a
+ * greeter group or in MDM_GREETER_DAEMON_KEYS.  Nothing else is
+ * published in bulk.
+ */
+gboolean
+mdm_daemon_config_is_greeter_key (const char *group, const char *key)
+{
+	static const char *daemon_keys[] = { MDM_GREETER_DAEMON_KEYS, NULL };
+	char    *keystring;
+	gboolean ret;
+	int      i;
+
+	if (mdm_daemon_config_is_greeter_group (group))
+		return TRUE;
+
+	keystring = g_strdup_printf ("%s/%s", group, key);
+	ret = FALSE;
+	for (i = 0; daemon_keys[i] != NULL; i++) {
+		if (is_key (daemon_keys[i], keystring)) {
+			ret = TRUE;
+			break;
+		}
+	}
+	g_free (keystring);
+
+	return ret;
+}
+
 /**
  * mdm_is_valid_key
  *
@@ -2250,6 +2713,42 @@ mdm_daemon_config_is_valid_key (const char *keystring)
 	return ret;
 }
 
+/**
+ * mdm_daemon_config_get_key_type
+ *
+ * Returns the value type of the entry the key refers to, or
+ * MDM_CONFIG_VALUE_INVALID if the key is not valid.
+ */
+MdmConfigValueType
+mdm_daemon_config_get_key_type (const char *keystring)
+{
+	char    *group;
+	char    *key;
+	const MdmConfigEntry *entry;
+	MdmConfigValueType type;
+
+	type = MDM_CONFIG_VALUE_INVALID;
+
+	if (! mdm_common_config_parse_key_string (keystring,
+						  &group,
+						  &key,
+						  NULL,
+						  NULL)) {
+		goto out;
+	}
+
+	entry = mdm_config_lookup_entry (daemon_config, group, key);
+	if (entry != NULL) {
+		type = entry->type;
+	}
+
+ out:
+	g_free (group);
+	g_free (key);
+
+	return type;
+}
+
 /**
  * mdm_signal_terminthup_was_notified
  *
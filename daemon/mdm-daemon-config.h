@@ -78,12 +78,23 @@ gboolean       mdm_daemon_config_key_to_string        (const char *file,
 gboolean       mdm_daemon_config_to_string            (const char *key,
                                                        const char *display,
                                                        char **retval);
+gboolean       mdm_daemon_config_to_translated_string (const char *key,
+                                                       const char *display,
+                                                       const char * const *langs,
+                                                       char **retval);
 gboolean       mdm_daemon_config_update_key           (const char *key);
+void           mdm_daemon_config_publish_snapshot     (void);
+void           mdm_daemon_config_republish_snapshot   (void);
+void           mdm_daemon_config_unpublish_snapshot   (void);
 
 
 int            mdm_daemon_config_compare_displays     (gconstpointer a,
                                                        gconstpointer b);
 gboolean       mdm_daemon_config_is_valid_key         (const char *key);
+gboolean       mdm_daemon_config_is_greeter_group     (const char *group);
+gboolean       mdm_daemon_config_is_greeter_key       (const char *group,
+                                                       const char *key);
+MdmConfigValueType mdm_daemon_config_get_key_type     (const char *key);
 gboolean       mdm_daemon_config_signal_terminthup_was_notified  (void);
 void           mdm_daemon_config_get_user_session_lang (char **usrsess,
                                                         char **usrlang,
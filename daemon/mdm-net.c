@@ -75,6 +75,24 @@
  */
 #define MAX_CONNECTIONS 15
 
+/*
+ * Replies a client does not read right away are queued on its
+ * connection and sent from a G_IO_OUT watch as the client drains its
+ * socket, so the daemon never blocks on one slow client.  Once more
+ * than the high-water mark is waiting, no more requests are read from
+ * the client until the queue is flushed.  A client whose queue would
+ * grow past OUTPUT_MAX_QUEUED is hung up on rather than sent a
+ * truncated reply.
+ */
+#define OUTPUT_HIGH_WATER (64 * 1024)
+#define OUTPUT_MAX_QUEUED (1024 * 1024)
+
+/* Clients that have not sent anything for this many seconds are closed */
+#define IDLE_TIMEOUT 60
+
+/* How many pending connections to accept each time the socket wakes us */
+#define MAX_ACCEPTS 32
+
 struct _MdmConnection {
 	int fd;
 	guint source;
@@ -86,6 +104,18 @@ struct _MdmConnection {
 
 	gboolean nonblock;
 
+	gboolean pipelined;	/* requests and replies carry a tag */
+	const char *reply_tag;	/* tag of the request being handled */
+	gboolean replied;	/* reply_tag was already written */
+
+	GString *outbuf;	/* output not yet sent */
+	gsize outbuf_start;	/* first unsent byte in outbuf */
+	gsize high_water;
+	guint out_source;
+	gboolean input_paused;
+	gsize bytes_queued;	/* total output that had to be queued */
+	guint drops;		/* replies dropped */
+
 	int close_level; /* 0 - normal
 			    1 - no close, when called raise to 2
 			    2 - close was requested */
@@ -98,14 +128,24 @@ struct _MdmConnection {
 	gpointer data;
 	GDestroyNotify destroy_notify;
 
+	MdmConnectionHandler frame_handler;
+	guchar frame_magic;
+	GString *frame;		/* binary frame being read */
+
 	gpointer close_data;
 	GDestroyNotify close_notify;
 
 	MdmConnection *parent;
+	GList *link;		/* in parent->subconnections */
+	GList *display_link;	/* in parent->display_subconnections */
 
-	GList *subconnections;
+	GQueue *subconnections;	/* oldest first */
+	GHashTable *display_subconnections; /* MdmDisplay * -> GQueue */
 	int n_subconnections;
 
+	time_t last_activity;
+	guint idle_source;
+
 	MdmDisplay *disp;
 };
 
@@ -146,6 +186,118 @@ close_if_needed (MdmConnection *conn, GIOCondition cond, gboolean error)
 	return TRUE;
 }
 
+/* cut lines short at this length to prevent DoS attacks */
+#define MAX_LINE_LENGTH 4096
+
+/*
+ * Calls handler with msg.  Returns FALSE if the handler closed the
+ * connection.
+ */
+static gboolean
+dispatch_message (MdmConnection *conn,
+		  MdmConnectionHandler handler,
+		  const char *msg)
+{
+	conn->close_level = 1;
+	conn->message_count++;
+
+	handler (conn, msg, conn->data);
+
+	if (conn->close_level == 2) {
+		conn->close_level = 0;
+		conn->source = 0;
+		mdm_connection_close (conn);
+		return FALSE;
+	}
+	conn->close_level = 0;
+
+	return TRUE;
+}
+
+/* Hands the line in conn->buffer to the handler */
+static gboolean
+dispatch_line (MdmConnection *conn)
+{
+	char *line;
+	gboolean ret;
+
+	line = conn->buffer->str;
+
+	if (conn->pipelined) {
+		char *p = strchr (line, ' ');
+
+		conn->reply_tag = line;
+		conn->replied = FALSE;
+		if (p != NULL) {
+			*p = '\0';
+			line = p + 1;
+		} else {
+			line = "";
+		}
+	}
+
+	ret = dispatch_message (conn, conn->handler, line);
+	if ( ! ret)
+		return FALSE;
+
+	conn->reply_tag = NULL;
+	g_string_truncate (conn->buffer, 0);
+
+	return TRUE;
+}
+
+/*
+ * Reads a binary frame from *p, which may have been started by an
+ * earlier read, and hands it to the frame handler once it is complete.
+ * A frame is a magic byte, a byte the handler can use, and the length
+ * of the whole frame as a guint16 in host byte order, followed by
+ * whatever the handler wants.
+ */
+static gboolean
+read_frame (MdmConnection *conn, const char **p, const char *end)
+{
+	gboolean ret;
+
+	if (conn->frame == NULL)
+		conn->frame = g_string_new (NULL);
+
+	for (;;) {
+		gsize need = 4;
+		gsize n;
+
+		if (conn->frame->len >= 4) {
+			guint16 length;
+
+			memcpy (&length, conn->frame->str + 2, sizeof (length));
+			need = length;
+			if G_UNLIKELY (need < 4) {
+				mdm_debug ("read_frame: Dropping bad frame on %d", conn->fd);
+				g_string_free (conn->frame, TRUE);
+				conn->frame = NULL;
+				return TRUE;
+			}
+			if (conn->frame->len >= need)
+				break;
+		}
+
+		if (*p == end)
+			return TRUE;
+
+		n = MIN (need - conn->frame->len, (gsize) (end - *p));
+		g_string_append_len (conn->frame, *p, n);
+		*p += n;
+	}
+
+	ret = dispatch_message (conn, conn->frame_handler, conn->frame->str);
+	if ( ! ret)
+		return FALSE;
+
+	g_string_free (conn->frame, TRUE);
+	conn->frame = NULL;
+
+	return TRUE;
+}
+
 static gboolean
 mdm_connection_handler (GIOChannel *source,
 		        GIOCondition cond,
@@ -163,35 +315,49 @@ mdm_connection_handler (GIOChannel *source,
 	if (len <= 0)
 		return close_if_needed (conn, cond, TRUE);
 
+	conn->last_activity = time (NULL);
+
 	buf[len] = '\0';
 
 	if (conn->buffer == NULL)
 		conn->buffer = g_string_new (NULL);
 
-	for (p = buf; *p != '\0'; p++) {
-		if (*p == '\r' ||
-		    (*p == '\n' &&
-		     ve_string_empty (conn->buffer->str)))
-			/*ignore \r or empty lines*/
-			continue;
-		if (*p == '\n' || 
-		    /* cut lines short at 4096 to prevent DoS attacks */
-		    conn->buffer->len > 4096) {
-			conn->close_level = 1;
-			conn->message_count++;
-			conn->handler (conn, conn->buffer->str,
-				       conn->data);
-			if (conn->close_level == 2) {
-				conn->close_level = 0;
-				conn->source = 0;
-				mdm_connection_close (conn);
+	/*
+	 * Handle every complete line in the buffer before going back
+	 * to the main loop, so that a client sending several requests
+	 * at once gets all the replies from one wakeup.
+	 */
+	p = buf;
+	while (p < buf + len) {
+		size_t run;
+
+		/* frames only ever start where a line could */
+		if (conn->frame != NULL ||
+		    (conn->frame_handler != NULL &&
+		     conn->buffer->len == 0 &&
+		     (guchar) *p == conn->frame_magic)) {
+			if ( ! read_frame (conn, (const char **) &p, buf + len))
 				return FALSE;
-			}
-			conn->close_level = 0;
-			g_string_truncate (conn->buffer, 0);
+			continue;
+		}
+
+		run = strcspn (p, "\r\n");
+		if (run > 0) {
+			run = MIN (run, MAX_LINE_LENGTH - conn->buffer->len);
+			g_string_append_len (conn->buffer, p, run);
+			p += run;
+			if (conn->buffer->len < MAX_LINE_LENGTH)
+				continue;
+		} else if (*p != '\n' || conn->buffer->len == 0) {
+			/*ignore \r, stray NULs or empty lines*/
+			p++;
+			continue;
 		} else {
-			g_string_append_c (conn->buffer, *p);
+			p++;
 		}
+
+		if ( ! dispatch_line (conn))
+			return FALSE;
 	}
 
 	return close_if_needed (conn, cond, FALSE);
@@ -205,33 +371,46 @@ mdm_connection_is_writable (MdmConnection *conn)
 	return conn->writable;
 }
 
-gboolean
-mdm_connection_write (MdmConnection *conn, const char *str)
+static guint
+add_watch (MdmConnection *conn, GIOCondition cond, GIOFunc func)
 {
-	int ret;
+	GIOChannel *chan;
+	guint source;
+
+	chan = g_io_channel_unix_new (conn->fd);
+	g_io_channel_set_encoding (chan, NULL, NULL);
+	g_io_channel_set_buffered (chan, FALSE);
+
+	source = g_io_add_watch_full
+		(chan, G_PRIORITY_DEFAULT,
+		 cond|G_IO_ERR|G_IO_HUP|G_IO_NVAL,
+		 func, conn, NULL);
+	g_io_channel_unref (chan);
+
+	return source;
+}
+
+static gssize
+send_data (MdmConnection *conn, const char *data, gsize len)
+{
+	gssize ret;
 	int save_errno;
 	int flags = 0;
 #ifndef MSG_NOSIGNAL
 	void (*old_handler)(int);
 #endif
 
-	g_return_val_if_fail (conn != NULL, FALSE);
-	g_return_val_if_fail (str != NULL, FALSE);
-
-	if G_UNLIKELY ( ! conn->writable)
-		return FALSE;
-
 #ifdef MSG_DONTWAIT
 	if (conn->nonblock)
 		flags |= MSG_DONTWAIT;
 #endif
 
 #ifdef MSG_NOSIGNAL
-	VE_IGNORE_EINTR (ret = send (conn->fd, str, strlen (str), MSG_NOSIGNAL | flags));
+	VE_IGNORE_EINTR (ret = send (conn->fd, data, len, MSG_NOSIGNAL | flags));
 	save_errno = errno;
 #else
 	old_handler = signal (SIGPIPE, SIG_IGN);
-	VE_IGNORE_EINTR (ret = send (conn->fd, str, strlen (str), flags));
+	VE_IGNORE_EINTR (ret = send (conn->fd, data, len, flags));
 	save_errno = errno;
 	signal (SIGPIPE, old_handler);
 #endif
@@ -239,38 +418,252 @@ mdm_connection_write (MdmConnection *conn, const char *str)
 	/* just so that 'signal' doesn't whack it */
 	errno = save_errno;
 
-	if G_UNLIKELY (ret < 0)
-		return FALSE;
-	else
-		return TRUE;
+	return ret;
+}
+
+static gsize
+output_queued (MdmConnection *conn)
+{
+	if (conn->outbuf == NULL)
+		return 0;
+
+	return conn->outbuf->len - conn->outbuf_start;
 }
 
+/*
+ * Sends as much of the output queue as the socket takes.  Returns
+ * FALSE if the connection is broken.
+ */
 static gboolean
-mdm_socket_handler (GIOChannel *source,
-		    GIOCondition cond,
-		    gpointer data)
+flush_output (MdmConnection *conn)
+{
+	while (output_queued (conn) > 0) {
+		gssize ret;
+
+		ret = send_data (conn,
+				 conn->outbuf->str + conn->outbuf_start,
+				 output_queued (conn));
+		if (ret < 0)
+			return (errno == EAGAIN || errno == EWOULDBLOCK);
+
+		conn->outbuf_start += ret;
+	}
+
+	if (conn->outbuf != NULL) {
+		g_string_truncate (conn->outbuf, 0);
+		conn->outbuf_start = 0;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+mdm_connection_output_handler (GIOChannel *source,
+			       GIOCondition cond,
+			       gpointer data)
 {
-	GIOChannel *unixchan;
 	MdmConnection *conn = data;
-	MdmConnection *newconn;
-	struct sockaddr_un addr;
-	socklen_t addr_size = sizeof (addr);
-	int fd;
-	int max_connections;
 
-	if ( ! (cond & G_IO_IN))
+	if ((cond & (G_IO_ERR|G_IO_HUP|G_IO_NVAL)) ||
+	    ! flush_output (conn)) {
+		mdm_debug ("mdm_connection_output_handler: Could not send to %d", conn->fd);
+		conn->out_source = 0;
+		mdm_connection_close (conn);
+		return FALSE;
+	}
+
+	if (output_queued (conn) > 0)
 		return TRUE;
 
-	VE_IGNORE_EINTR (fd = accept (conn->fd,
-				   (struct sockaddr *)&addr,
-				   &addr_size));
-	if G_UNLIKELY (fd < 0) {
-		mdm_debug ("mdm_socket_handler: Rejecting connection");
+	conn->out_source = 0;
+
+	if (conn->input_paused) {
+		conn->input_paused = FALSE;
+		conn->source = add_watch (conn, G_IO_IN|G_IO_PRI,
+					  mdm_connection_handler);
+	}
+
+	return FALSE;
+}
+
+static gboolean
+queue_output (MdmConnection *conn, const char *data, gsize len)
+{
+	if G_UNLIKELY (output_queued (conn) + len > OUTPUT_MAX_QUEUED) {
+		mdm_debug ("mdm_connection_write: Client on %d is not reading, hanging up",
+			   conn->fd);
+		conn->drops++;
+		conn->writable = FALSE;
+		if (conn->outbuf != NULL) {
+			g_string_truncate (conn->outbuf, 0);
+			conn->outbuf_start = 0;
+		}
+		/* the input watch sees the hangup and closes us */
+		shutdown (conn->fd, SHUT_RDWR);
+		return FALSE;
+	}
+
+	if (conn->outbuf == NULL)
+		conn->outbuf = g_string_new (NULL);
+
+	g_string_append_len (conn->outbuf, data, len);
+	conn->bytes_queued += len;
+
+	if (conn->out_source == 0)
+		conn->out_source = add_watch (conn, G_IO_OUT,
+					      mdm_connection_output_handler);
+
+	/* stop reading requests until the client catches up */
+	if (output_queued (conn) > conn->high_water &&
+	    ! conn->input_paused &&
+	    conn->source > 0) {
+		g_source_remove (conn->source);
+		conn->source = 0;
+		conn->input_paused = TRUE;
+	}
+
+	return TRUE;
+}
+
+gboolean
+mdm_connection_write (MdmConnection *conn, const char *str)
+{
+	gsize len;
+	gsize sent;
+
+	g_return_val_if_fail (conn != NULL, FALSE);
+	g_return_val_if_fail (str != NULL, FALSE);
+
+	if G_UNLIKELY ( ! conn->writable)
+		return FALSE;
+
+	/* the first reply to a pipelined request carries its tag */
+	if (conn->reply_tag != NULL && ! conn->replied) {
+		gboolean ret;
+		char *tagged;
+
+		conn->replied = TRUE;
+		tagged = g_strconcat (conn->reply_tag, " ", str, NULL);
+		ret = mdm_connection_write (conn, tagged);
+		g_free (tagged);
+
+		return ret;
+	}
+
+	len = strlen (str);
+	sent = 0;
+
+	/* keep the order if there is output waiting already */
+	if (output_queued (conn) == 0) {
+		while (sent < len) {
+			gssize ret;
+
+			ret = send_data (conn, str + sent, len - sent);
+			if (ret < 0) {
+				if (conn->nonblock &&
+				    (errno == EAGAIN || errno == EWOULDBLOCK))
+					break;
+				return FALSE;
+			}
+			sent += ret;
+		}
+	}
+
+	if (sent == len)
 		return TRUE;
+
+	return queue_output (conn, str + sent, len - sent);
+}
+
+static void
+display_index_add (MdmConnection *conn)
+{
+	MdmConnection *parent = conn->parent;
+	GQueue *queue;
+
+	if (parent == NULL || conn->disp == NULL)
+		return;
+
+	queue = g_hash_table_lookup (parent->display_subconnections, conn->disp);
+	if (queue == NULL) {
+		queue = g_queue_new ();
+		g_hash_table_insert (parent->display_subconnections,
+				     conn->disp, queue);
 	}
 
+	g_queue_push_tail (queue, conn);
+	conn->display_link = g_queue_peek_tail_link (queue);
+}
+
+static void
+display_index_remove (MdmConnection *conn)
+{
+	MdmConnection *parent = conn->parent;
+	GQueue *queue;
+
+	if (parent == NULL || conn->display_link == NULL)
+		return;
+
+	queue = g_hash_table_lookup (parent->display_subconnections, conn->disp);
+	g_queue_delete_link (queue, conn->display_link);
+	conn->display_link = NULL;
+
+	if (g_queue_is_empty (queue))
+		g_hash_table_remove (parent->display_subconnections, conn->disp);
+}
+
+/* Detaches conn from its parent, without closing it */
+static void
+subconnection_unlink (MdmConnection *conn)
+{
+	MdmConnection *parent = conn->parent;
+
+	if (parent == NULL)
+		return;
+
+	display_index_remove (conn);
+
+	g_queue_delete_link (parent->subconnections, conn->link);
+	conn->link = NULL;
+	parent->n_subconnections--;
+
+	conn->parent = NULL;
+}
+
+static gboolean
+idle_timeout_handler (gpointer data)
+{
+	MdmConnection *conn = data;
+
+	/* waiting on a display, or on the client to read its replies */
+	if (conn->close_notify != NULL ||
+	    output_queued (conn) > 0 ||
+	    time (NULL) - conn->last_activity < IDLE_TIMEOUT)
+		return TRUE;
+
+	mdm_debug ("Closing connection %d, idle for %d seconds",
+		   conn->fd, IDLE_TIMEOUT);
+
+	conn->idle_source = 0;
+	mdm_connection_close (conn);
+
+	return FALSE;
+}
+
+static void
+accept_connection (MdmConnection *conn, int fd)
+{
+	MdmConnection *newconn;
+	int max_connections;
+	int flags;
+
 	mdm_debug ("mdm_socket_handler: Accepting new connection fd %d", fd);
 
+	/* some systems pass O_NONBLOCK on from the listening socket */
+	flags = fcntl (fd, F_GETFL);
+	if (flags >= 0 && (flags & O_NONBLOCK))
+		fcntl (fd, F_SETFL, flags & ~O_NONBLOCK);
+
 	newconn = g_new0 (MdmConnection, 1);
 	newconn->disp = NULL;
 	newconn->message_count = 0;
@@ -288,8 +681,18 @@ mdm_socket_handler (GIOChannel *source,
 	newconn->data = conn->data;
 	newconn->destroy_notify = NULL; /* the data belongs to
 					   parent connection */
+	newconn->high_water = conn->high_water;
+	newconn->last_activity = time (NULL);
+
+	if (conn->subconnections == NULL) {
+		conn->subconnections = g_queue_new ();
+		conn->display_subconnections =
+			g_hash_table_new_full (NULL, NULL, NULL,
+					       (GDestroyNotify) g_queue_free);
+	}
 
-	conn->subconnections = g_list_append (conn->subconnections, newconn);
+	g_queue_push_tail (conn->subconnections, newconn);
+	newconn->link = g_queue_peek_tail_link (conn->subconnections);
 	conn->n_subconnections++;
 	
 	max_connections = MAX_CONNECTIONS;
@@ -298,21 +701,45 @@ mdm_socket_handler (GIOChannel *source,
 		MdmConnection *old;
 		mdm_debug ("Closing connection, %d subconnections reached",
 			max_connections);
-		old = conn->subconnections->data;
-		conn->subconnections =
-			g_list_remove (conn->subconnections, old);
+		old = g_queue_peek_head (conn->subconnections);
+		subconnection_unlink (old);
 		mdm_connection_close (old);
 	}
 
-	unixchan = g_io_channel_unix_new (newconn->fd);
-	g_io_channel_set_encoding (unixchan, NULL, NULL);
-	g_io_channel_set_buffered (unixchan, FALSE);
+	newconn->source = add_watch (newconn, G_IO_IN|G_IO_PRI,
+				     mdm_connection_handler);
+	newconn->idle_source = g_timeout_add (IDLE_TIMEOUT * 1000,
+					      idle_timeout_handler, newconn);
+}
 
-	newconn->source = g_io_add_watch_full
-		(unixchan, G_PRIORITY_DEFAULT,
-		 G_IO_IN|G_IO_PRI|G_IO_ERR|G_IO_HUP|G_IO_NVAL,
-		 mdm_connection_handler, newconn, NULL);
-	g_io_channel_unref (unixchan);
+static gboolean
+mdm_socket_handler (GIOChannel *source,
+		    GIOCondition cond,
+		    gpointer data)
+{
+	MdmConnection *conn = data;
+	struct sockaddr_un addr;
+	socklen_t addr_size;
+	int fd;
+	int i;
+
+	if ( ! (cond & G_IO_IN))
+		return TRUE;
+
+	/* the listening socket is non-blocking, take what is queued */
+	for (i = 0; i < MAX_ACCEPTS; i++) {
+		addr_size = sizeof (addr);
+		VE_IGNORE_EINTR (fd = accept (conn->fd,
+					   (struct sockaddr *)&addr,
+					   &addr_size));
+		if (fd < 0) {
+			if G_UNLIKELY (errno != EAGAIN && errno != EWOULDBLOCK)
+				mdm_debug ("mdm_socket_handler: Rejecting connection");
+			break;
+		}
+
+		accept_connection (conn, fd);
+	}
 
 	return TRUE;
 }
@@ -373,6 +800,7 @@ try_again:
 	conn->disp = NULL;
 	conn->message_count = 0;
 	conn->nonblock = FALSE;
+	conn->high_water = OUTPUT_HIGH_WATER;
 	conn->close_level = 0;
 	conn->fd = fd;
 	conn->writable = FALSE;
@@ -393,7 +821,8 @@ try_again:
 		 mdm_socket_handler, conn, NULL);
 	g_io_channel_unref (unixchan);
 
-	listen (fd, 5);
+	fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+	listen (fd, SOMAXCONN);
 
 	return conn;
 }
@@ -410,6 +839,7 @@ mdm_connection_open_fd (int fd)
 	conn->disp = NULL;
 	conn->message_count = 0;
 	conn->nonblock = FALSE;
+	conn->high_water = OUTPUT_HIGH_WATER;
 	conn->close_level = 0;
 	conn->fd = fd;
 	conn->writable = FALSE;
@@ -460,6 +890,7 @@ mdm_connection_open_fifo (const char *fifo, mode_t mode)
 	conn->disp = NULL;
 	conn->message_count = 0;
 	conn->nonblock = FALSE;
+	conn->high_water = OUTPUT_HIGH_WATER;
 	conn->close_level = 0;
 	conn->fd = fd;
 	conn->writable = FALSE;
@@ -499,6 +930,22 @@ mdm_connection_set_handler (MdmConnection *conn,
 	conn->destroy_notify = destroy_notify;
 }
 
+/*
+ * Makes the connection also accept binary frames, which start with
+ * the byte magic where a line could start, and are handed whole to
+ * handler.  See read_frame for the layout.
+ */
+void
+mdm_connection_set_frame_handler (MdmConnection *conn,
+				  guchar magic,
+				  MdmConnectionHandler handler)
+{
+	g_return_if_fail (conn != NULL);
+
+	conn->frame_magic = magic;
+	conn->frame_handler = handler;
+}
+
 guint32
 mdm_connection_get_user_flags (MdmConnection *conn)
 {
@@ -519,8 +966,6 @@ mdm_connection_set_user_flags (MdmConnection *conn,
 void
 mdm_connection_close (MdmConnection *conn)
 {
-	GList *list;
-
 	g_return_if_fail (conn != NULL);
 
 	if (conn->close_level > 0) {
@@ -540,19 +985,51 @@ mdm_connection_close (MdmConnection *conn)
 		conn->buffer = NULL;
 	}
 
-	if (conn->parent != NULL) {
-		conn->parent->subconnections =
-			g_list_remove (conn->parent->subconnections, conn);
-		/* This is evil a bit, but safe, whereas -- would not be */
-		conn->parent->n_subconnections =
-			g_list_length (conn->parent->subconnections);
-		conn->parent = NULL;
+	if (conn->frame != NULL) {
+		g_string_free (conn->frame, TRUE);
+		conn->frame = NULL;
 	}
 
-	list = conn->subconnections;
-	conn->subconnections = NULL;
-	g_list_foreach (list, (GFunc) mdm_connection_close, NULL);
-	g_list_free (list);
+	if (conn->out_source > 0) {
+		g_source_remove (conn->out_source);
+		conn->out_source = 0;
+	}
+
+	/* last chance for queued replies, such as a final error */
+	if (output_queued (conn) > 0) {
+		if ( ! flush_output (conn) || output_queued (conn) > 0)
+			conn->drops++;
+	}
+
+	if (conn->bytes_queued > 0 || conn->drops > 0)
+		mdm_debug ("mdm_connection_close: %d had %lu bytes queued, %u replies dropped",
+			   conn->fd, (gulong) conn->bytes_queued, conn->drops);
+
+	if (conn->outbuf != NULL) {
+		g_string_free (conn->outbuf, TRUE);
+		conn->outbuf = NULL;
+	}
+
+	subconnection_unlink (conn);
+
+	if (conn->subconnections != NULL) {
+		MdmConnection *sub;
+
+		while ((sub = g_queue_peek_head (conn->subconnections)) != NULL) {
+			subconnection_unlink (sub);
+			mdm_connection_close (sub);
+		}
+
+		g_queue_free (conn->subconnections);
+		conn->subconnections = NULL;
+		g_hash_table_destroy (conn->display_subconnections);
+		conn->display_subconnections = NULL;
+	}
+
+	if (conn->idle_source > 0) {
+		g_source_remove (conn->idle_source);
+		conn->idle_source = 0;
+	}
 
 	if (conn->destroy_notify != NULL) {
 		conn->destroy_notify (conn->data);
@@ -630,6 +1107,26 @@ mdm_connection_set_nonblock (MdmConnection *conn,
 	conn->nonblock = nonblock;
 }
 
+gboolean
+mdm_connection_get_pipelined (MdmConnection *conn)
+{
+	g_return_val_if_fail (conn != NULL, FALSE);
+	return conn->pipelined;
+}
+
+/*
+ * In pipelined mode every request line starts with a tag, which is
+ * split off before the line is given to the handler and put in front
+ * of the reply.  Takes effect from the next line read.
+ */
+void
+mdm_connection_set_pipelined (MdmConnection *conn,
+			      gboolean pipelined)
+{
+	g_return_if_fail (conn != NULL);
+	conn->pipelined = pipelined;
+}
+
 MdmDisplay *
 mdm_connection_get_display (MdmConnection *conn)
 {
@@ -642,30 +1139,32 @@ mdm_connection_set_display (MdmConnection *conn,
 			    MdmDisplay *disp)
 {
 	g_return_if_fail (conn != NULL);
+
+	display_index_remove (conn);
 	conn->disp = disp;
+	display_index_add (conn);
 }
 
 void
 mdm_kill_subconnections_with_display (MdmConnection *conn,
 				      MdmDisplay *disp)
 {
-	GList *subs;
+	GQueue *queue;
 
 	g_return_if_fail (conn != NULL);
 	g_return_if_fail (disp != NULL);
 
-	subs = conn->subconnections;
-	while (subs != NULL) {
-		MdmConnection *subcon = subs->data;
-		if (subcon->disp == disp) {
-			subcon->disp = NULL;
-			conn->subconnections =
-				g_list_remove (conn->subconnections, subcon);
-			mdm_connection_close (subcon);
-			subs = conn->subconnections;
-		} else {
-			subs = subs->next;
-		}
+	if (conn->display_subconnections == NULL)
+		return;
+
+	/* the queue goes away with the last connection in it */
+	while ((queue = g_hash_table_lookup (conn->display_subconnections,
+					     disp)) != NULL) {
+		MdmConnection *subcon = g_queue_peek_head (queue);
+
+		subconnection_unlink (subcon);
+		subcon->disp = NULL;
+		mdm_connection_close (subcon);
 	}
 }
 
@@ -61,10 +61,18 @@ void		mdm_connection_set_handler (MdmConnection *conn,
 					    gpointer data,
 					    GDestroyNotify destroy_notify);
 
+void		mdm_connection_set_frame_handler (MdmConnection *conn,
+						  guchar magic,
+						  MdmConnectionHandler handler);
+
 gboolean	mdm_connection_get_nonblock   (MdmConnection *conn);
 void		mdm_connection_set_nonblock   (MdmConnection *conn,
 					       gboolean nonblock);
 
+gboolean	mdm_connection_get_pipelined  (MdmConnection *conn);
+void		mdm_connection_set_pipelined  (MdmConnection *conn,
+					       gboolean pipelined);
+
 guint32		mdm_connection_get_user_flags (MdmConnection *conn);
 void		mdm_connection_set_user_flags (MdmConnection *conn,
 					       guint32 flags);
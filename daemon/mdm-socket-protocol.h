@@ -104,12 +104,14 @@
 #define MDM_SOP_DISP_NUM     "DISP_NUM" /* <slave pid> <display as int> */
 /* For Linux only currently */
 #define MDM_SOP_VT_NUM       "VT_NUM" /* <slave pid> <vt as int> */
+/* How long the X server took to get ready */
+#define MDM_SOP_SERVSTART    "SERVSTART" /* <slave pid> <usec as int> */
 #define MDM_SOP_FLEXI_ERR    "FLEXI_ERR" /* <slave pid> <error num> */
 	/* 3 = X failed */
 	/* 4 = X too busy */
 	/* 5 = Nest display can't connect */
 #define MDM_SOP_FLEXI_OK     "FLEXI_OK" /* <slave pid> */
-#define MDM_SOP_START_NEXT_LOCAL "START_NEXT_LOCAL" /* no arguments */
+#define MDM_SOP_START_NEXT_LOCAL "START_NEXT_LOCAL" /* <slave pid> */
 
 /* write out a sessreg (xdm) compatible Xservers file
  * in the ServAuthDir as <name>.Xservers */
@@ -124,6 +126,62 @@
 #define MDM_SOP_SHOW_QUESTION_DIALOG "SHOW_QUESTION_DIALOG"  /* show the question dialog from daemon */
 #define MDM_SOP_SHOW_ASKBUTTONS_DIALOG "SHOW_ASKBUTTON_DIALOG"  /* show the askbutton dialog from daemon */
 
+/*
+ * Binary framing for the slave pipe.  A slave forked by a daemon that
+ * reads frames (slave_fifo_frame_version is set) may send the
+ * messages that carry a number or a string as frames instead of text
+ * lines.  The text protocol stays, and is still used for the dialogs.
+ *
+ * A frame is an MdmSopFrameHeader, in host byte order, followed by a
+ * gint64 for MDM_SOP_FIELD_NUM or the bytes of the string, without a
+ * NUL, for MDM_SOP_FIELD_STRING.  length covers the whole frame.
+ *
+ * Several frames may be written with one write of at most PIPE_BUF
+ * bytes, so they reach the daemon together.  Every frame but the last
+ * has MDM_SOP_FRAME_MORE set, and the daemon acks the batch once,
+ * after the last frame.
+ */
+#define MDM_SOP_FRAME_MAGIC   0xFF	/* never starts a text line */
+#define MDM_SOP_FRAME_VERSION 1
+
+#define MDM_SOP_FRAME_MORE    0x1
+
+enum {
+	MDM_SOP_FIELD_NONE = 0,
+	MDM_SOP_FIELD_NUM,
+	MDM_SOP_FIELD_STRING
+};
+
+enum {
+	MDM_SOP_ID_XPID = 1,
+	MDM_SOP_ID_SESSPID,
+	MDM_SOP_ID_GREETPID,
+	MDM_SOP_ID_LOGGED_IN,
+	MDM_SOP_ID_LOGIN,
+	MDM_SOP_ID_COOKIE,
+	MDM_SOP_ID_AUTHFILE,
+	MDM_SOP_ID_QUERYLOGIN,
+	MDM_SOP_ID_MIGRATE,
+	MDM_SOP_ID_DISP_NUM,
+	MDM_SOP_ID_VT_NUM,
+	MDM_SOP_ID_FLEXI_ERR,
+	MDM_SOP_ID_FLEXI_OK,
+	MDM_SOP_ID_WRITE_X_SERVERS,
+	MDM_SOP_ID_CHOSEN_THEME,
+	MDM_SOP_ID_SERVSTART,
+	MDM_SOP_ID_LAST
+};
+
+typedef struct {
+	guint8  magic;		/* MDM_SOP_FRAME_MAGIC */
+	guint8  version;	/* MDM_SOP_FRAME_VERSION */
+	guint16 length;
+	guint16 opcode;		/* MDM_SOP_ID_* */
+	guint8  type;		/* MDM_SOP_FIELD_* */
+	guint8  flags;		/* MDM_SOP_FRAME_MORE */
+	gint32  slave_pid;
+} MdmSopFrameHeader;
+
 /* Ack for a slave message */
 /* Note that an extra response can follow an 'ack' */
 #define MDM_SLAVE_NOTIFY_ACK 'A'
@@ -149,8 +207,18 @@
  * all to be grabbed in one pull.
  */
 #define MDM_SUP_MAX_MESSAGES 80
+/* Same for connections in pipelined mode, see MDM_SUP_PIPELINE */
+#define MDM_SUP_MAX_PIPELINED_MESSAGES 1000
 #define MDM_SUP_SOCKET "/var/run/gdm_socket"
 
+/*
+ * Read-only snapshot of the effective configuration, published by the
+ * daemon next to the socket, see common/mdm-config-snapshot.h.
+ * Greeters read values from it and only fall back to GET_CONFIG when
+ * it is missing or in a format they do not understand.
+ */
+#define MDM_CONFIG_SNAPSHOT "/var/run/mdm_config_snapshot"
+
 /*
  * The user socket protocol.  Each command is given on a separate line
  *
@@ -168,10 +236,63 @@
 /* The user protocol, using /tmp/.mdm_socket */
 
 #define MDM_SUP_VERSION "VERSION"
+/*
+ * VERSION PIPELINE
+ *
+ * Asks for pipelined mode.  A daemon that supports it answers
+ * "MDM <version> PIPELINE"; older ones answer "ERROR 0 Not implemented"
+ * and hang up.  From then on each request line starts with a tag chosen
+ * by the client, and the reply to it starts with the same tag:
+ *
+ *   <tag> <command>
+ *   <tag> OK ...
+ *
+ * Tags may not contain spaces.  A client can write any number of
+ * requests, up to MDM_SUP_MAX_PIPELINED_MESSAGES, before reading the
+ * replies, which come back in the same order.  FLEXI_XSERVER is refused
+ * with error 201 since its reply only comes once the server is running,
+ * and so are GET_CONFIG_MULTI and GET_CONFIG_ALL, whose record lines
+ * would come back untagged.
+ */
+#define MDM_SUP_PIPELINE "PIPELINE"
 #define MDM_SUP_AUTH_LOCAL "AUTH_LOCAL"
 #define MDM_SUP_FLEXI_XSERVER "FLEXI_XSERVER"
 #define MDM_SUP_ATTACHED_SERVERS "ATTACHED_SERVERS"
 #define MDM_SUP_GET_CONFIG "GET_CONFIG"
+/*
+ * Bulk variants of GET_CONFIG, so that a greeter can pull its whole
+ * configuration in one round trip:
+ *
+ *   GET_CONFIG_MULTI <display> <key> [<key> ...]
+ *   GET_CONFIG_ALL <display> [<group>]
+ *
+ * GET_CONFIG_ALL only covers the "greeter" and "gui" groups, <group>
+ * narrows it down to one of them.  Keys from other groups have to be
+ * asked for by name with GET_CONFIG_MULTI.
+ *
+ * <display> is "-" when there is no display to look up per-display
+ * values for.  The reply is "OK <n>" followed by n record lines:
+ *
+ *   OK <n>
+ *   <type>:<group/key>=<value>
+ *   ...
+ *
+ * where <type> is 'b', 'i' or 's' and <value> is escaped with
+ * g_strescape.  Unknown keys are left out of the reply.  Since only
+ * the first line would carry a tag, in pipelined mode these are
+ * answered with "ERROR 201 Not allowed in pipelined mode".
+ */
+#define MDM_SUP_GET_CONFIG_MULTI "GET_CONFIG_MULTI"
+#define MDM_SUP_GET_CONFIG_ALL "GET_CONFIG_ALL"
+/*
+ * GET_CONFIG_TRANSLATED <display> <key> <lang> [<lang> ...]
+ *
+ * Returns the value of key for the first of the languages that has a
+ * translation, or the untranslated value, in the same "OK <value>"
+ * form as GET_CONFIG.  The languages are given most preferred first,
+ * as returned by g_get_language_names.
+ */
+#define MDM_SUP_GET_CONFIG_TRANSLATED "GET_CONFIG_TRANSLATED"
 #define MDM_SUP_GET_CONFIG_FILE  "GET_CONFIG_FILE"
 #define MDM_SUP_GET_CUSTOM_CONFIG_FILE  "GET_CUSTOM_CONFIG_FILE"
 #define MDM_SUP_UPDATE_CONFIG "UPDATE_CONFIG"
@@ -73,16 +73,25 @@
 
 /* Local functions */
 static void mdm_handle_message (MdmConnection *conn, const gchar *msg, gpointer data);
+static void sop_log_stats (void);
+static void mdm_handle_frame (MdmConnection *conn, const gchar *frame, gpointer data);
 static void mdm_handle_user_message (MdmConnection *conn, const gchar *msg, gpointer data);
 static void mdm_daemonify (void);
 static void mdm_safe_restart (void);
 static void mdm_try_logout_action (MdmDisplay *disp);
 static void mdm_restart_now (void);
-static void handle_flexi_server (MdmConnection *conn, int type, const gchar *server, gboolean handled, const gchar *username);
+static void handle_flexi_server (MdmConnection *conn, int type, const gchar *server, gboolean handled, const gchar *username, gboolean pooled);
+static void flexi_pool_schedule_refill (int delay);
+static void flexi_pool_reschedule_refill (int delay);
+static void flexi_pool_claim (MdmDisplay *disp);
 
 /* Global vars */
 
 gint flexi_servers         = 0; /* Number of flexi servers */
+static guint flexi_pool_refill_id = 0; /* Pending flexi pool top up */
+static gboolean flexi_pool_claim_pending = FALSE; /* Top up waits for a claimed greeter */
+static int flexi_pool_failures    = 0; /* Spares that died starting up */
+static gint64 static_bringup_time = 0; /* When the first static display was started */
 pid_t extra_process = 0;        /* An extra process.  Used for quickie
                                    processes, so that they also get whacked */
 static int extra_status    = 0; /* Last status from the last extra process */
@@ -103,6 +112,7 @@ static gboolean no_console       = FALSE; /* There are no static servers, this
 MdmConnection *pipeconn = NULL; /* slavepipe connection */
 MdmConnection *unixconn = NULL; /* UNIX Socket connection */
 int slave_fifo_pipe_fd = -1;    /* The slavepipe connection */
+int slave_fifo_frame_version = 0; /* MDM_SOP_FRAME_VERSION if frames are read */
 
 unsigned char *mdm_global_cookie  = NULL;
 unsigned char *mdm_global_bcookie = NULL;
@@ -178,24 +188,66 @@ mdm_daemonify (void)
 	mdm_open_dev_null (O_RDWR); /* open stderr - fd 2 */
 }
 
+/*
+ * Static displays normally start one after the other, the
+ * START_NEXT_LOCAL of one starting the next.  With StaticStartConcurrency
+ * above one, that many start side by side, and we pick their VTs here in
+ * display order instead of having the slaves race for the first free one.
+ */
 static void
 mdm_start_first_unborn_local (int delay)
 {
 	GSList *li;
+	GSList *next;
 	GSList *displays;
+	gboolean pick_vts;
+	int concurrency;
+	int starting = 0;
+	int next_vt;
 
 	displays = mdm_daemon_config_get_display_list ();
 
 	/* tickle the random stuff */
 	mdm_random_tick ();
 
+	concurrency = MAX (1, mdm_daemon_config_get_int_for_id (MDM_ID_STATIC_START_CONCURRENCY));
+	next_vt = mdm_daemon_config_get_value_int (MDM_KEY_FIRST_VT);
+
 	for (li = displays; li != NULL; li = li->next) {
 		MdmDisplay *d = li->data;
 
+		/* a display that died before START_NEXT_LOCAL
+		 * must not hold up the rest */
+		if (d->type == TYPE_STATIC && d->starting &&
+		    d->dispstat != DISPLAY_DEAD) {
+			starting++;
+			if (d->start_vt >= next_vt)
+				next_vt = d->start_vt + 1;
+		}
+	}
+
+	pick_vts = (concurrency > 1 &&
+		    mdm_daemon_config_get_value_bool (MDM_KEY_VT_ALLOCATION));
+	if (pick_vts && mdm_get_free_vt_from (next_vt) < 0) {
+		mdm_debug ("mdm_start_first_unborn_local: Cannot pick VTs, "
+			   "starting displays one at a time");
+		concurrency = 1;
+		pick_vts = FALSE;
+	}
+
+	for (li = displays; li != NULL; li = next) {
+		MdmDisplay *d = li->data;
+
+		next = li->next;
+
 		if (d != NULL &&
 		    d->type == TYPE_STATIC &&
 		    d->dispstat == DISPLAY_UNBORN) {
 			MdmXserver *svr;
+
+			if (starting >= concurrency)
+				return;
+
 			mdm_debug ("mdm_start_first_unborn_local: "
 				   "Starting %s", d->name);
 
@@ -203,6 +255,17 @@ mdm_start_first_unborn_local (int delay)
 			 * before starting */
 			d->sleep_before_run = delay;
 
+			d->start_vt = -1;
+			if (pick_vts) {
+				d->start_vt = mdm_get_free_vt_from (next_vt);
+				if (d->start_vt > 0)
+					next_vt = d->start_vt + 1;
+			}
+
+			d->bringup_time = g_get_monotonic_time ();
+			if (static_bringup_time == 0)
+				static_bringup_time = d->bringup_time;
+
 			/* all static displays have
 			 * timed login going on */
 			d->timed_login_ok = TRUE;
@@ -224,10 +287,24 @@ mdm_start_first_unborn_local (int delay)
 				if (svr != NULL &&
 				    svr->handled)
 					mdm_first_login = FALSE;
-				break;
+				d->starting = TRUE;
+				starting++;
 			}
 		}
 	}
+
+	if (starting > 0)
+		return;
+
+	if (static_bringup_time != 0) {
+		mdm_info ("All static displays started in %ld ms",
+			  (long) ((g_get_monotonic_time () - static_bringup_time) / 1000));
+		static_bringup_time = 0;
+	}
+
+	/* All the static displays are up, now is the time to start the
+	 * spare flexi displays */
+	flexi_pool_schedule_refill (3 /* delay */);
 }
 
 void
@@ -258,6 +335,8 @@ mdm_final_cleanup (void)
 
 	mdm_debug ("mdm_final_cleanup");
 
+	sop_log_stats ();
+
 	if (extra_process > 1) {
 		/* we sigterm extra processes, and we
 		 * don't wait */
@@ -310,6 +389,8 @@ mdm_final_cleanup (void)
 		unixconn = NULL;
 	}
 
+	mdm_daemon_config_unpublish_snapshot ();
+
 	if (another_mdm_is_running) {
 		mdm_debug ("mdm_final_cleanup: Another MDM is already running. Leaving %s alone.", MDM_PID_FILE);		
 	}
@@ -417,13 +498,14 @@ deal_with_x_crashes (MdmDisplay *d)
 				int ret;
 				int killsignal = SIGTERM;
 				int storeerrno;
+				int pidfd = mdm_pidfd_open (extra_process);
 				errno = 0;
 				ret = waitpid (extra_process, &status, WNOHANG);
 				do {
 					/* wait for some signal, yes this is a race */
 					if (ret <= 0) {
-						mdm_debug("mdm deal_with_x_crashes: sleeping for 10 seconds");
-						sleep (10);
+						mdm_debug("mdm deal_with_x_crashes: waiting up to 10 seconds");
+						mdm_pidfd_sleep (pidfd, 10);
 					}
 					errno = 0;
 					ret = waitpid (extra_process, &status, WNOHANG);
@@ -433,6 +515,9 @@ deal_with_x_crashes (MdmDisplay *d)
 						killsignal = SIGKILL;
 					}
 				} while (ret == 0 || (ret < 0 && storeerrno == EINTR));
+
+				if (pidfd >= 0)
+					VE_IGNORE_EINTR (close (pidfd));
 			}
 			extra_process = 0;
 
@@ -745,10 +830,7 @@ mdm_exec_script (const gchar *dir,
 static gboolean
 mdm_cleanup_children (void)
 {
-	gint exitstatus = 0, status;
-	MdmDisplay *d = NULL;
-	gboolean crashed;
-	gboolean sysmenu;
+	gint exitstatus = 0;
 	pid_t pid;
 
 	/* Pid and exit status of slave that died */
@@ -757,6 +839,23 @@ mdm_cleanup_children (void)
 	if (pid <= 0)
 		return FALSE;
 
+	mdm_cleanup_child (pid, exitstatus);
+
+	return TRUE;
+}
+
+/*
+ * Deals with the child pid having exited with exitstatus, once it is
+ * reaped, either from SIGCHLD or from the pidfd of a slave.
+ */
+void
+mdm_cleanup_child (pid_t pid, int exitstatus)
+{
+	gint status;
+	MdmDisplay *d = NULL;
+	gboolean crashed;
+	gboolean sysmenu;
+
 	if G_LIKELY (WIFEXITED (exitstatus)) {
 		status = WEXITSTATUS (exitstatus);
 		crashed = FALSE;
@@ -786,14 +885,16 @@ mdm_cleanup_children (void)
 		/* An extra process died, yay! */
 		extra_process = 0;
 		extra_status  = exitstatus;
-		return TRUE;
+		return;
 	}
 
 	/* Find out who this slave belongs to */
 	d = mdm_display_lookup (pid);
 
 	if (d == NULL)
-		return TRUE;
+		return;
+
+	mdm_display_unwatch_slave (d);
 
 	/* Whack connections about this display */
 	if (unixconn != NULL)
@@ -828,7 +929,7 @@ mdm_cleanup_children (void)
 	d->login = NULL;
 
 	/* Declare the display dead */
-	d->slavepid = 0;
+	mdm_display_set_slavepid (d, 0);
 	d->dispstat = DISPLAY_DEAD;
 
 	/* Run SuperPost script */
@@ -1035,15 +1136,23 @@ mdm_cleanup_children (void)
 			 */			
 			mdm_debug ("mdm_child_action: Flexible server died, scanning for a greeter");
 			GSList *li;
-			for (li = mdm_daemon_config_get_display_list (); li != NULL; li = li->next) {
+			for (li = mdm_daemon_config_get_display_list (); li != NULL && ! d->pooled; li = li->next) {
 				MdmDisplay *disp = li->data;
 				if (disp->greetpid > 0) {
 					mdm_debug ("mdm_child_action: Found a greeter on %d, changing VT.", disp->vt);
+					if (disp->pooled)
+						flexi_pool_claim (disp);
 					mdm_change_vt (disp->vt);							
 					break;
 				}
 			}
 
+			/* A spare that never made it counts as a failure,
+			 * either way the pool needs topping up */
+			if (d->pooled && d->greetpid <= 0)
+				flexi_pool_failures++;
+			flexi_pool_schedule_refill (3 /* delay */);
+
 			/*
 			 * If this was a chooser session and we have chosen a
 			 * host, then we don't want to unmanage, we want to
@@ -1065,8 +1174,6 @@ mdm_cleanup_children (void)
 
 	mdm_try_logout_action (d);
 	mdm_safe_restart ();
-
-	return TRUE;
 }
 
 static void
@@ -1260,6 +1367,10 @@ create_connections (void)
 		mdm_connection_set_close_notify (pipeconn,
 						 &pipeconn,
 						 close_notify);
+		mdm_connection_set_frame_handler (pipeconn,
+						  MDM_SOP_FRAME_MAGIC,
+						  mdm_handle_frame);
+		slave_fifo_frame_version = MDM_SOP_FRAME_VERSION;
 	} else {
 		VE_IGNORE_EINTR (close (p[0]));
 		VE_IGNORE_EINTR (close (p[1]));
@@ -1277,6 +1388,8 @@ create_connections (void)
 		mdm_connection_set_close_notify (unixconn,
 						 &unixconn,
 						 close_notify);
+
+		mdm_daemon_config_publish_snapshot ();
 	}
 }
 
@@ -1799,9 +1912,22 @@ send_slave_ack_dialog_char (MdmDisplay *d, int type, const char *resp)
 	}
 }
 
+/* A batch of frames from this slave is being read, see mdm_handle_frame */
+static pid_t       sop_batch_pid     = 0;
+static MdmDisplay *sop_batch_ack     = NULL;
+static char       *sop_batch_ack_resp = NULL;
+
 static void
 send_slave_ack (MdmDisplay *d, const char *resp)
 {
+	/* the batch is acked once, at its end */
+	if (sop_batch_pid != 0 && d->slavepid == sop_batch_pid) {
+		sop_batch_ack = d;
+		g_free (sop_batch_ack_resp);
+		sop_batch_ack_resp = g_strdup (resp);
+		return;
+	}
+
 	if (d->master_notify_fd >= 0) {
 		if (resp == NULL) {
 			char not[2];
@@ -1846,667 +1972,1018 @@ send_slave_command (MdmDisplay *d, const char *command)
 	}
 }
 
-static void
-mdm_handle_message (MdmConnection *conn, const char *msg, gpointer data)
+/*
+ * Slave to daemon messages are dispatched through a table keyed on the
+ * opcode.  A message is either "<opcode> <slave pid> [<args>]", the
+ * opcode alone, or "opcode=<opcode>$$<name>=<value>$$..." for the
+ * dialogs.  The dispatcher splits the message up before calling the
+ * handler, which returns FALSE if the arguments do not make sense.
+ */
+typedef struct {
+	long         slave_pid;
+	const char  *args;	/* what follows the slave pid, or NULL */
+	char       **fields;	/* the $$ separated fields of "opcode=" messages */
+	gint64       num;	/* the number, if a frame carried one */
+	gboolean     has_num;
+} MdmSopMessage;
+
+typedef gboolean (* MdmSopHandlerFunc) (const MdmSopMessage *m);
+
+typedef enum {
+	SOP_ARGS_NONE,
+	SOP_ARGS_PID,
+	SOP_ARGS_FIELDS
+} MdmSopArgs;
+
+typedef struct {
+	const char        *opcode;
+	int                id;	/* MDM_SOP_ID_*, for frames */
+	MdmSopArgs         args;
+	MdmSopHandlerFunc  handler;
+	guint              handled;
+	guint              rejected;
+} MdmSopHandler;
+
+/* The number argument of a message, from a frame or from the text */
+static gboolean
+sop_get_num (const MdmSopMessage *m, long *num)
 {
-	/* Evil!, all this for debugging? */
-	if G_UNLIKELY (mdm_daemon_config_get_value_bool (MDM_KEY_DEBUG)) {
-		if (strncmp (msg, MDM_SOP_COOKIE " ",
-			     strlen (MDM_SOP_COOKIE " ")) == 0) {
-			char *s = g_strndup
-				(msg, strlen (MDM_SOP_COOKIE " XXXX XX"));
-			/* cut off most of the cookie for "security" */
-			mdm_debug ("Handling message: '%s...'", s);
-			g_free (s);
-		}
+	if (m->has_num) {
+		*num = m->num;
+		return TRUE;
 	}
 
-	if (strncmp (msg, MDM_SOP_XPID " ",
-		            strlen (MDM_SOP_XPID " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid, pid;
+	return (m->args != NULL && sscanf (m->args, "%ld", num) == 1);
+}
 
-		if (sscanf (msg, MDM_SOP_XPID " %ld %ld", &slave_pid, &pid)
-		    != 2)
-			return;
+static gboolean
+sop_handle_xpid (const MdmSopMessage *m)
+{
+	MdmDisplay *d;
+	long pid;
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+	if ( ! sop_get_num (m, &pid))
+		return FALSE;
 
-		if (d != NULL) {
-			d->servpid = pid;
-			mdm_debug ("Got XPID == %ld", (long)pid);
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_SESSPID " ",
-		            strlen (MDM_SOP_SESSPID " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid, pid;
+	/* Find out who this slave belongs to */
+	d = mdm_display_lookup (m->slave_pid);
 
-		if (sscanf (msg, MDM_SOP_SESSPID " %ld %ld", &slave_pid, &pid)
-		    != 2)
-			return;
+	if (d != NULL) {
+		d->servpid = pid;
+		mdm_debug ("Got XPID == %ld", (long)pid);
+		/* send ack */
+		send_slave_ack (d, NULL);
+	}
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+	return TRUE;
+}
 
-		if (d != NULL) {
-			d->sesspid = pid;
-			mdm_debug ("Got SESSPID == %ld", (long)pid);
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_GREETPID " ",
-		            strlen (MDM_SOP_GREETPID " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid, pid;
+static gboolean
+sop_handle_sesspid (const MdmSopMessage *m)
+{
+	MdmDisplay *d;
+	long pid;
 
-		if (sscanf (msg, MDM_SOP_GREETPID " %ld %ld", &slave_pid, &pid)
-		    != 2)
-			return;
+	if ( ! sop_get_num (m, &pid))
+		return FALSE;
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+	/* Find out who this slave belongs to */
+	d = mdm_display_lookup (m->slave_pid);
 
-		if (d != NULL) {
-			d->greetpid = pid;
-			mdm_debug ("Got GREETPID == %ld", (long)pid);
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_LOGGED_IN " ",
-		            strlen (MDM_SOP_LOGGED_IN " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		int logged_in;
-		if (sscanf (msg, MDM_SOP_LOGGED_IN " %ld %d", &slave_pid,
-			    &logged_in) != 2)
-			return;
+	if (d != NULL) {
+		d->sesspid = pid;
+		mdm_debug ("Got SESSPID == %ld", (long)pid);
+		/* send ack */
+		send_slave_ack (d, NULL);
+	}
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
-
-		if (d != NULL) {
-			d->logged_in = logged_in ? TRUE : FALSE;
-			mdm_debug ("Got logged in == %s",
-				   d->logged_in ? "TRUE" : "FALSE");
-
-			/* whack connections about this display if a user
-			 * just logged out since we don't want such
-			 * connections persisting to be authenticated */
-			if ( ! logged_in && unixconn != NULL)
-				mdm_kill_subconnections_with_display (unixconn, d);
-
-			/* if the user just logged out,
-			 * let's see if it's safe to restart */
-			if ( ! d->logged_in) {
-				mdm_try_logout_action (d);
-				mdm_safe_restart ();
-			}
+	return TRUE;
+}
 
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_DISP_NUM " ",
-		            strlen (MDM_SOP_DISP_NUM " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		int disp_num;
-
-		if (sscanf (msg, MDM_SOP_DISP_NUM " %ld %d",
-			    &slave_pid, &disp_num) != 2)
-			return;
+static gboolean
+sop_handle_greetpid (const MdmSopMessage *m)
+{
+	MdmDisplay *d;
+	long pid;
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+	if ( ! sop_get_num (m, &pid))
+		return FALSE;
 
-		if (d != NULL) {
-			g_free (d->name);
-			d->name = g_strdup_printf (":%d", disp_num);
-			d->dispnum = disp_num;
-			mdm_debug ("Got DISP_NUM == %d", disp_num);
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_VT_NUM " ",
-		            strlen (MDM_SOP_VT_NUM " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		int vt_num;
-
-		if (sscanf (msg, MDM_SOP_VT_NUM " %ld %d",
-			    &slave_pid, &vt_num) != 2)
-			return;
+	/* Find out who this slave belongs to */
+	d = mdm_display_lookup (m->slave_pid);
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+	if (d != NULL) {
+		d->greetpid = pid;
+		mdm_debug ("Got GREETPID == %ld", (long)pid);
+		/* send ack */
+		send_slave_ack (d, NULL);
 
-		if (d != NULL) {
-			d->vt = vt_num;
-			mdm_debug ("Got VT_NUM == %d", vt_num);
-			/* send ack */
-			send_slave_ack (d, NULL);
+		/* this spare is ready, go on with the next one */
+		if (d->pooled && pid > 0) {
+			flexi_pool_failures = 0;
+			flexi_pool_schedule_refill (1 /* delay */);
 		}
-	} else if (strncmp (msg, MDM_SOP_LOGIN " ",
-		            strlen (MDM_SOP_LOGIN " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		char *p;
-
-		if (sscanf (msg, MDM_SOP_LOGIN " %ld",
-			    &slave_pid) != 1)
-			return;
-		p = strchr (msg, ' ');
-		if (p != NULL)
-			p = strchr (p+1, ' ');
-		if (p == NULL)
-			return;
+	}
+
+	return TRUE;
+}
 
-		p++;
+static gboolean
+sop_handle_logged_in (const MdmSopMessage *m)
+{
+	MdmDisplay *d;
+	long logged_in;
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+	if ( ! sop_get_num (m, &logged_in))
+		return FALSE;
 
-		if (d != NULL) {
-			g_free (d->login);
-			d->login = g_strdup (p);
-			mdm_debug ("Got LOGIN == %s", p);
-			/* send ack */
-			send_slave_ack (d, NULL);
+	/* Find out who this slave belongs to */
+	d = mdm_display_lookup (m->slave_pid);
+
+	if (d != NULL) {
+		d->logged_in = logged_in ? TRUE : FALSE;
+		mdm_debug ("Got logged in == %s",
+			   d->logged_in ? "TRUE" : "FALSE");
+
+		/* whack connections about this display if a user
+		 * just logged out since we don't want such
+		 * connections persisting to be authenticated */
+		if ( ! logged_in && unixconn != NULL)
+			mdm_kill_subconnections_with_display (unixconn, d);
+
+		/* if the user just logged out,
+		 * let's see if it's safe to restart */
+		if ( ! d->logged_in) {
+			mdm_try_logout_action (d);
+			mdm_safe_restart ();
 		}
-	} else if (strncmp (msg, MDM_SOP_QUERYLOGIN " ",
-		            strlen (MDM_SOP_QUERYLOGIN " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		char *p;
-
-		if (sscanf (msg, MDM_SOP_QUERYLOGIN " %ld",
-			    &slave_pid) != 1)
-			return;
-		p = strchr (msg, ' ');
-		if (p != NULL)
-			p = strchr (p+1, ' ');
-		if (p == NULL)
-			return;
 
-		p++;
+		/* nobody is typing into a claimed greeter any more */
+		if (d->logged_in && flexi_pool_claim_pending)
+			flexi_pool_reschedule_refill (1 /* delay */);
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
-
-		if (d != NULL) {
-			GString *resp = NULL;
-			GSList *li;
-			GSList *displays;
+		/* send ack */
+		send_slave_ack (d, NULL);
+	}
 
-			displays = mdm_daemon_config_get_display_list ();
-			mdm_debug ("Got QUERYLOGIN %s", p);
-			for (li = displays; li != NULL; li = li->next) {
-				MdmDisplay *di = li->data;
-				if (di->logged_in &&
-				    di->login != NULL &&
-				    strcmp (di->login, p) == 0) {
-					gboolean migratable = FALSE;
+	return TRUE;
+}
 
-					if (resp == NULL)
-						resp = g_string_new (NULL);
-					else
-						resp = g_string_append_c (resp, ',');
+static gboolean
+sop_handle_disp_num (const MdmSopMessage *m)
+{
+	MdmDisplay *d;
+	long disp_num;
 
-					g_string_append (resp, di->name);
-					g_string_append_c (resp, ',');
+	if ( ! sop_get_num (m, &disp_num))
+		return FALSE;
 
-					if (d->attached && di->attached && di->vt > 0)
-						migratable = TRUE;					
+	/* Find out who this slave belongs to */
+	d = mdm_display_lookup (m->slave_pid);
 
-					g_string_append_c (resp, migratable ? '1' : '0');
-				}
-			}
+	if (d != NULL) {
+		char *name = g_strdup_printf (":%ld", disp_num);
 
-			/* send ack */
-			if (resp != NULL) {
-				send_slave_ack (d, resp->str);
-				g_string_free (resp, TRUE);
-			} else {
-				send_slave_ack (d, NULL);
-			}
-		}
-	} else if (strncmp (msg, MDM_SOP_MIGRATE " ",
-		            strlen (MDM_SOP_MIGRATE " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		char *p;
-		GSList *li;
-		GSList *displays;
+		mdm_display_set_name (d, name);
+		g_free (name);
+		mdm_display_set_dispnum (d, disp_num);
+		mdm_debug ("Got DISP_NUM == %ld", disp_num);
+		/* send ack */
+		send_slave_ack (d, NULL);
+	}
 
-		displays = mdm_daemon_config_get_display_list ();
+	return TRUE;
+}
 
-		if (sscanf (msg, MDM_SOP_MIGRATE " %ld", &slave_pid) != 1)
-			return;
-		p = strchr (msg, ' ');
-		if (p != NULL)
-			p = strchr (p+1, ' ');
-		if (p == NULL)
-			return;
+static gboolean
+sop_handle_vt_num (const MdmSopMessage *m)
+{
+	MdmDisplay *d;
+	long vt_num;
 
-		p++;
+	if ( ! sop_get_num (m, &vt_num))
+		return FALSE;
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
-		if (d == NULL)
-			return;
+	/* Find out who this slave belongs to */
+	d = mdm_display_lookup (m->slave_pid);
 
-		mdm_debug ("Got MIGRATE %s", p);
-		for (li = displays; li != NULL; li = li->next) {
-			MdmDisplay *di = li->data;
-			if (di->logged_in && strcmp (di->name, p) == 0) {
-				if (d->attached && di->vt > 0)
-					mdm_change_vt (di->vt);				
-			}
-		}
+	if (d != NULL) {
+		mdm_display_set_vt (d, vt_num);
+		mdm_debug ("Got VT_NUM == %ld", vt_num);
+		/* send ack */
 		send_slave_ack (d, NULL);
-	} else if (strncmp (msg, MDM_SOP_COOKIE " ",
-		            strlen (MDM_SOP_COOKIE " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		char *p;
-
-		if (sscanf (msg, MDM_SOP_COOKIE " %ld",
-			    &slave_pid) != 1)
-			return;
-		p = strchr (msg, ' ');
-		if (p != NULL)
-			p = strchr (p+1, ' ');
-		if (p == NULL)
-			return;
-
-		p++;
-
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
-
-		if (d != NULL) {
-			g_free (d->cookie);
-			d->cookie = g_strdup (p);
-			mdm_debug ("Got COOKIE == <secret>");
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_AUTHFILE " ",
-		            strlen (MDM_SOP_AUTHFILE " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		char *p;
-
-		if (sscanf (msg, MDM_SOP_AUTHFILE " %ld",
-			    &slave_pid) != 1)
-			return;
-		p = strchr (msg, ' ');
-		if (p != NULL)
-			p = strchr (p+1, ' ');
-		if (p == NULL)
-			return;
-
-		p++;
+	}
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+	return TRUE;
+}
 
-		if (d != NULL) {
-			g_free (d->authfile);
-			d->authfile = g_strdup (p);
-			mdm_debug ("Got AUTHFILE == %s", d->authfile);
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_FLEXI_ERR " ",
-		            strlen (MDM_SOP_FLEXI_ERR " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		int err;
-
-		if (sscanf (msg, MDM_SOP_FLEXI_ERR " %ld %d",
-			    &slave_pid, &err) != 2)
-			return;
+static gboolean
+sop_handle_servstart (const MdmSopMessage *m)
+{
+	MdmDisplay *d;
+	long usec;
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+	if ( ! sop_get_num (m, &usec))
+		return FALSE;
 
-		if (d != NULL) {
-			char *error = NULL;
-			MdmConnection *conn = d->socket_conn;
-			d->socket_conn = NULL;
+	d = mdm_display_lookup (m->slave_pid);
 
-			if (conn != NULL)
-				mdm_connection_set_close_notify (conn,
-								 NULL, NULL);
+	if (d != NULL) {
+		d->servstart_usec = usec;
+		mdm_debug ("Got SERVSTART == %ld ms for %s", usec / 1000, d->name);
+		/* send ack */
+		send_slave_ack (d, NULL);
+	}
 
-			if (err == 3)
-				error = "ERROR 3 X failed\n";
-			else if (err == 4)
-				error = "ERROR 4 X too busy\n";
-			else if (err == 5)
-				error = "ERROR 5 Nested display can't connect\n";
-			else
-				error = "ERROR 999 Unknown error\n";
-			if (conn != NULL)
-				mdm_connection_write (conn, error);
+	return TRUE;
+}
 
-			mdm_debug ("Got FLEXI_ERR == %d", err);
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_FLEXI_OK " ",
-		            strlen (MDM_SOP_FLEXI_OK " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
+static gboolean
+sop_handle_login (const MdmSopMessage *m)
+{
+	MdmDisplay *d;
 
-		if (sscanf (msg, MDM_SOP_FLEXI_OK " %ld",
-			    &slave_pid) != 1)
-			return;
+	if (m->args == NULL)
+		return FALSE;
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+	/* Find out who this slave belongs to */
+	d = mdm_display_lookup (m->slave_pid);
 
-		if (d != NULL) {
-			MdmConnection *conn = d->socket_conn;
-			d->socket_conn = NULL;
+	if (d != NULL) {
+		g_free (d->login);
+		d->login = g_strdup (m->args);
+		mdm_debug ("Got LOGIN == %s", m->args);
+		/* send ack */
+		send_slave_ack (d, NULL);
+	}
 
-			if (conn != NULL) {
-				mdm_connection_set_close_notify (conn,
-								 NULL, NULL);
-				if ( ! mdm_connection_printf (conn, "OK %s\n", d->name))
-					mdm_display_unmanage (d);
-			}
+	return TRUE;
+}
 
-			mdm_debug ("Got FLEXI_OK");
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strcmp (msg, MDM_SOP_START_NEXT_LOCAL) == 0) {
-		mdm_start_first_unborn_local (3 /* delay */);
-	} else if (strncmp (msg, MDM_SOP_WRITE_X_SERVERS " ",
-		            strlen (MDM_SOP_WRITE_X_SERVERS " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
+static gboolean
+sop_handle_querylogin (const MdmSopMessage *m)
+{
+	MdmDisplay *d;
 
-		if (sscanf (msg, MDM_SOP_WRITE_X_SERVERS " %ld",
-			    &slave_pid) != 1)
-			return;
+	if (m->args == NULL)
+		return FALSE;
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+	/* Find out who this slave belongs to */
+	d = mdm_display_lookup (m->slave_pid);
 
-		if (d != NULL) {
-			write_x_servers (d);
+	if (d != NULL) {
+		GString *resp = NULL;
+		GSList *li;
+		GSList *displays;
 
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_SUSPEND_MACHINE " ",
-			    strlen (MDM_SOP_SUSPEND_MACHINE " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		gboolean sysmenu;
+		displays = mdm_daemon_config_get_display_list ();
+		mdm_debug ("Got QUERYLOGIN %s", m->args);
+		for (li = displays; li != NULL; li = li->next) {
+			MdmDisplay *di = li->data;
+			if (di->logged_in &&
+			    di->login != NULL &&
+			    strcmp (di->login, m->args) == 0) {
+				gboolean migratable = FALSE;
 
-		if (sscanf (msg, MDM_SOP_SUSPEND_MACHINE " %ld", &slave_pid) != 1)
-			return;
-		d = mdm_display_lookup (slave_pid);
+				if (resp == NULL)
+					resp = g_string_new (NULL);
+				else
+					resp = g_string_append_c (resp, ',');
 
-		mdm_info ("Master suspending...");
+				g_string_append (resp, di->name);
+				g_string_append_c (resp, ',');
 
-		sysmenu = mdm_daemon_config_get_value_bool_per_display (MDM_KEY_SYSTEM_MENU, d->name);
-		if (sysmenu && mdm_daemon_config_get_value_string_array (MDM_KEY_SUSPEND) != NULL) {
-			suspend_machine ();
-		}
-	} else if (strncmp (msg, MDM_SOP_CHOSEN_THEME " ",
-		            strlen (MDM_SOP_CHOSEN_THEME " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		const char *p;
+				if (d->attached && di->attached && di->vt > 0)
+					migratable = TRUE;
 
-		if (sscanf (msg, MDM_SOP_CHOSEN_THEME " %ld", &slave_pid) != 1)
-			return;
-		d = mdm_display_lookup (slave_pid);
-
-		if (d != NULL) {
-			g_free (d->theme_name);
-			d->theme_name = NULL;
-
-			/* Syntax errors are partially OK here, if there
-			   was no theme argument we just wanted to clear the
-			   theme field */
-			p = strchr (msg, ' ');
-			if (p != NULL) {
-				p = strchr (p+1, ' ');
-				if (p != NULL) {
-					while (*p == ' ')
-						p++;
-					if ( ! ve_string_empty (p))
-						d->theme_name = g_strdup (p);
-				}
+				g_string_append_c (resp, migratable ? '1' : '0');
 			}
+		}
 
+		/* send ack */
+		if (resp != NULL) {
+			send_slave_ack (d, resp->str);
+			g_string_free (resp, TRUE);
+		} else {
 			send_slave_ack (d, NULL);
 		}
-	} else if (strncmp (msg, "opcode="MDM_SOP_SHOW_ERROR_DIALOG,
-			    strlen ("opcode="MDM_SOP_SHOW_ERROR_DIALOG)) == 0) {
-		char **list;
-		list = g_strsplit (msg, "$$", -1);
-
-		if (mdm_vector_len (list) == 8) {
-			MdmDisplay *d;
-			GtkMessageType type;
-			char *ptr;
-			char *error;
-			char *details_label;
-			char *details_file;
-			long slave_pid;
-			int uid, gid;
-
-			ptr = strchr (list[1], '=');
-			slave_pid = atol (ptr + 1);
-
-			ptr = strchr (list[2], '=');
-			type = atoi (ptr + 1);
-
-			ptr = strchr (list[3], '=');
-			error = g_malloc0 (strlen (ptr));
-			strcpy (error, ptr + 1);
-
-			ptr = strchr (list[4], '=');
-			details_label = g_malloc0 (strlen (ptr));
-			strcpy (details_label, ptr + 1);
-
-			ptr = strchr (list[5], '=');
-			details_file = g_malloc0 (strlen (ptr));
-			strcpy (details_file, ptr + 1);
-
-			ptr = strchr (list[6], '=');
-			uid = atoi (ptr + 1);
-
-			ptr = strchr (list[7], '=');
-			gid = atoi (ptr + 1);
-
-			d = mdm_display_lookup (slave_pid);
-
-			if (d != NULL) {
-				if (MDM_AUTHFILE (d)) {
-					VE_IGNORE_EINTR (
-						chmod (MDM_AUTHFILE (d), 0644));
-				}
-
-				/* FIXME: this is really bad */
-				mdm_errorgui_error_box_full (d, type, error,
-				     details_label, details_file, 0, 0);
+	}
 
-				if (MDM_AUTHFILE (d)) {
-					VE_IGNORE_EINTR (
-						chmod (MDM_AUTHFILE (d), 0640));
-				}
+	return TRUE;
+}
 
-				send_slave_ack_dialog_char (d,
-					MDM_SLAVE_NOTIFY_ERROR_RESPONSE, NULL);
-			}
+static gboolean
+sop_handle_migrate (const MdmSopMessage *m)
+{
+	MdmDisplay *d;
+	GSList *li;
+	GSList *displays;
 
-			g_free (error);
-			g_free (details_label);
-			g_free (details_file);
-		}
-		g_strfreev (list);
-	} else if (strncmp (msg, "opcode="MDM_SOP_SHOW_YESNO_DIALOG,
-                            strlen ("opcode="MDM_SOP_SHOW_YESNO_DIALOG)) == 0) {
-		char **list;
-		list = g_strsplit (msg, "$$", -1);
-
-		if (mdm_vector_len (list) == 3) {
-			MdmDisplay *d;
-			char *ptr;
-			char *yesno_msg;
-			long slave_pid;
-			gboolean resp;
-
-			ptr = strchr (list [1], '=');
-			slave_pid = atol (ptr + 1);
-
-			ptr = strchr (list [2], '=');
-			yesno_msg = g_malloc0 (strlen (ptr));
-			strcpy (yesno_msg, ptr + 1);
-
-			d = mdm_display_lookup (slave_pid);
-			if (d != NULL) {
-				if (MDM_AUTHFILE (d)) {
-					VE_IGNORE_EINTR (
-						chmod (MDM_AUTHFILE (d), 0644));
-				}
+	if (m->args == NULL)
+		return FALSE;
 
-				resp = mdm_errorgui_failsafe_yesno (d,
-					yesno_msg);
+	displays = mdm_daemon_config_get_display_list ();
 
-				send_slave_ack_dialog_int (d,
-					MDM_SLAVE_NOTIFY_YESNO_RESPONSE,
-					resp);
+	/* Find out who this slave belongs to */
+	d = mdm_display_lookup (m->slave_pid);
+	if (d == NULL)
+		return TRUE;
 
-				if (MDM_AUTHFILE (d)) {
-					VE_IGNORE_EINTR (
-						chmod (MDM_AUTHFILE (d), 0640));
-				}
-			}
-			g_free (yesno_msg);
+	mdm_debug ("Got MIGRATE %s", m->args);
+	for (li = displays; li != NULL; li = li->next) {
+		MdmDisplay *di = li->data;
+		if (di->logged_in && strcmp (di->name, m->args) == 0) {
+			if (d->attached && di->vt > 0)
+				mdm_change_vt (di->vt);
 		}
+	}
+	send_slave_ack (d, NULL);
 
-		g_strfreev (list);
-	} else if (strncmp (msg, "opcode="MDM_SOP_SHOW_QUESTION_DIALOG,
-                            strlen ("opcode="MDM_SOP_SHOW_QUESTION_DIALOG)) == 0) {
-		char **list;
+	return TRUE;
+}
 
-		list = g_strsplit (msg, "$$", -1);
+static gboolean
+sop_handle_cookie (const MdmSopMessage *m)
+{
+	MdmDisplay *d;
 
-		if (mdm_vector_len (list) == 4) {
-			MdmDisplay *d;
-			char *ptr;
-			char *question_msg;
-			char *resp;
-			long slave_pid;
-			gboolean echo;
+	if (m->args == NULL)
+		return FALSE;
 
-			ptr = strchr (list [1], '=');
-			slave_pid = atol (ptr + 1);
+	/* Find out who this slave belongs to */
+	d = mdm_display_lookup (m->slave_pid);
 
-			ptr = strchr (list [2], '=');
-			question_msg = g_malloc0 (strlen (ptr));
-			strcpy (question_msg, ptr + 1);
+	if (d != NULL) {
+		g_free (d->cookie);
+		d->cookie = g_strdup (m->args);
+		mdm_debug ("Got COOKIE == <secret>");
+		/* send ack */
+		send_slave_ack (d, NULL);
+	}
 
-			ptr = strchr (list [3], '=');
-			echo = atoi (ptr + 1);
+	return TRUE;
+}
 
-			d = mdm_display_lookup (slave_pid);
-			if (d != NULL) {
-				if (MDM_AUTHFILE (d)) {
-					VE_IGNORE_EINTR (
-						chmod (MDM_AUTHFILE (d), 0644));
-				}
+static gboolean
+sop_handle_authfile (const MdmSopMessage *m)
+{
+	MdmDisplay *d;
 
-				resp = mdm_errorgui_failsafe_question (d,
-					question_msg, echo);
+	if (m->args == NULL)
+		return FALSE;
 
-				send_slave_ack_dialog_char (d,
-					MDM_SLAVE_NOTIFY_QUESTION_RESPONSE,
-					resp);
+	/* Find out who this slave belongs to */
+	d = mdm_display_lookup (m->slave_pid);
 
-				if (MDM_AUTHFILE (d)) {
-					VE_IGNORE_EINTR (
-						chmod (MDM_AUTHFILE (d), 0640));
-				}
-			}
+	if (d != NULL) {
+		g_free (d->authfile);
+		d->authfile = g_strdup (m->args);
+		mdm_debug ("Got AUTHFILE == %s", d->authfile);
+		/* send ack */
+		send_slave_ack (d, NULL);
+	}
+
+	return TRUE;
+}
+
+static gboolean
+sop_handle_flexi_err (const MdmSopMessage *m)
+{
+	MdmDisplay *d;
+	long err;
+
+	if ( ! sop_get_num (m, &err))
+		return FALSE;
+
+	/* Find out who this slave belongs to */
+	d = mdm_display_lookup (m->slave_pid);
+
+	if (d != NULL) {
+		char *error = NULL;
+		MdmConnection *conn = d->socket_conn;
+		d->socket_conn = NULL;
+
+		if (conn != NULL)
+			mdm_connection_set_close_notify (conn,
+							 NULL, NULL);
+
+		if (err == 3)
+			error = "ERROR 3 X failed\n";
+		else if (err == 4)
+			error = "ERROR 4 X too busy\n";
+		else if (err == 5)
+			error = "ERROR 5 Nested display can't connect\n";
+		else
+			error = "ERROR 999 Unknown error\n";
+		if (conn != NULL)
+			mdm_connection_write (conn, error);
+
+		mdm_debug ("Got FLEXI_ERR == %ld", err);
+		/* send ack */
+		send_slave_ack (d, NULL);
+	}
+
+	return TRUE;
+}
+
+static gboolean
+sop_handle_flexi_ok (const MdmSopMessage *m)
+{
+	MdmDisplay *d;
+
+	/* Find out who this slave belongs to */
+	d = mdm_display_lookup (m->slave_pid);
+
+	if (d != NULL) {
+		MdmConnection *conn = d->socket_conn;
+		d->socket_conn = NULL;
 
-			g_free (question_msg);
+		if (conn != NULL) {
+			mdm_connection_set_close_notify (conn,
+							 NULL, NULL);
+			if ( ! mdm_connection_printf (conn, "OK %s\n", d->name))
+				mdm_display_unmanage (d);
 		}
-		g_strfreev (list);
-	} else if (strncmp (msg, "opcode="MDM_SOP_SHOW_ASKBUTTONS_DIALOG,
-                            strlen ("opcode="MDM_SOP_SHOW_ASKBUTTONS_DIALOG)) == 0) {
-		char **list;
-		list = g_strsplit (msg, "$$", -1);
-
-		if (mdm_vector_len (list) == 7) {
-			MdmDisplay *d;
-			char *askbuttons_msg;
-			char *ptr;
-			char *options[4];
-			long slave_pid;
-			int i;
-
-			int resp;
-			ptr = strchr (list [1], '=');
-			slave_pid = atol (ptr + 1);
-
-			ptr = strchr (list [2], '=');
-			askbuttons_msg = g_malloc0 (strlen (ptr));
-			strcpy (askbuttons_msg, ptr + 1);
-
-			ptr = strchr (list [3], '=');
-			options[0] = g_malloc0 (strlen (ptr));
-			strcpy (options[0], ptr + 1);
-
-			ptr = strchr (list [4], '=');
-			options[1] = g_malloc0 (strlen (ptr));
-			strcpy (options[1], ptr + 1);
-
-			ptr = strchr (list [5], '=');
-			options[2] = g_malloc0 (strlen (ptr));
-			strcpy (options[2], ptr + 1);
-
-			ptr = strchr (list [6], '=');
-			options[3] = g_malloc0 (strlen (ptr));
-			strcpy (options[3], ptr + 1);
-
-			d = mdm_display_lookup (slave_pid);
-			if (d != NULL) {
-				if (MDM_AUTHFILE (d)) {
-					VE_IGNORE_EINTR (
-						chmod (MDM_AUTHFILE (d), 0644));
-				}
 
-				resp = mdm_errorgui_failsafe_ask_buttons (d,
-					askbuttons_msg, options);
+		mdm_debug ("Got FLEXI_OK");
+		/* send ack */
+		send_slave_ack (d, NULL);
+	}
 
-				send_slave_ack_dialog_int (d,
-					MDM_SLAVE_NOTIFY_ASKBUTTONS_RESPONSE,
-					resp);
+	return TRUE;
+}
 
-				if (MDM_AUTHFILE (d)) {
-					VE_IGNORE_EINTR (
-						chmod (MDM_AUTHFILE (d), 0640));
-				}
-			}
+static gboolean
+sop_handle_start_next_local (const MdmSopMessage *m)
+{
+	MdmDisplay *d;
+	int delay = 3;
+
+	/* Find out who this slave belongs to */
+	d = mdm_display_lookup (m->slave_pid);
+
+	if (d != NULL && d->starting) {
+		d->starting = FALSE;
+		mdm_info ("Display %s started in %ld ms", d->name,
+			  (long) ((g_get_monotonic_time () - d->bringup_time) / 1000));
+
+		/* no point waiting when starting side by side */
+		if (mdm_daemon_config_get_int_for_id (MDM_ID_STATIC_START_CONCURRENCY) > 1)
+			delay = 0;
+	}
+
+	mdm_start_first_unborn_local (delay);
+
+	return TRUE;
+}
+
+static gboolean
+sop_handle_write_x_servers (const MdmSopMessage *m)
+{
+	MdmDisplay *d;
+
+	/* Find out who this slave belongs to */
+	d = mdm_display_lookup (m->slave_pid);
+
+	if (d != NULL) {
+		write_x_servers (d);
+
+		/* send ack */
+		send_slave_ack (d, NULL);
+	}
+
+	return TRUE;
+}
+
+static gboolean
+sop_handle_suspend_machine (const MdmSopMessage *m)
+{
+	MdmDisplay *d;
+	gboolean sysmenu;
+
+	d = mdm_display_lookup (m->slave_pid);
+	if (d == NULL)
+		return FALSE;
+
+	mdm_info ("Master suspending...");
+
+	sysmenu = mdm_daemon_config_get_value_bool_per_display (MDM_KEY_SYSTEM_MENU, d->name);
+	if (sysmenu && mdm_daemon_config_get_value_string_array (MDM_KEY_SUSPEND) != NULL) {
+		suspend_machine ();
+	}
+
+	return TRUE;
+}
+
+static gboolean
+sop_handle_chosen_theme (const MdmSopMessage *m)
+{
+	MdmDisplay *d;
+	const char *p;
+
+	d = mdm_display_lookup (m->slave_pid);
+
+	if (d != NULL) {
+		g_free (d->theme_name);
+		d->theme_name = NULL;
+
+		/* Syntax errors are partially OK here, if there
+		   was no theme argument we just wanted to clear the
+		   theme field */
+		p = m->args;
+		if (p != NULL) {
+			while (*p == ' ')
+				p++;
+			if ( ! ve_string_empty (p))
+				d->theme_name = g_strdup (p);
+		}
+
+		send_slave_ack (d, NULL);
+	}
+
+	return TRUE;
+}
+
+static gboolean
+sop_handle_show_error_dialog (const MdmSopMessage *m)
+{
+	char **list = m->fields;
+	MdmDisplay *d;
+	GtkMessageType type;
+	char *ptr;
+	char *error;
+	char *details_label;
+	char *details_file;
+	long slave_pid;
+	int uid, gid;
+
+	if (mdm_vector_len (list) != 8)
+		return FALSE;
+
+	ptr = strchr (list[1], '=');
+	slave_pid = atol (ptr + 1);
+
+	ptr = strchr (list[2], '=');
+	type = atoi (ptr + 1);
+
+	ptr = strchr (list[3], '=');
+	error = g_malloc0 (strlen (ptr));
+	strcpy (error, ptr + 1);
+
+	ptr = strchr (list[4], '=');
+	details_label = g_malloc0 (strlen (ptr));
+	strcpy (details_label, ptr + 1);
+
+	ptr = strchr (list[5], '=');
+	details_file = g_malloc0 (strlen (ptr));
+	strcpy (details_file, ptr + 1);
+
+	ptr = strchr (list[6], '=');
+	uid = atoi (ptr + 1);
+
+	ptr = strchr (list[7], '=');
+	gid = atoi (ptr + 1);
+
+	d = mdm_display_lookup (slave_pid);
+
+	if (d != NULL) {
+		if (MDM_AUTHFILE (d)) {
+			VE_IGNORE_EINTR (
+				chmod (MDM_AUTHFILE (d), 0644));
+		}
+
+		/* FIXME: this is really bad */
+		mdm_errorgui_error_box_full (d, type, error,
+		     details_label, details_file, 0, 0);
+
+		if (MDM_AUTHFILE (d)) {
+			VE_IGNORE_EINTR (
+				chmod (MDM_AUTHFILE (d), 0640));
+		}
+
+		send_slave_ack_dialog_char (d,
+			MDM_SLAVE_NOTIFY_ERROR_RESPONSE, NULL);
+	}
+
+	g_free (error);
+	g_free (details_label);
+	g_free (details_file);
+
+	return TRUE;
+}
+
+static gboolean
+sop_handle_show_yesno_dialog (const MdmSopMessage *m)
+{
+	char **list = m->fields;
+	MdmDisplay *d;
+	char *ptr;
+	char *yesno_msg;
+	long slave_pid;
+	gboolean resp;
+
+	if (mdm_vector_len (list) != 3)
+		return FALSE;
+
+	ptr = strchr (list [1], '=');
+	slave_pid = atol (ptr + 1);
+
+	ptr = strchr (list [2], '=');
+	yesno_msg = g_malloc0 (strlen (ptr));
+	strcpy (yesno_msg, ptr + 1);
+
+	d = mdm_display_lookup (slave_pid);
+	if (d != NULL) {
+		if (MDM_AUTHFILE (d)) {
+			VE_IGNORE_EINTR (
+				chmod (MDM_AUTHFILE (d), 0644));
+		}
+
+		resp = mdm_errorgui_failsafe_yesno (d,
+			yesno_msg);
+
+		send_slave_ack_dialog_int (d,
+			MDM_SLAVE_NOTIFY_YESNO_RESPONSE,
+			resp);
+
+		if (MDM_AUTHFILE (d)) {
+			VE_IGNORE_EINTR (
+				chmod (MDM_AUTHFILE (d), 0640));
+		}
+	}
+	g_free (yesno_msg);
+
+	return TRUE;
+}
+
+static gboolean
+sop_handle_show_question_dialog (const MdmSopMessage *m)
+{
+	char **list = m->fields;
+	MdmDisplay *d;
+	char *ptr;
+	char *question_msg;
+	char *resp;
+	long slave_pid;
+	gboolean echo;
+
+	if (mdm_vector_len (list) != 4)
+		return FALSE;
+
+	ptr = strchr (list [1], '=');
+	slave_pid = atol (ptr + 1);
+
+	ptr = strchr (list [2], '=');
+	question_msg = g_malloc0 (strlen (ptr));
+	strcpy (question_msg, ptr + 1);
+
+	ptr = strchr (list [3], '=');
+	echo = atoi (ptr + 1);
+
+	d = mdm_display_lookup (slave_pid);
+	if (d != NULL) {
+		if (MDM_AUTHFILE (d)) {
+			VE_IGNORE_EINTR (
+				chmod (MDM_AUTHFILE (d), 0644));
+		}
+
+		resp = mdm_errorgui_failsafe_question (d,
+			question_msg, echo);
+
+		send_slave_ack_dialog_char (d,
+			MDM_SLAVE_NOTIFY_QUESTION_RESPONSE,
+			resp);
+
+		if (MDM_AUTHFILE (d)) {
+			VE_IGNORE_EINTR (
+				chmod (MDM_AUTHFILE (d), 0640));
+		}
+	}
+
+	g_free (question_msg);
+
+	return TRUE;
+}
+
+static gboolean
+sop_handle_show_askbuttons_dialog (const MdmSopMessage *m)
+{
+	char **list = m->fields;
+	MdmDisplay *d;
+	char *askbuttons_msg;
+	char *ptr;
+	char *options[4];
+	long slave_pid;
+	int i;
+	int resp;
+
+	if (mdm_vector_len (list) != 7)
+		return FALSE;
+
+	ptr = strchr (list [1], '=');
+	slave_pid = atol (ptr + 1);
+
+	ptr = strchr (list [2], '=');
+	askbuttons_msg = g_malloc0 (strlen (ptr));
+	strcpy (askbuttons_msg, ptr + 1);
+
+	ptr = strchr (list [3], '=');
+	options[0] = g_malloc0 (strlen (ptr));
+	strcpy (options[0], ptr + 1);
+
+	ptr = strchr (list [4], '=');
+	options[1] = g_malloc0 (strlen (ptr));
+	strcpy (options[1], ptr + 1);
+
+	ptr = strchr (list [5], '=');
+	options[2] = g_malloc0 (strlen (ptr));
+	strcpy (options[2], ptr + 1);
+
+	ptr = strchr (list [6], '=');
+	options[3] = g_malloc0 (strlen (ptr));
+	strcpy (options[3], ptr + 1);
+
+	d = mdm_display_lookup (slave_pid);
+	if (d != NULL) {
+		if (MDM_AUTHFILE (d)) {
+			VE_IGNORE_EINTR (
+				chmod (MDM_AUTHFILE (d), 0644));
+		}
+
+		resp = mdm_errorgui_failsafe_ask_buttons (d,
+			askbuttons_msg, options);
+
+		send_slave_ack_dialog_int (d,
+			MDM_SLAVE_NOTIFY_ASKBUTTONS_RESPONSE,
+			resp);
+
+		if (MDM_AUTHFILE (d)) {
+			VE_IGNORE_EINTR (
+				chmod (MDM_AUTHFILE (d), 0640));
+		}
+	}
+
+	g_free (askbuttons_msg);
+
+	for (i = 0; i < 4; i ++)
+		g_free (options[i]);
+
+	return TRUE;
+}
+
+static MdmSopHandler sop_handlers[] = {
+	{ MDM_SOP_XPID, MDM_SOP_ID_XPID, SOP_ARGS_PID, sop_handle_xpid },
+	{ MDM_SOP_SESSPID, MDM_SOP_ID_SESSPID, SOP_ARGS_PID, sop_handle_sesspid },
+	{ MDM_SOP_GREETPID, MDM_SOP_ID_GREETPID, SOP_ARGS_PID, sop_handle_greetpid },
+	{ MDM_SOP_LOGGED_IN, MDM_SOP_ID_LOGGED_IN, SOP_ARGS_PID, sop_handle_logged_in },
+	{ MDM_SOP_DISP_NUM, MDM_SOP_ID_DISP_NUM, SOP_ARGS_PID, sop_handle_disp_num },
+	{ MDM_SOP_VT_NUM, MDM_SOP_ID_VT_NUM, SOP_ARGS_PID, sop_handle_vt_num },
+	{ MDM_SOP_SERVSTART, MDM_SOP_ID_SERVSTART, SOP_ARGS_PID, sop_handle_servstart },
+	{ MDM_SOP_LOGIN, MDM_SOP_ID_LOGIN, SOP_ARGS_PID, sop_handle_login },
+	{ MDM_SOP_QUERYLOGIN, MDM_SOP_ID_QUERYLOGIN, SOP_ARGS_PID, sop_handle_querylogin },
+	{ MDM_SOP_MIGRATE, MDM_SOP_ID_MIGRATE, SOP_ARGS_PID, sop_handle_migrate },
+	{ MDM_SOP_COOKIE, MDM_SOP_ID_COOKIE, SOP_ARGS_PID, sop_handle_cookie },
+	{ MDM_SOP_AUTHFILE, MDM_SOP_ID_AUTHFILE, SOP_ARGS_PID, sop_handle_authfile },
+	{ MDM_SOP_FLEXI_ERR, MDM_SOP_ID_FLEXI_ERR, SOP_ARGS_PID, sop_handle_flexi_err },
+	{ MDM_SOP_FLEXI_OK, MDM_SOP_ID_FLEXI_OK, SOP_ARGS_PID, sop_handle_flexi_ok },
+	{ MDM_SOP_START_NEXT_LOCAL, 0, SOP_ARGS_PID, sop_handle_start_next_local },
+	{ MDM_SOP_WRITE_X_SERVERS, MDM_SOP_ID_WRITE_X_SERVERS, SOP_ARGS_PID, sop_handle_write_x_servers },
+	{ MDM_SOP_SUSPEND_MACHINE, 0, SOP_ARGS_PID, sop_handle_suspend_machine },
+	{ MDM_SOP_CHOSEN_THEME, MDM_SOP_ID_CHOSEN_THEME, SOP_ARGS_PID, sop_handle_chosen_theme },
+	{ MDM_SOP_SHOW_ERROR_DIALOG, 0, SOP_ARGS_FIELDS, sop_handle_show_error_dialog },
+	{ MDM_SOP_SHOW_YESNO_DIALOG, 0, SOP_ARGS_FIELDS, sop_handle_show_yesno_dialog },
+	{ MDM_SOP_SHOW_QUESTION_DIALOG, 0, SOP_ARGS_FIELDS, sop_handle_show_question_dialog },
+	{ MDM_SOP_SHOW_ASKBUTTONS_DIALOG, 0, SOP_ARGS_FIELDS, sop_handle_show_askbuttons_dialog },
+	{ NULL }
+};
+
+static GHashTable    *sop_handler_table = NULL;
+static MdmSopHandler *sop_handlers_by_id[MDM_SOP_ID_LAST];
+static guint          sop_unknown       = 0;
+
+static void
+sop_init_handlers (void)
+{
+	int i;
+
+	if (sop_handler_table != NULL)
+		return;
+
+	sop_handler_table = g_hash_table_new (g_str_hash, g_str_equal);
+	for (i = 0; sop_handlers[i].opcode != NULL; i++) {
+		g_hash_table_insert (sop_handler_table,
+				     (gpointer) sop_handlers[i].opcode,
+				     &sop_handlers[i]);
+		if (sop_handlers[i].id > 0)
+			sop_handlers_by_id[sop_handlers[i].id] = &sop_handlers[i];
+	}
+}
+
+static MdmSopHandler *
+sop_lookup_handler (const char *opcode, gsize len)
+{
+	char key[64];
+
+	sop_init_handlers ();
+
+	if (len >= sizeof (key))
+		return NULL;
+
+	memcpy (key, opcode, len);
+	key[len] = '\0';
+
+	return g_hash_table_lookup (sop_handler_table, key);
+}
+
+static void
+sop_log_stats (void)
+{
+	int i;
+
+	for (i = 0; sop_handlers[i].opcode != NULL; i++) {
+		if (sop_handlers[i].handled == 0 && sop_handlers[i].rejected == 0)
+			continue;
+		mdm_debug ("Slave message %s: %u handled, %u rejected",
+			   sop_handlers[i].opcode,
+			   sop_handlers[i].handled,
+			   sop_handlers[i].rejected);
+	}
+
+	if (sop_unknown > 0)
+		mdm_debug ("Slave messages with unknown opcodes: %u", sop_unknown);
+}
+
+static void
+mdm_handle_message (MdmConnection *conn, const char *msg, gpointer data)
+{
+	MdmSopHandler *handler;
+	MdmSopMessage m;
+	const char *opcode;
+	gsize len;
+	gboolean ok;
+
+	/* Evil!, all this for debugging? */
+	if G_UNLIKELY (mdm_daemon_config_get_value_bool (MDM_KEY_DEBUG)) {
+		if (strncmp (msg, MDM_SOP_COOKIE " ",
+			     strlen (MDM_SOP_COOKIE " ")) == 0) {
+			char *s = g_strndup
+				(msg, strlen (MDM_SOP_COOKIE " XXXX XX"));
+			/* cut off most of the cookie for "security" */
+			mdm_debug ("Handling message: '%s...'", s);
+			g_free (s);
+		}
+	}
+
+	if (strncmp (msg, "opcode=", strlen ("opcode=")) == 0) {
+		const char *end;
+
+		opcode = msg + strlen ("opcode=");
+		end = strstr (opcode, "$$");
+		len = (end != NULL) ? (gsize) (end - opcode) : strlen (opcode);
+	} else {
+		opcode = msg;
+		len = strcspn (msg, " ");
+	}
+
+	handler = sop_lookup_handler (opcode, len);
+	if (handler == NULL) {
+		sop_unknown++;
+		return;
+	}
+
+	memset (&m, 0, sizeof (m));
+
+	switch (handler->args) {
+	case SOP_ARGS_NONE:
+		ok = (opcode[len] == '\0');
+		break;
+
+	case SOP_ARGS_PID: {
+		char *end;
+
+		ok = (opcode[len] == ' ');
+		if ( ! ok)
+			break;
+
+		m.slave_pid = strtol (opcode + len + 1, &end, 10);
+		ok = (end != opcode + len + 1);
+		if ( ! ok)
+			break;
+
+		m.args = strchr (end, ' ');
+		if (m.args != NULL)
+			m.args++;
+		break;
+	}
+
+	case SOP_ARGS_FIELDS:
+		m.fields = g_strsplit (msg, "$$", -1);
+		ok = TRUE;
+		break;
+
+	default:
+		ok = FALSE;
+		break;
+	}
+
+	if (ok)
+		ok = handler->handler (&m);
+
+	if (ok)
+		handler->handled++;
+	else
+		handler->rejected++;
+
+	g_strfreev (m.fields);
+}
+
+static void
+mdm_handle_frame (MdmConnection *conn, const char *frame, gpointer data)
+{
+	MdmSopFrameHeader header;
+	MdmSopHandler *handler;
+	MdmSopMessage m;
+	const char *payload;
+	gsize payload_len;
+	char *str = NULL;
+	guint16 length;
+	gboolean ok;
+
+	sop_init_handlers ();
+
+	memcpy (&length, frame + 2, sizeof (length));
+	if (length < sizeof (header)) {
+		sop_unknown++;
+		return;
+	}
+	memcpy (&header, frame, sizeof (header));
+
+	if (header.version != MDM_SOP_FRAME_VERSION ||
+	    header.opcode >= MDM_SOP_ID_LAST ||
+	    sop_handlers_by_id[header.opcode] == NULL) {
+		mdm_debug ("Dropping frame version %d opcode %d",
+			   (int) header.version, (int) header.opcode);
+		sop_unknown++;
+		return;
+	}
+	handler = sop_handlers_by_id[header.opcode];
+
+	payload = frame + sizeof (header);
+	payload_len = length - sizeof (header);
 
-			g_free (askbuttons_msg);
+	memset (&m, 0, sizeof (m));
+	m.slave_pid = header.slave_pid;
 
-			for (i = 0; i < 3; i ++)
-				g_free (options[i]);
+	switch (header.type) {
+	case MDM_SOP_FIELD_NONE:
+		ok = (payload_len == 0);
+		break;
+
+	case MDM_SOP_FIELD_NUM:
+		ok = (payload_len == sizeof (m.num));
+		if (ok) {
+			memcpy (&m.num, payload, sizeof (m.num));
+			m.has_num = TRUE;
 		}
-		g_strfreev (list);
+		break;
+
+	case MDM_SOP_FIELD_STRING:
+		str = g_strndup (payload, payload_len);
+		m.args = str;
+		ok = TRUE;
+		break;
+
+	default:
+		ok = FALSE;
+		break;
+	}
+
+	if (header.flags & MDM_SOP_FRAME_MORE)
+		sop_batch_pid = header.slave_pid;
+
+	if (ok)
+		ok = handler->handler (&m);
+
+	if (ok)
+		handler->handled++;
+	else
+		handler->rejected++;
+
+	g_free (str);
+
+	/* end of a batch, ack it all at once */
+	if (sop_batch_pid != 0 &&
+	    ! (header.flags & MDM_SOP_FRAME_MORE)) {
+		MdmDisplay *d = sop_batch_ack;
+		char *resp = sop_batch_ack_resp;
+
+		sop_batch_pid = 0;
+		sop_batch_ack = NULL;
+		sop_batch_ack_resp = NULL;
+
+		if (d != NULL)
+			send_slave_ack (d, resp);
+		g_free (resp);
 	}
 }
 
@@ -2522,8 +2999,116 @@ close_conn (gpointer data)
 	}
 }
 
+/*
+ * The flexi pool is FlexiPoolSize spare flexi displays, started with a
+ * greeter on a VT nobody is looking at.  Switching to one of their VTs,
+ * or asking for a new flexi server, claims one, and the pool gets
+ * topped up again one display at a time.  A new spare grabs the VT
+ * for a moment while it starts, so after a claim the top up waits
+ * until someone logs in on the claimed greeter, or for
+ * FLEXI_POOL_CLAIM_DELAY seconds.
+ */
+#define FLEXI_POOL_CLAIM_DELAY 60
+
+static int
+flexi_pool_count (int *starting)
+{
+	GSList *li;
+	int count = 0;
+
+	*starting = 0;
+	for (li = mdm_daemon_config_get_display_list (); li != NULL; li = li->next) {
+		MdmDisplay *disp = li->data;
+
+		if ( ! disp->pooled)
+			continue;
+		count++;
+		if (disp->greetpid <= 0)
+			(*starting)++;
+	}
+
+	return count;
+}
+
+static MdmDisplay *
+flexi_pool_find_ready (const char *server)
+{
+	GSList *li;
+
+	for (li = mdm_daemon_config_get_display_list (); li != NULL; li = li->next) {
+		MdmDisplay *disp = li->data;
+
+		if (disp->pooled &&
+		    disp->greetpid > 0 &&
+		    disp->vt > 0 &&
+		    strcmp (ve_sure_string (disp->command), server) == 0)
+			return disp;
+	}
+
+	return NULL;
+}
+
+static gboolean
+flexi_pool_refill (gpointer data)
+{
+	int starting;
+
+	flexi_pool_refill_id = 0;
+	flexi_pool_claim_pending = FALSE;
+
+	/* Start just one at a time, each new server grabs the VT for
+	 * a moment */
+	if (mdm_wait_for_go ||
+	    flexi_pool_failures >= 3 ||
+	    flexi_pool_count (&starting) >= mdm_daemon_config_get_int_for_id (MDM_ID_FLEXI_POOL_SIZE) ||
+	    starting > 0 ||
+	    flexi_servers >= mdm_daemon_config_get_value_int (MDM_KEY_FLEXIBLE_XSERVERS))
+		return FALSE;
+
+	mdm_debug ("flexi_pool_refill: Starting a spare flexi server");
+	handle_flexi_server (NULL, TYPE_FLEXI,
+			     mdm_daemon_config_get_value_string (MDM_KEY_STANDARD_XSERVER),
+			     TRUE, NULL, TRUE /* pooled */);
+
+	return FALSE;
+}
+
+static void
+flexi_pool_schedule_refill (int delay)
+{
+	if (flexi_pool_refill_id != 0 ||
+	    mdm_daemon_config_get_int_for_id (MDM_ID_FLEXI_POOL_SIZE) <= 0)
+		return;
+
+	flexi_pool_refill_id = g_timeout_add_seconds (delay, flexi_pool_refill, NULL);
+}
+
+static void
+flexi_pool_reschedule_refill (int delay)
+{
+	if (flexi_pool_refill_id != 0) {
+		g_source_remove (flexi_pool_refill_id);
+		flexi_pool_refill_id = 0;
+	}
+
+	flexi_pool_schedule_refill (delay);
+}
+
+static void
+flexi_pool_claim (MdmDisplay *disp)
+{
+	mdm_debug ("flexi_pool_claim: %s is no longer a spare", disp->name);
+
+	disp->pooled = FALSE;
+	/* the slave must not hide the VT if it restarts the server */
+	send_slave_command (disp, MDM_NOTIFY_CLAIMED);
+
+	flexi_pool_reschedule_refill (FLEXI_POOL_CLAIM_DELAY);
+	flexi_pool_claim_pending = (flexi_pool_refill_id != 0);
+}
+
 static void
-handle_flexi_server (MdmConnection *conn, int type, const char *server, gboolean handled, const char *username)
+handle_flexi_server (MdmConnection *conn, int type, const char *server, gboolean handled, const char *username, gboolean pooled)
 {
 	MdmDisplay *display;
 	gchar *bin;
@@ -2538,6 +3123,20 @@ handle_flexi_server (MdmConnection *conn, int type, const char *server, gboolean
 		return;
 	}	
 
+	/* Take a spare one if we have it, it only needs a VT switch */
+	if ( ! pooled &&
+	    type == TYPE_FLEXI &&
+	    handled &&
+	    username == NULL &&
+	    (display = flexi_pool_find_ready (ve_sure_string (server))) != NULL) {
+		flexi_pool_claim (display);
+		mdm_change_vt (display->vt);
+		send_slave_command (display, MDM_NOTIFY_TWIDDLE_POINTER);
+		if (conn != NULL)
+			mdm_connection_printf (conn, "OK %s\n", display->name);
+		return;
+	}
+
 	if (flexi_servers >= mdm_daemon_config_get_value_int (MDM_KEY_FLEXIBLE_XSERVERS)) {
 		if (conn != NULL)
 			mdm_connection_write (conn,
@@ -2569,10 +3168,9 @@ handle_flexi_server (MdmConnection *conn, int type, const char *server, gboolean
 	   oh well, this makes other things simpler */
 	display->handled = handled;
 
-	flexi_servers++;
-
 	display->preset_user = g_strdup (username);
 	display->type = type;
+	display->pooled = pooled;
 	display->socket_conn = conn;
 		
 	if (conn != NULL)
@@ -2755,6 +3353,221 @@ sup_handle_get_config (MdmConnection *conn,
 	g_strfreev (splitstr);
 }
 
+/*
+ * Appends one "<type>:<group/key>=<value>" record line to a bulk
+ * GET_CONFIG_MULTI / GET_CONFIG_ALL reply.  The value is escaped so
+ * that it can never contain the newline ending the record.
+ */
+static void
+sup_append_config_record (GString           *reply,
+			  const char        *keystring,
+			  MdmConfigValueType type,
+			  const char        *display)
+{
+	char *value;
+	char *escaped;
+	char  type_char;
+
+	value = NULL;
+	mdm_daemon_config_to_string (keystring, display, &value);
+
+	switch (type) {
+	case MDM_CONFIG_VALUE_BOOL:
+		type_char = 'b';
+		break;
+	case MDM_CONFIG_VALUE_INT:
+		type_char = 'i';
+		break;
+	default:
+		type_char = 's';
+		break;
+	}
+
+	escaped = g_strescape (ve_sure_string (value), NULL);
+	g_string_append_printf (reply, "%c:%s=%s\n", type_char, keystring, escaped);
+
+	g_free (escaped);
+	g_free (value);
+}
+
+static void
+sup_write_config_records (MdmConnection *conn,
+			  GString       *records,
+			  int            count)
+{
+	GString *reply;
+
+	reply = g_string_sized_new (records->len + 16);
+	g_string_printf (reply, "OK %d\n", count);
+	g_string_append_len (reply, records->str, records->len);
+
+	mdm_connection_write (conn, reply->str);
+
+	g_string_free (reply, TRUE);
+}
+
+static void
+sup_handle_get_config_multi (MdmConnection *conn,
+			     const char    *msg,
+			     gpointer       data)
+{
+	const char *parms;
+	const char *display;
+	char **splitstr;
+	GString *records;
+	int count;
+	int i;
+
+	parms = &msg[strlen (MDM_SUP_GET_CONFIG_MULTI " ")];
+
+	splitstr = g_strsplit (parms, " ", -1);
+
+	if (splitstr == NULL || splitstr[0] == NULL || splitstr[1] == NULL) {
+		mdm_connection_printf (conn, "ERROR 50 Unsupported key <null>\n");
+		g_strfreev (splitstr);
+		return;
+	}
+
+	display = strcmp (splitstr[0], "-") == 0 ? NULL : splitstr[0];
+
+	mdm_debug ("Handling GET_CONFIG_MULTI for display %s",
+		   display ? display : "(null)");
+
+	records = g_string_new (NULL);
+	count = 0;
+
+	for (i = 1; splitstr[i] != NULL; i++) {
+		MdmConfigValueType type;
+
+		if (ve_string_empty (splitstr[i]))
+			continue;
+
+		type = mdm_daemon_config_get_key_type (splitstr[i]);
+		if (type == MDM_CONFIG_VALUE_INVALID) {
+			mdm_debug ("GET_CONFIG_MULTI: skipping unsupported key <%s>", splitstr[i]);
+			continue;
+		}
+
+		sup_append_config_record (records, splitstr[i], type, display);
+		count++;
+	}
+
+	sup_write_config_records (conn, records, count);
+
+	g_string_free (records, TRUE);
+	g_strfreev (splitstr);
+}
+
+static void
+sup_handle_get_config_all (MdmConnection *conn,
+			   const char    *msg,
+			   gpointer       data)
+{
+	const char *display;
+	const char *group;
+	char **splitstr;
+	GString *records;
+	int count;
+	int i;
+
+	splitstr = NULL;
+	display = NULL;
+	group = NULL;
+
+	if (strncmp (msg, MDM_SUP_GET_CONFIG_ALL " ",
+		     strlen (MDM_SUP_GET_CONFIG_ALL " ")) == 0) {
+		splitstr = g_strsplit (&msg[strlen (MDM_SUP_GET_CONFIG_ALL " ")], " ", 2);
+		if (splitstr[0] != NULL) {
+			if (strcmp (splitstr[0], "-") != 0)
+				display = splitstr[0];
+			if (splitstr[1] != NULL && ! ve_string_empty (splitstr[1]))
+				group = splitstr[1];
+		}
+	}
+
+	mdm_debug ("Handling GET_CONFIG_ALL: group %s for display %s",
+		   group ? group : "(all)",
+		   display ? display : "(null)");
+
+	records = g_string_new (NULL);
+	count = 0;
+
+	for (i = 0; mdm_daemon_config_entries[i].group != NULL; i++) {
+		const MdmConfigEntry *entry = &mdm_daemon_config_entries[i];
+		char *keystring;
+
+		/*
+		 * Only the greeter groups are dumped, the few other keys
+		 * greeters read have to be asked for by name.  The
+		 * snapshot follows the same rules.
+		 */
+		if ( ! mdm_daemon_config_is_greeter_group (entry->group))
+			continue;
+
+		if (group != NULL && strcmp (entry->group, group) != 0)
+			continue;
+
+		/*
+		 * The prefetch program is only handed to the first display
+		 * that asks for it, see sup_handle_get_config, so it has to
+		 * keep going through GET_CONFIG.
+		 */
+		if (entry->id == MDM_ID_PRE_FETCH_PROGRAM)
+			continue;
+
+		keystring = g_strdup_printf ("%s/%s", entry->group, entry->key);
+		sup_append_config_record (records, keystring, entry->type, display);
+		g_free (keystring);
+		count++;
+	}
+
+	sup_write_config_records (conn, records, count);
+
+	g_string_free (records, TRUE);
+	g_strfreev (splitstr);
+}
+
+static void
+sup_handle_get_config_translated (MdmConnection *conn,
+				  const char    *msg,
+				  gpointer       data)
+{
+	const char *parms;
+	const char *display;
+	char **splitstr;
+	char *retval;
+
+	parms = &msg[strlen (MDM_SUP_GET_CONFIG_TRANSLATED " ")];
+
+	splitstr = g_strsplit (parms, " ", -1);
+
+	if (splitstr == NULL || splitstr[0] == NULL || splitstr[1] == NULL) {
+		mdm_connection_printf (conn, "ERROR 50 Unsupported key <null>\n");
+		goto out;
+	}
+
+	display = strcmp (splitstr[0], "-") == 0 ? NULL : splitstr[0];
+
+	mdm_debug ("Handling GET_CONFIG_TRANSLATED: %s for display %s", splitstr[1],
+		   display ? display : "(null)");
+
+	/* the languages, if any, follow the key */
+	if (mdm_daemon_config_to_translated_string (splitstr[1], display,
+						    (const char * const *)&splitstr[2],
+						    &retval)) {
+		mdm_connection_printf (conn, "OK %s\n", ve_sure_string (retval));
+		g_free (retval);
+	} else if (mdm_daemon_config_is_valid_key (splitstr[1])) {
+		mdm_connection_printf (conn, "OK \n");
+	} else {
+		mdm_connection_printf (conn,
+				       "ERROR 50 Unsupported key <%s>\n",
+				       splitstr[1]);
+	}
+ out:
+	g_strfreev (splitstr);
+}
+
 static gboolean
 is_action_available (MdmDisplay *disp, gchar *action)
 {
@@ -3013,11 +3826,8 @@ sup_handle_set_vt (MdmConnection *conn,
 		   const char    *msg,
 		   gpointer       data)
 {
+	MdmDisplay *disp;
 	int vt;
-	GSList *li;
-	GSList *displays;
-
-	displays = mdm_daemon_config_get_display_list ();
 
 	if (sscanf (msg, MDM_SUP_SET_VT " %d", &vt) != 1 ||
 	    vt < 0) {
@@ -3035,12 +3845,11 @@ sup_handle_set_vt (MdmConnection *conn,
 
 #if defined (MDM_USE_SYS_VT) || defined (MDM_USE_CONSIO_VT)
 	mdm_change_vt (vt);
-	for (li = displays; li != NULL; li = li->next) {
-		MdmDisplay *disp = li->data;
-		if (disp->vt == vt) {
-			send_slave_command (disp, MDM_NOTIFY_TWIDDLE_POINTER);
-			break;
-		}
+	disp = mdm_display_lookup_vt (vt);
+	if (disp != NULL) {
+		if (disp->pooled)
+			flexi_pool_claim (disp);
+		send_slave_command (disp, MDM_NOTIFY_TWIDDLE_POINTER);
 	}
 	mdm_connection_write (conn, "OK\n");
 #else
@@ -3053,11 +3862,17 @@ mdm_handle_user_message (MdmConnection *conn,
 			 const char    *msg,
 			 gpointer       data)
 {
+	int max_messages;
 
 	mdm_debug ("Handling user message: '%s'", msg);
 
-	if (mdm_connection_get_message_count (conn) > MDM_SUP_MAX_MESSAGES) {
-		mdm_debug ("Closing connection, %d messages reached", MDM_SUP_MAX_MESSAGES);
+	if (mdm_connection_get_pipelined (conn))
+		max_messages = MDM_SUP_MAX_PIPELINED_MESSAGES;
+	else
+		max_messages = MDM_SUP_MAX_MESSAGES;
+
+	if (mdm_connection_get_message_count (conn) > max_messages) {
+		mdm_debug ("Closing connection, %d messages reached", max_messages);
 		mdm_connection_write (conn, "ERROR 200 Too many messages\n");
 		mdm_connection_close (conn);
 		return;
@@ -3076,7 +3891,13 @@ mdm_handle_user_message (MdmConnection *conn,
 			return;
 		}
 
-		handle_flexi_server (conn, TYPE_FLEXI, mdm_daemon_config_get_value_string (MDM_KEY_STANDARD_XSERVER), TRUE, NULL);
+		/* The reply comes once the server is up, untagged */
+		if (mdm_connection_get_pipelined (conn)) {
+			mdm_connection_write (conn, "ERROR 201 Not allowed in pipelined mode\n");
+			return;
+		}
+
+		handle_flexi_server (conn, TYPE_FLEXI, mdm_daemon_config_get_value_string (MDM_KEY_STANDARD_XSERVER), TRUE, NULL, FALSE);
 
 	} else if ((strncmp (msg, MDM_SUP_ATTACHED_SERVERS,
 	                     strlen (MDM_SUP_ATTACHED_SERVERS)) == 0)) {
@@ -3102,6 +3923,32 @@ mdm_handle_user_message (MdmConnection *conn,
 
 		sup_handle_get_config (conn, msg, data);
 
+	} else if (strncmp (msg, MDM_SUP_GET_CONFIG_MULTI " ",
+			    strlen (MDM_SUP_GET_CONFIG_MULTI " ")) == 0) {
+		/* Only the first line of the reply would carry the tag */
+		if (mdm_connection_get_pipelined (conn)) {
+			mdm_connection_write (conn, "ERROR 201 Not allowed in pipelined mode\n");
+			return;
+		}
+
+		sup_handle_get_config_multi (conn, msg, data);
+
+	} else if (strncmp (msg, MDM_SUP_GET_CONFIG_TRANSLATED " ",
+			    strlen (MDM_SUP_GET_CONFIG_TRANSLATED " ")) == 0) {
+
+		sup_handle_get_config_translated (conn, msg, data);
+
+	} else if (strcmp (msg, MDM_SUP_GET_CONFIG_ALL) == 0 ||
+		   strncmp (msg, MDM_SUP_GET_CONFIG_ALL " ",
+			    strlen (MDM_SUP_GET_CONFIG_ALL " ")) == 0) {
+		/* Same as GET_CONFIG_MULTI */
+		if (mdm_connection_get_pipelined (conn)) {
+			mdm_connection_write (conn, "ERROR 201 Not allowed in pipelined mode\n");
+			return;
+		}
+
+		sup_handle_get_config_all (conn, msg, data);
+
 	} else if (strcmp (msg, MDM_SUP_GET_CONFIG_FILE) == 0) {
 		/*
 		 * Value is only non-null if passed in on command line.
@@ -3141,6 +3988,9 @@ mdm_handle_user_message (MdmConnection *conn,
 		sup_handle_set_vt (conn, msg, data);	
 	} else if (strcmp (msg, MDM_SUP_VERSION) == 0) {
 		mdm_connection_write (conn, "MDM " VERSION "\n");
+	} else if (strcmp (msg, MDM_SUP_VERSION " " MDM_SUP_PIPELINE) == 0) {
+		mdm_connection_set_pipelined (conn, TRUE);
+		mdm_connection_write (conn, "MDM " VERSION " " MDM_SUP_PIPELINE "\n");
 	} else if (strcmp (msg, MDM_SUP_CLOSE) == 0) {
 		mdm_connection_close (conn);
 	} else {
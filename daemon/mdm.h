@@ -21,6 +21,8 @@
 #ifndef MDM_H
 #define MDM_H
 
+#include <sys/types.h>
+
 #define MDM_MAX_PASS 256	/* Define a value for password length. Glibc
 				 * leaves MAX_PASS undefined. */
 
@@ -56,6 +58,7 @@ enum {
 
 /* If id == NULL, then get the first X server */
 void		mdm_final_cleanup	(void);
+void		mdm_cleanup_child	(pid_t pid, int exitstatus);
 
 #endif /* MDM_H */
 
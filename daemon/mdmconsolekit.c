@@ -31,6 +31,7 @@
 #include <dbus/dbus-glib-lowlevel.h>
 
 #include "mdm-log.h" /* for mdm_debug */
+#include "misc.h"
 #include "mdmconsolekit.h"
 
 
@@ -294,7 +295,7 @@ get_sessions_for_user (DBusConnection *connection,
 	message = NULL;
 	reply = NULL;
 
-	pwent = getpwnam (user);
+	pwent = mdm_getpwnam (user);
 
 	dbus_error_init (&error);
 	message = dbus_message_new_method_call (CK_NAME,
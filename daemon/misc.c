@@ -32,6 +32,7 @@
 #include <sys/ioctl.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <poll.h>
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <net/if.h>
@@ -47,6 +48,9 @@
 #ifdef HAVE_DEFOPEN
 #include <deflt.h>
 #endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #include <X11/Xlib.h>
 
@@ -195,138 +199,282 @@ mdm_restoreenv (void)
 	}
 }
 
-/* Evil function to figure out which display number is free */
-int
-mdm_get_free_display (int start, uid_t server_uid)
+/*
+ * Cap display numbers at 3000, I'm not sure we can ever seriously
+ * go that far
+ */
+#define MAX_DISPLAY_NUM 3000
+
+/*
+ * Display numbers some X server outside of our display list is
+ * running on: there is a socket in /tmp/.X11-unix and /tmp/.X<n>-lock
+ * names a live process.  The directories are read again only when
+ * they change, so that mdm_get_free_display can skip the numbers in
+ * use without probing each of them.  The pids are checked on every
+ * call so that a server that died without cleaning up frees its
+ * number again.  Anything else, such as a stale socket, is left to
+ * display_is_free.
+ */
+typedef struct {
+	int   num;
+	pid_t pid;
+} TakenDisplay;
+
+static guint32 taken_displays[(MAX_DISPLAY_NUM + 31) / 32];
+static GArray *taken_pids = NULL;
+static time_t  taken_sockets_mtime = -1;
+static time_t  taken_locks_mtime = -1;
+
+#define DISPLAY_TAKEN(i)       (taken_displays[(i) / 32] & (1U << ((i) % 32)))
+#define SET_DISPLAY_TAKEN(i)   (taken_displays[(i) / 32] |= (1U << ((i) % 32)))
+#define CLEAR_DISPLAY_TAKEN(i) (taken_displays[(i) / 32] &= ~(1U << ((i) % 32)))
+
+/* Returns the pid in the lock file for display number i, or 0 */
+static pid_t
+read_lock_pid (int i)
 {
-	int sock;
-	int i;
-	struct sockaddr_in serv_addr = { 0 };
+	char buf[256];
+	char line[100];
+	char *getsret;
+	struct stat s;
+	gulong pid;
+	FILE *fp;
+	int r;
 
-	serv_addr.sin_family = AF_INET;
-	serv_addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	g_snprintf (buf, sizeof (buf), "/tmp/.X%d-lock", i);
+	VE_IGNORE_EINTR (r = g_stat (buf, &s));
+	if (r != 0 || ! S_ISREG (s.st_mode))
+		return 0;
 
-	/*
-         * Cap this at 3000, I'm not sure we can ever seriously
-	 * go that far
-         */
-	for (i = start; i < 3000; i++) {
-		FILE *fp;
-		GSList *li;
-		GSList *displays;
-		struct stat s;
-		char buf[256];
-		int r;
-		gboolean try_ipv4 = TRUE;
+	VE_IGNORE_EINTR (fp = fopen (buf, "r"));
+	if (fp == NULL)
+		return 0;
+
+	VE_IGNORE_EINTR (getsret = fgets (line, sizeof (line), fp));
+	VE_IGNORE_EINTR (fclose (fp));
 
-                displays = mdm_daemon_config_get_display_list ();
+	if (getsret == NULL || sscanf (line, "%lu", &pid) != 1)
+		return 0;
+
+	return (pid_t)pid;
+}
+
+static gboolean
+pid_is_alive (pid_t pid)
+{
+	return (pid > 0 && (kill (pid, 0) == 0 || errno == EPERM));
+}
+
+static void
+scan_taken_displays (void)
+{
+	DIR *dir;
+	struct dirent *ent;
+	struct stat s;
+	time_t sockets_mtime = 0;
+	time_t locks_mtime = 0;
+	guint i;
+
+	if (taken_pids == NULL)
+		taken_pids = g_array_new (FALSE, FALSE, sizeof (TakenDisplay));
+
+	if (g_stat ("/tmp/.X11-unix", &s) == 0)
+		sockets_mtime = s.st_mtime;
+	if (g_stat ("/tmp", &s) == 0)
+		locks_mtime = s.st_mtime;
+
+	if (sockets_mtime == taken_sockets_mtime &&
+	    locks_mtime == taken_locks_mtime) {
+		/* forget servers that went away without a trace */
+		for (i = 0; i < taken_pids->len; ) {
+			TakenDisplay *td = &g_array_index (taken_pids, TakenDisplay, i);
+
+			if (pid_is_alive (td->pid)) {
+				i++;
+				continue;
+			}
 
-		for (li = displays; li != NULL; li = li->next) {
-			MdmDisplay *dsp = li->data;
-			if (SERVER_IS_LOCAL (dsp) &&
-			    dsp->dispnum == i)
-				break;
+			CLEAR_DISPLAY_TAKEN (td->num);
+			g_array_remove_index_fast (taken_pids, i);
 		}
-		if (li != NULL) {
-			/* found one */
+		return;
+	}
+	taken_sockets_mtime = sockets_mtime;
+	taken_locks_mtime = locks_mtime;
+
+	memset (taken_displays, 0, sizeof (taken_displays));
+	g_array_set_size (taken_pids, 0);
+
+	dir = opendir ("/tmp/.X11-unix");
+	if (dir == NULL)
+		return;
+
+	while ((ent = readdir (dir)) != NULL) {
+		TakenDisplay td;
+		char *end;
+		long num;
+
+		if (ent->d_name[0] != 'X')
 			continue;
-		}
+
+		num = strtol (&ent->d_name[1], &end, 10);
+		if (end == &ent->d_name[1] || *end != '\0' ||
+		    num < 0 || num >= MAX_DISPLAY_NUM)
+			continue;
+
+		td.num = num;
+		td.pid = read_lock_pid (num);
+		if ( ! pid_is_alive (td.pid))
+			continue;
+
+		SET_DISPLAY_TAKEN (num);
+		g_array_append_val (taken_pids, td);
+	}
+
+	closedir (dir);
+}
+
+/* Checks that no X server answers on display number i, and that no
+ * lock file or socket keeps server_uid from using it */
+static gboolean
+display_is_free (int i, uid_t server_uid)
+{
+	int sock;
+	struct sockaddr_in serv_addr = { 0 };
+	FILE *fp;
+	struct stat s;
+	char buf[256];
+	int r;
+	gboolean try_ipv4 = TRUE;
+
+	serv_addr.sin_family = AF_INET;
+	serv_addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
 
 #ifdef ENABLE_IPV6
-		if (have_ipv6 ()) {
-			struct sockaddr_in6 serv6_addr = { 0 };
+	if (have_ipv6 ()) {
+		struct sockaddr_in6 serv6_addr = { 0 };
 
-			sock = socket (AF_INET6, SOCK_STREAM,0);
+		sock = socket (AF_INET6, SOCK_STREAM,0);
 
-			serv6_addr.sin6_family = AF_INET6;
-			serv6_addr.sin6_addr = in6addr_loopback;
-			serv6_addr.sin6_port = htons (6000 + i);
-			errno = 0;
-			VE_IGNORE_EINTR (connect (sock,
+		serv6_addr.sin6_family = AF_INET6;
+		serv6_addr.sin6_addr = in6addr_loopback;
+		serv6_addr.sin6_port = htons (6000 + i);
+		errno = 0;
+		VE_IGNORE_EINTR (connect (sock,
                                       (struct sockaddr *)&serv6_addr,
                                       sizeof (serv6_addr)));
 
-			/*
-			 * If IPv6 returns the network is unreachable,
-			 * then try fallbacking to IPv4.  In all other
-			 * cases, do not fallback.  This problem can
-			 * happen if IPv6 is enabled, but the
-			 * administrator has disabled it.
-			 */
-			if (errno != ENETUNREACH)
-				try_ipv4 = FALSE;
-		}
+		/*
+		 * If IPv6 returns the network is unreachable,
+		 * then try fallbacking to IPv4.  In all other
+		 * cases, do not fallback.  This problem can
+		 * happen if IPv6 is enabled, but the
+		 * administrator has disabled it.
+		 */
+		if (errno != ENETUNREACH)
+			try_ipv4 = FALSE;
+	}
 #endif
 
-		if (try_ipv4)
-		{
-			sock = socket (AF_INET, SOCK_STREAM, 0);
+	if (try_ipv4)
+	{
+		sock = socket (AF_INET, SOCK_STREAM, 0);
 
-			serv_addr.sin_port = htons (6000 + i);
+		serv_addr.sin_port = htons (6000 + i);
+
+		errno = 0;
+		VE_IGNORE_EINTR (connect (sock,
+			       (struct sockaddr *)&serv_addr,
+			       sizeof (serv_addr)));
+	}
+	if (errno != 0 && errno != ECONNREFUSED) {
+		VE_IGNORE_EINTR (close (sock));
+		return FALSE;
+	}
+	VE_IGNORE_EINTR (close (sock));
+
+	/* if lock file exists and the process exists */
+	g_snprintf (buf, sizeof (buf), "/tmp/.X%d-lock", i);
+	VE_IGNORE_EINTR (r = g_stat (buf, &s));
+	if (r == 0 &&
+	    ! S_ISREG (s.st_mode)) {
+		/*
+		 * Eeeek! not a regular file?  Perhaps someone
+		 * is trying to play tricks on us
+		 */
+		return FALSE;
+	}
+	VE_IGNORE_EINTR (fp = fopen (buf, "r"));
+	if (fp != NULL) {
+		char buf2[100];
+		char *getsret;
+		VE_IGNORE_EINTR (getsret = fgets (buf2, sizeof (buf2), fp));
+		if (getsret != NULL) {
+			gulong pid;
+			if (sscanf (buf2, "%lu", &pid) == 1 &&
+			    kill (pid, 0) == 0) {
+				VE_IGNORE_EINTR (fclose (fp));
+				return FALSE;
+			}
 
-			errno = 0;
-			VE_IGNORE_EINTR (connect (sock,
-				       (struct sockaddr *)&serv_addr,
-				       sizeof (serv_addr)));
 		}
-		if (errno != 0 && errno != ECONNREFUSED) {
-			VE_IGNORE_EINTR (close (sock));
-			continue;
+		VE_IGNORE_EINTR (fclose (fp));
+
+		/* whack the file, it's a stale lock file */
+		VE_IGNORE_EINTR (g_unlink (buf));
+	}
+
+	/* If starting as root, we'll be able to overwrite any
+	 * stale sockets or lock files, but a user may not be
+	 * able to */
+	if (server_uid > 0) {
+		g_snprintf (buf, sizeof (buf),
+			    "/tmp/.X11-unix/X%d", i);
+		VE_IGNORE_EINTR (r = g_stat (buf, &s));
+		if (r == 0 &&
+		    s.st_uid != server_uid) {
+			return FALSE;
 		}
-		VE_IGNORE_EINTR (close (sock));
 
-		/* if lock file exists and the process exists */
-		g_snprintf (buf, sizeof (buf), "/tmp/.X%d-lock", i);
+		g_snprintf (buf, sizeof (buf),
+			    "/tmp/.X%d-lock", i);
 		VE_IGNORE_EINTR (r = g_stat (buf, &s));
 		if (r == 0 &&
-		    ! S_ISREG (s.st_mode)) {
-			/*
-                         * Eeeek! not a regular file?  Perhaps someone
-			 * is trying to play tricks on us
-                         */
-			continue;
+		    s.st_uid != server_uid) {
+			return FALSE;
 		}
-		VE_IGNORE_EINTR (fp = fopen (buf, "r"));
-		if (fp != NULL) {
-			char buf2[100];
-			char *getsret;
-			VE_IGNORE_EINTR (getsret = fgets (buf2, sizeof (buf2), fp));
-			if (getsret != NULL) {
-				gulong pid;
-				if (sscanf (buf2, "%lu", &pid) == 1 &&
-				    kill (pid, 0) == 0) {
-					VE_IGNORE_EINTR (fclose (fp));
-					continue;
-				}
+	}
 
-			}
-			VE_IGNORE_EINTR (fclose (fp));
+	return TRUE;
+}
+
+/* Evil function to figure out which display number is free */
+int
+mdm_get_free_display (int start, uid_t server_uid)
+{
+	int i;
+
+	scan_taken_displays ();
 
-			/* whack the file, it's a stale lock file */
-			VE_IGNORE_EINTR (g_unlink (buf));
+	for (i = MAX (start, 0); i < MAX_DISPLAY_NUM; i++) {
+		/* a whole word of numbers in use */
+		if (taken_displays[i / 32] == 0xffffffff) {
+			i |= 31;
+			continue;
 		}
 
-		/* If starting as root, we'll be able to overwrite any
-		 * stale sockets or lock files, but a user may not be
-		 * able to */
-		if (server_uid > 0) {
-			g_snprintf (buf, sizeof (buf),
-				    "/tmp/.X11-unix/X%d", i);
-			VE_IGNORE_EINTR (r = g_stat (buf, &s));
-			if (r == 0 &&
-			    s.st_uid != server_uid) {
-				continue;
-			}
+		if (DISPLAY_TAKEN (i))
+			continue;
 
-			g_snprintf (buf, sizeof (buf),
-				    "/tmp/.X%d-lock", i);
-			VE_IGNORE_EINTR (r = g_stat (buf, &s));
-			if (r == 0 &&
-			    s.st_uid != server_uid) {
-				continue;
-			}
+		if (mdm_display_lookup_dispnum (i) != NULL) {
+			/* found one */
+			continue;
 		}
 
+		/* someone got there since the scan, or a stale socket */
+		if ( ! display_is_free (i, server_uid))
+			continue;
+
 		return i;
 	}
 
@@ -682,6 +830,42 @@ mdm_sigusr2_block_pop (void)
 	}
 }
 
+/*
+ * Returns a pidfd for the child pid, which polls readable once it
+ * exits, or -1 where the kernel has no pidfds.
+ */
+int
+mdm_pidfd_open (pid_t pid)
+{
+#if defined (__linux__) && defined (SYS_pidfd_open)
+	return syscall (SYS_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/*
+ * Sleeps secs seconds, or less if the process behind pidfd exits or a
+ * signal comes in.  Without a pidfd this is a plain sleep ().
+ */
+void
+mdm_pidfd_sleep (int pidfd, int secs)
+{
+	struct pollfd pfd;
+
+	if (pidfd < 0) {
+		sleep (secs);
+		return;
+	}
+
+	pfd.fd = pidfd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	poll (&pfd, 1, secs * 1000);
+}
+
 pid_t
 mdm_fork_extra (void)
 {
@@ -934,6 +1118,285 @@ mdm_desetuid (void)
 #endif
 }
 
+/*
+ * A small cache in front of getpwnam, getpwuid and getgrnam.  A login
+ * asks about the same user a dozen times over, and with a network
+ * directory every one of those is a round trip.  Entries are kept for
+ * PWCACHE_TTL seconds.  What we return are our own copies, so later
+ * lookups (PAM's included) cannot overwrite them, and they stay valid
+ * until mdm_pwcache_trim or mdm_pwcache_invalidate even if the entry
+ * gets refreshed.
+ * Missing users are not cached, they may well show up after PAM ran.
+ */
+#define PWCACHE_TTL 30
+
+typedef struct {
+	struct passwd pw;
+	time_t time;
+} PwCacheUser;
+
+typedef struct {
+	struct group gr;
+	time_t time;
+} PwCacheGroup;
+
+static GHashTable *pwcache_by_name  = NULL;
+static GHashTable *pwcache_by_uid   = NULL;
+static GHashTable *pwcache_groups   = NULL;
+static GSList     *pwcache_users    = NULL;
+static GSList     *pwcache_grlist   = NULL;
+static guint       pwcache_hits     = 0;
+static guint       pwcache_misses   = 0;
+
+static void
+pwcache_user_free (PwCacheUser *u)
+{
+	g_free (u->pw.pw_name);
+	g_free (u->pw.pw_passwd);
+	g_free (u->pw.pw_gecos);
+	g_free (u->pw.pw_dir);
+	g_free (u->pw.pw_shell);
+	g_free (u);
+}
+
+static void
+pwcache_group_free (PwCacheGroup *g)
+{
+	g_free (g->gr.gr_name);
+	g_free (g->gr.gr_passwd);
+	g_strfreev (g->gr.gr_mem);
+	g_free (g);
+}
+
+static gboolean
+pwcache_fresh (time_t t)
+{
+	time_t now = time (NULL);
+
+	return (now >= t && now - t < PWCACHE_TTL);
+}
+
+static struct passwd *
+pwcache_add_user (struct passwd *pw)
+{
+	PwCacheUser *u;
+
+	if (pw == NULL)
+		return NULL;
+
+	if (pwcache_by_name == NULL) {
+		pwcache_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+		pwcache_by_uid = g_hash_table_new (NULL, NULL);
+	}
+
+	u = g_new0 (PwCacheUser, 1);
+	u->pw = *pw;
+	u->pw.pw_name = g_strdup (pw->pw_name);
+	u->pw.pw_passwd = g_strdup (pw->pw_passwd);
+	u->pw.pw_gecos = g_strdup (pw->pw_gecos);
+	u->pw.pw_dir = g_strdup (pw->pw_dir);
+	u->pw.pw_shell = g_strdup (pw->pw_shell);
+	u->time = time (NULL);
+
+	/* older copies are only freed on trim or invalidate, someone
+	 * may still be looking at them */
+	pwcache_users = g_slist_prepend (pwcache_users, u);
+	g_hash_table_replace (pwcache_by_name, u->pw.pw_name, u);
+	g_hash_table_replace (pwcache_by_uid, GUINT_TO_POINTER (u->pw.pw_uid), u);
+
+	return &u->pw;
+}
+
+struct passwd *
+mdm_getpwnam (const char *name)
+{
+	PwCacheUser *u = NULL;
+
+	if (name == NULL)
+		return NULL;
+
+	if (pwcache_by_name != NULL)
+		u = g_hash_table_lookup (pwcache_by_name, name);
+	if (u != NULL && pwcache_fresh (u->time)) {
+		pwcache_hits++;
+		return &u->pw;
+	}
+
+	pwcache_misses++;
+	return pwcache_add_user (getpwnam (name));
+}
+
+struct passwd *
+mdm_getpwuid (uid_t uid)
+{
+	PwCacheUser *u = NULL;
+
+	if (pwcache_by_uid != NULL)
+		u = g_hash_table_lookup (pwcache_by_uid, GUINT_TO_POINTER (uid));
+	if (u != NULL && pwcache_fresh (u->time)) {
+		pwcache_hits++;
+		return &u->pw;
+	}
+
+	pwcache_misses++;
+	return pwcache_add_user (getpwuid (uid));
+}
+
+struct group *
+mdm_getgrnam (const char *name)
+{
+	PwCacheGroup *g = NULL;
+	struct group *gr;
+
+	if (name == NULL)
+		return NULL;
+
+	if (pwcache_groups != NULL)
+		g = g_hash_table_lookup (pwcache_groups, name);
+	if (g != NULL && pwcache_fresh (g->time)) {
+		pwcache_hits++;
+		return &g->gr;
+	}
+
+	pwcache_misses++;
+	gr = getgrnam (name);
+	if (gr == NULL)
+		return NULL;
+
+	if (pwcache_groups == NULL)
+		pwcache_groups = g_hash_table_new (g_str_hash, g_str_equal);
+
+	g = g_new0 (PwCacheGroup, 1);
+	g->gr = *gr;
+	g->gr.gr_name = g_strdup (gr->gr_name);
+	g->gr.gr_passwd = g_strdup (gr->gr_passwd);
+	g->gr.gr_mem = g_strdupv (gr->gr_mem);
+	g->time = time (NULL);
+
+	pwcache_grlist = g_slist_prepend (pwcache_grlist, g);
+	g_hash_table_replace (pwcache_groups, g->gr.gr_name, g);
+
+	return &g->gr;
+}
+
+/*
+ * Is user a member of group, either as its primary group or as a
+ * supplementary one.  The member list of the group is only what the
+ * group file says, groups NSS modules such as LDAP hand out on the
+ * side only show up in getgrouplist.
+ */
+gboolean
+mdm_user_in_group (const char *user, const char *group)
+{
+	struct passwd *pw;
+	struct group *gr;
+	gid_t *groups;
+	int ngroups;
+	int size;
+	gboolean found;
+	int i;
+
+	pw = mdm_getpwnam (user);
+	gr = mdm_getgrnam (group);
+	if (pw == NULL || gr == NULL)
+		return FALSE;
+
+	if (pw->pw_gid == gr->gr_gid)
+		return TRUE;
+
+	for (i = 0; gr->gr_mem != NULL && gr->gr_mem[i] != NULL; i++) {
+		if (strcmp (gr->gr_mem[i], user) == 0)
+			return TRUE;
+	}
+
+	size = 32;
+	ngroups = size;
+	groups = g_new (gid_t, size);
+	/* too small a buffer gets us the size it needs to be, on glibc */
+	while (getgrouplist (user, pw->pw_gid, groups, &ngroups) < 0) {
+		size = MAX (ngroups, size * 2);
+		if (size > 65536) {
+			g_free (groups);
+			return FALSE;
+		}
+		groups = g_renew (gid_t, groups, size);
+		ngroups = size;
+	}
+
+	found = FALSE;
+	for (i = 0; i < ngroups; i++) {
+		if (groups[i] == gr->gr_gid) {
+			found = TRUE;
+			break;
+		}
+	}
+	g_free (groups);
+
+	return found;
+}
+
+/*
+ * Frees the copies that have been replaced by a fresher lookup.  Only
+ * call this where nobody can still hold a pointer from an earlier
+ * lookup, such as between two login attempts.
+ */
+void
+mdm_pwcache_trim (void)
+{
+	GSList *li;
+	GSList *next;
+
+	for (li = pwcache_users; li != NULL; li = next) {
+		PwCacheUser *u = li->data;
+
+		next = li->next;
+		if (g_hash_table_lookup (pwcache_by_name, u->pw.pw_name) == u ||
+		    g_hash_table_lookup (pwcache_by_uid, GUINT_TO_POINTER (u->pw.pw_uid)) == u)
+			continue;
+
+		pwcache_users = g_slist_delete_link (pwcache_users, li);
+		pwcache_user_free (u);
+	}
+
+	for (li = pwcache_grlist; li != NULL; li = next) {
+		PwCacheGroup *g = li->data;
+
+		next = li->next;
+		if (g_hash_table_lookup (pwcache_groups, g->gr.gr_name) == g)
+			continue;
+
+		pwcache_grlist = g_slist_delete_link (pwcache_grlist, li);
+		pwcache_group_free (g);
+	}
+}
+
+/* Forget everything, and free all the copies handed out */
+void
+mdm_pwcache_invalidate (void)
+{
+	if (pwcache_hits > 0 || pwcache_misses > 0)
+		mdm_debug ("mdm_pwcache_invalidate: %u hits, %u misses",
+			   pwcache_hits, pwcache_misses);
+
+	if (pwcache_by_name != NULL) {
+		g_hash_table_remove_all (pwcache_by_name);
+		g_hash_table_remove_all (pwcache_by_uid);
+	}
+	if (pwcache_groups != NULL)
+		g_hash_table_remove_all (pwcache_groups);
+
+	g_slist_foreach (pwcache_users, (GFunc) pwcache_user_free, NULL);
+	g_slist_free (pwcache_users);
+	pwcache_users = NULL;
+
+	g_slist_foreach (pwcache_grlist, (GFunc) pwcache_group_free, NULL);
+	g_slist_free (pwcache_grlist);
+	pwcache_grlist = NULL;
+
+	pwcache_hits = 0;
+	pwcache_misses = 0;
+}
+
 gboolean
 mdm_test_opt (const char *cmd, const char *help, const char *option)
 {
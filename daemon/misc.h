@@ -21,6 +21,8 @@
 
 #include <stdio.h>
 #include <sys/types.h>
+#include <pwd.h>
+#include <grp.h>
 
 #include "mdm.h"
 #include "display.h"
@@ -58,11 +60,23 @@ void	mdm_sigusr2_block_pop (void);
 pid_t	mdm_fork_extra (void);
 void	mdm_wait_for_extra (pid_t pid, int *status);
 
+int	mdm_pidfd_open (pid_t pid);
+void	mdm_pidfd_sleep (int pidfd, int secs);
+
 const GList * mdm_address_peek_local_list (void);
 gboolean      mdm_address_is_local        (struct sockaddr_storage *sa);
 
 gboolean mdm_setup_gids (const char *login, gid_t gid);
 
+/* cached passwd/group lookups, the result belongs to the cache and
+ * stays valid until mdm_pwcache_trim or mdm_pwcache_invalidate */
+struct passwd *	mdm_getpwnam		(const char *name);
+struct passwd *	mdm_getpwuid		(uid_t uid);
+struct group *	mdm_getgrnam		(const char *name);
+gboolean	mdm_user_in_group	(const char *user, const char *group);
+void		mdm_pwcache_trim	(void);
+void		mdm_pwcache_invalidate	(void);
+
 void mdm_desetuid (void);
 
 gboolean mdm_test_opt (const char *cmd, const char *help, const char *option);
@@ -40,6 +40,7 @@
 #include <errno.h>
 #include <time.h>
 #include <ctype.h>
+#include <poll.h>
 #include <X11/Xlib.h>
 
 #include "mdm.h"
@@ -65,6 +66,9 @@ static void mdm_server_child_handler (gint);
 
 /* Global vars */
 static int server_signal_pipe[2];
+static int server_displayfd[2]         = { -1, -1 };
+static gint64 server_spawn_time        = 0;
+static GHashTable *displayfd_support   = NULL;
 static MdmDisplay *d                   = NULL;
 static gboolean server_signal_notified = FALSE;
 static int mdm_in_signal               = 0;
@@ -374,17 +378,102 @@ setup_server_wait (MdmDisplay *d)
     return TRUE;
 }
 
+/*
+ * Wait for the X server to write its display number to the -displayfd
+ * pipe.  Returns FALSE if the server closed the pipe without writing
+ * anything, in which case the caller falls back to the old ways of
+ * waiting.
+ */
+static gboolean
+wait_for_displayfd (MdmDisplay *d)
+{
+    char buf[16];
+    int len = 0;
+    time_t t = time (NULL);
+
+    mdm_debug ("do_server_wait: Waiting for server on displayfd");
+
+    for (;;) {
+	    struct pollfd fds[2];
+	    int timeout;
+	    int n;
+
+	    if (d->servpid <= 1) {
+		    d->servstat = SERVER_ABORT;
+		    return TRUE;
+	    }
+	    /* a root server may still beat us to it with USR1 */
+	    if (server_signal_notified)
+		    return TRUE;
+
+	    timeout = mdm_daemon_config_get_int_for_id (MDM_ID_XSERVER_TIMEOUT) - (time (NULL) - t);
+	    if (timeout <= 0) {
+		    mdm_debug ("do_server_wait: Server timeout");
+		    d->servstat = SERVER_TIMEOUT;
+		    return TRUE;
+	    }
+
+	    fds[0].fd = server_displayfd[0];
+	    fds[0].events = POLLIN;
+	    fds[1].fd = server_signal_pipe[0];
+	    fds[1].events = POLLIN;
+
+	    if (poll (fds, 2, timeout * 1000) <= 0)
+		    continue;
+
+	    if (fds[1].revents & POLLIN) {
+		    char yay[4];
+		    VE_IGNORE_EINTR (read (server_signal_pipe[0], yay, 4));
+	    }
+
+	    if ( ! (fds[0].revents & (POLLIN | POLLHUP)))
+		    continue;
+
+	    VE_IGNORE_EINTR (n = read (server_displayfd[0], buf + len, sizeof (buf) - 1 - len));
+	    if (n < 0)
+		    continue;
+
+	    if (n == 0) {
+		    if (d->servpid > 1) {
+			    mdm_debug ("do_server_wait: Server closed displayfd without a display number, falling back");
+			    return FALSE;
+		    }
+		    continue;
+	    }
+
+	    len += n;
+	    buf[len] = '\0';
+	    if (strchr (buf, '\n') != NULL || len == sizeof (buf) - 1) {
+		    if (atoi (buf) != d->dispnum)
+			    mdm_debug ("do_server_wait: Server reported display %d, expected %d", atoi (buf), d->dispnum);
+
+		    /* a non-root server also has to be connected to, the
+		     * loop below does that at once now it is up */
+		    if (d->server_uid == 0 || ! d->handled || d->chosen_hostname) {
+			    d->servstat = SERVER_RUNNING;
+			    d->starttime = time (NULL);
+		    }
+		    return TRUE;
+	    }
+    }
+}
+
 static void
 do_server_wait (MdmDisplay *d)
 {
     /* Wait for X server to send ready signal */
+    if (d->servstat == SERVER_PENDING &&
+	server_displayfd[0] >= 0) {
+	    wait_for_displayfd (d);
+    }
+
     if (d->servstat == SERVER_PENDING) {
 	    if (d->server_uid != 0 && ! d->handled && ! d->chosen_hostname) {
 		    /* FIXME: If not handled, we just don't know, so
 		     * just wait a few seconds and hope things just work,
 		     * fortunately there is no such case yet and probably
 		     * never will, but just for code anality's sake */
-		    mdm_sleep_no_signal (mdm_daemon_config_get_value_int(MDM_KEY_XSERVER_TIMEOUT));
+		    mdm_sleep_no_signal (mdm_daemon_config_get_int_for_id (MDM_ID_XSERVER_TIMEOUT));
 	    } else if (d->server_uid != 0) {
 		    int i;
 
@@ -404,7 +493,7 @@ do_server_wait (MdmDisplay *d)
 		    for (i = 0;
 			 d->dsp == NULL &&
 			 d->servstat == SERVER_PENDING &&
-			 i < mdm_daemon_config_get_value_int(MDM_KEY_XSERVER_TIMEOUT);
+			 i < mdm_daemon_config_get_int_for_id (MDM_ID_XSERVER_TIMEOUT);
 			 i++) {
 			    d->dsp = XOpenDisplay (d->name);
 			    if (d->dsp == NULL)
@@ -427,7 +516,7 @@ do_server_wait (MdmDisplay *d)
 			    struct timeval tv;
 
 			    /* Wait up to MDM_KEY_XSERVER_TIMEOUT seconds. */
-			    tv.tv_sec = MAX (1, mdm_daemon_config_get_value_int(MDM_KEY_XSERVER_TIMEOUT) 
+			    tv.tv_sec = MAX (1, mdm_daemon_config_get_int_for_id (MDM_ID_XSERVER_TIMEOUT) 
 			    	- (time (NULL) - t));
 			    tv.tv_usec = 0;
 
@@ -440,7 +529,7 @@ do_server_wait (MdmDisplay *d)
 				    VE_IGNORE_EINTR (read (server_signal_pipe[0], buf, 4));
 			    }
 			    if ( ! server_signal_notified &&
-				t + mdm_daemon_config_get_value_int(MDM_KEY_XSERVER_TIMEOUT) < time (NULL)) {
+				t + mdm_daemon_config_get_int_for_id (MDM_ID_XSERVER_TIMEOUT) < time (NULL)) {
 				    mdm_debug ("do_server_wait: Server timeout");
 				    d->servstat = SERVER_TIMEOUT;
 				    server_signal_notified = TRUE;
@@ -463,10 +552,21 @@ do_server_wait (MdmDisplay *d)
     VE_IGNORE_EINTR (close (server_signal_pipe[0]));
     VE_IGNORE_EINTR (close (server_signal_pipe[1]));
 
+    if (server_displayfd[0] >= 0) {
+	    VE_IGNORE_EINTR (close (server_displayfd[0]));
+	    server_displayfd[0] = -1;
+    }
+
     if (d->servpid <= 1) {
 	    d->servstat = SERVER_ABORT;
     }
 
+    if (d->servstat == SERVER_RUNNING) {
+	    d->servstart_usec = g_get_monotonic_time () - server_spawn_time;
+	    mdm_debug ("do_server_wait: Server %s ready after %ld ms",
+		       d->name, (long) (d->servstart_usec / 1000));
+    }
+
     if (d->servstat != SERVER_RUNNING) {
 	    /* bad things are happening */
 	    if (d->servpid > 0) {
@@ -506,6 +606,7 @@ mdm_server_start (MdmDisplay *disp,
     int flexi_disp = 20;
     char *vtarg = NULL;
     int vtfd = -1, vt = -1;
+    int active_vt = -1;
     
     if (disp == NULL)
 	    return FALSE;
@@ -515,22 +616,28 @@ mdm_server_start (MdmDisplay *disp,
     /* if an X server exists, wipe it */
     mdm_server_stop (d);
 
+    /* the daemon gets the new display state in one write */
+    mdm_slave_send_batch_begin ();
+
     /* First clear the VT number */
     if (d->type == TYPE_STATIC ||
 	d->type == TYPE_FLEXI) {
-	    d->vt = -1;
+	    mdm_display_set_vt (d, -1);
 	    mdm_slave_send_num (MDM_SOP_VT_NUM, -1);
     }
 
     if (SERVER_IS_FLEXI (d) ||
 	treat_as_flexi) {
+	    char *name;
+
 	    flexi_disp = mdm_get_free_display
 		    (MAX (mdm_daemon_config_get_high_display_num () + 1, min_flexi_disp) /* start */,
 		     d->server_uid /* server uid */);
 
-	    g_free (d->name);
-	    d->name = g_strdup_printf (":%d", flexi_disp);
-	    d->dispnum = flexi_disp;
+	    name = g_strdup_printf (":%d", flexi_disp);
+	    mdm_display_set_name (d, name);
+	    g_free (name);
+	    mdm_display_set_dispnum (d, flexi_disp);
 
 	    mdm_slave_send_num (MDM_SOP_DISP_NUM, flexi_disp);
     }
@@ -538,10 +645,13 @@ mdm_server_start (MdmDisplay *disp,
     mdm_debug ("mdm_server_start: %s", d->name);
 
     /* Create new cookie */
-    if ( ! mdm_auth_secure_display (d)) 
+    if ( ! mdm_auth_secure_display (d)) {
+	    mdm_slave_send_batch_end ();
 	    return FALSE;
+    }
     mdm_slave_send_string (MDM_SOP_COOKIE, d->cookie);
     mdm_slave_send_string (MDM_SOP_AUTHFILE, d->authfile);
+    mdm_slave_send_batch_end ();
     g_setenv ("DISPLAY", d->name, TRUE);
 
     if ( ! setup_server_wait (d))
@@ -551,9 +661,19 @@ mdm_server_start (MdmDisplay *disp,
 
     if (d->type == TYPE_STATIC ||
 	d->type == TYPE_FLEXI) {
-	    vtarg = mdm_get_empty_vt_argument (&vtfd, &vt);
+	    /* the daemon may have picked one to keep the order of
+	     * static displays started side by side */
+	    if (d->start_vt > 0)
+		    vtarg = mdm_get_vt_argument (d->start_vt, &vtfd, &vt);
+	    if (vtarg == NULL)
+		    vtarg = mdm_get_empty_vt_argument (&vtfd, &vt);
     }
 
+    /* The server activates its VT when it starts, a spare one
+     * has to give it back to whatever was on screen */
+    if (d->pooled)
+	    active_vt = mdm_get_current_vt ();
+
     /* fork X server process */
     mdm_server_spawn (d, vtarg);
 
@@ -581,18 +701,24 @@ mdm_server_start (MdmDisplay *disp,
     case SERVER_RUNNING:
 	    mdm_debug ("mdm_server_start: Completed %s!", d->name);
 
+	    mdm_slave_send_batch_begin ();
 	    if (SERVER_IS_FLEXI (d))
 		    mdm_slave_send_num (MDM_SOP_FLEXI_OK, 0 /* bogus */);
+	    mdm_slave_send_num (MDM_SOP_SERVSTART, (long) d->servstart_usec);
 	    if (d->type == TYPE_STATIC ||
 		d->type == TYPE_FLEXI) {
 		    if (vt >= 0)
-			    d->vt = vt;
+			    mdm_display_set_vt (d, vt);
 
 		    if (d->vt < 0)
-			    d->vt = display_vt (d);
+			    mdm_display_set_vt (d, display_vt (d));
 		    if (d->vt >= 0)
 			    mdm_slave_send_num (MDM_SOP_VT_NUM, d->vt);
 	    }
+	    mdm_slave_send_batch_end ();
+
+	    if (active_vt > 0 && active_vt != d->vt)
+		    mdm_change_vt (active_vt);
 
 	    return TRUE;
     default:
@@ -659,7 +785,7 @@ mdm_server_checklog (MdmDisplay *disp)
 	if (d->vt < 0 &&
 	    (d->type == TYPE_STATIC ||
 	     d->type == TYPE_FLEXI)) {
-		d->vt = display_vt (d);
+		mdm_display_set_vt (d, display_vt (d));
 		if (d->vt >= 0)
 			mdm_slave_send_num (MDM_SOP_VT_NUM, d->vt);
 	}
@@ -911,6 +1037,53 @@ mdm_server_resolve_command_line (MdmDisplay *disp,
 	return TRUE;
 }
 
+/*
+ * Returns TRUE if the X server binary takes -displayfd.  The answer is
+ * kept per binary, and the daemon asks before it forks the slave so
+ * that the slave does not have to run the server with -help itself.
+ */
+static gboolean
+server_supports_displayfd (const char *bin)
+{
+	gpointer val;
+	gboolean supported;
+
+	if (ve_string_empty (bin) || bin[0] != '/')
+		return FALSE;
+
+	if (displayfd_support == NULL)
+		displayfd_support = g_hash_table_new_full (g_str_hash, g_str_equal,
+							   g_free, NULL);
+
+	if (g_hash_table_lookup_extended (displayfd_support, bin, NULL, &val))
+		return GPOINTER_TO_INT (val);
+
+	supported = mdm_test_opt (bin, "-help", "-displayfd");
+	g_hash_table_insert (displayfd_support, g_strdup (bin),
+			     GINT_TO_POINTER (supported));
+
+	mdm_debug ("server_supports_displayfd: %s %s -displayfd", bin,
+		   supported ? "supports" : "does not support");
+
+	return supported;
+}
+
+void
+mdm_server_probe_displayfd (MdmDisplay *disp)
+{
+	int argc;
+	char **argv = NULL;
+
+	if (ve_string_empty (disp->command))
+		return;
+
+	if (mdm_server_resolve_command_line (disp, FALSE /* resolve flags */,
+					     NULL, &argc, &argv)) {
+		server_supports_displayfd (argv[0]);
+		g_strfreev (argv);
+	}
+}
+
 /**
  * mdm_server_spawn:
  * @disp: Pointer to a MdmDisplay structure
@@ -963,6 +1136,25 @@ mdm_server_spawn (MdmDisplay *d, const char *vtarg)
     if (rc == FALSE)
        return;    
 
+    /* Have the server tell us on a pipe when it is ready, the number
+     * it writes there is the one we gave it */
+    if (server_supports_displayfd (argv[0]) &&
+	pipe (server_displayfd) == 0) {
+	    if (server_displayfd[1] > 2) {
+		    int len = mdm_vector_len (argv);
+
+		    fcntl (server_displayfd[0], F_SETFD, FD_CLOEXEC);
+		    argv = g_renew (char *, argv, len + 3);
+		    argv[len++] = g_strdup ("-displayfd");
+		    argv[len++] = g_strdup_printf ("%d", server_displayfd[1]);
+		    argv[len] = NULL;
+	    } else {
+		    VE_IGNORE_EINTR (close (server_displayfd[0]));
+		    VE_IGNORE_EINTR (close (server_displayfd[1]));
+		    server_displayfd[0] = server_displayfd[1] = -1;
+	    }
+    }
+
     if (d->xserver_session_args)
 	    mdm_server_add_xserver_args (d, argv);
 
@@ -973,12 +1165,23 @@ mdm_server_spawn (MdmDisplay *d, const char *vtarg)
 
     mdm_debug ("Forking X server process");
 
+    server_spawn_time = g_get_monotonic_time ();
+
     mdm_sigterm_block_push ();
     pid = d->servpid = fork ();
     if (pid == 0)
 	    mdm_unset_signals ();
     mdm_sigterm_block_pop ();
     mdm_sigchld_block_pop ();
+
+    if (pid != 0 && server_displayfd[1] >= 0) {
+	    VE_IGNORE_EINTR (close (server_displayfd[1]));
+	    server_displayfd[1] = -1;
+	    if (pid < 0) {
+		    VE_IGNORE_EINTR (close (server_displayfd[0]));
+		    server_displayfd[0] = -1;
+	    }
+    }
     
     switch (pid) {
 	
@@ -989,7 +1192,7 @@ mdm_server_spawn (MdmDisplay *d, const char *vtarg)
 	mdm_log_shutdown ();
 
 	/* close things */
-	mdm_close_all_descriptors (0 /* from */, -1 /* except */, -1 /* except2 */);
+	mdm_close_all_descriptors (0 /* from */, server_displayfd[1] /* except */, -1 /* except2 */);
 
 	/* No error checking here - if it's messed the best response
          * is to ignore & try to continue */
@@ -65,6 +65,7 @@ gboolean	mdm_server_resolve_command_line (MdmDisplay *disp,
                                                  int        *argc,
                                                  char     ***argv);
 MdmXserver *	mdm_server_resolve	(MdmDisplay *disp);
+void		mdm_server_probe_displayfd (MdmDisplay *disp);
 
 
 
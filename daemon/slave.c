@@ -41,6 +41,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <poll.h>
+#ifdef HAVE_SYS_SIGNALFD_H
+#include <sys/signalfd.h>
+#endif
 #include <strings.h>
 #include <netinet/in.h>
 #include <netdb.h>
@@ -175,6 +179,7 @@ extern gboolean mdm_first_login;
 
 /* The slavepipe, this is the write end */
 extern int slave_fifo_pipe_fd;
+extern int slave_fifo_frame_version;
 
 /* wait for a GO in the SOP protocol */
 extern gboolean mdm_wait_for_go;
@@ -317,8 +322,8 @@ run_session_output (gboolean read_until_eof)
 		}
 	}
 
-	gboolean limit_output = mdm_daemon_config_get_value_bool (MDM_KEY_LIMIT_SESSION_OUTPUT);
-	gboolean filter_output = mdm_daemon_config_get_value_bool (MDM_KEY_FILTER_SESSION_OUTPUT);
+	gboolean limit_output = mdm_daemon_config_get_bool_for_id (MDM_ID_LIMIT_SESSION_OUTPUT);
+	gboolean filter_output = mdm_daemon_config_get_bool_for_id (MDM_ID_FILTER_SESSION_OUTPUT);
 
 	/* the fd is non-blocking */
 	for (;;) {
@@ -474,101 +479,159 @@ try_to_touch_fb_userauth (void)
 	}
 }
 
+/*
+ * SIGCHLD and SIGUSR2, read as events while the slave sits in
+ * slave_waitpid so their handlers run outside of signal context.
+ * Returns -1 where there is no signalfd, the handlers and the waitpid
+ * pipe then do the work as before.
+ */
+static int
+slave_signal_fd (sigset_t *mask)
+{
+	static int signal_fd = -2;
+
+	sigemptyset (mask);
+	sigaddset (mask, SIGCHLD);
+	sigaddset (mask, SIGUSR2);
+
+#ifdef HAVE_SYS_SIGNALFD_H
+	if (signal_fd == -2) {
+		signal_fd = signalfd (-1, mask, SFD_NONBLOCK | SFD_CLOEXEC);
+		if G_UNLIKELY (signal_fd < 0)
+			mdm_debug ("slave_signal_fd: no signalfd: %s", strerror (errno));
+	}
+#else
+	signal_fd = -1;
+#endif
+
+	return signal_fd;
+}
+
+/* Milliseconds until the next authfb touch, or -1 */
+static int
+slave_waitpid_timeout (void)
+{
+	struct timeval tv;
+
+	/* unset time */
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+
+	if (min_time_to_wait (&tv) == NULL)
+		return -1;
+
+	return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
 /* must call slave_waitpid_setpid before calling this */
 static void
 slave_waitpid (MdmWaitPid *wp)
 {
+	gboolean read_session_output = TRUE;
+	sigset_t mask, omask;
+	int signal_fd;
+
 	if G_UNLIKELY (wp == NULL)
 		return;
 
 	mdm_debug ("slave_waitpid: waiting on %d", (int)wp->pid);
 
-	if G_UNLIKELY (slave_waitpid_r < 0) {
+	if G_UNLIKELY (slave_waitpid_r < 0)
 		mdm_error ("slave_waitpid: no pipe, trying to wing it");
 
+	signal_fd = slave_signal_fd (&mask);
+
+	while (wp->pid > 1) {
+		struct pollfd fds[4];
+		gboolean got_chld = FALSE;
+		gboolean got_usr2 = FALSE;
+		int nfds = 0;
+		int timeout;
+		int ret;
+		int poll_errno;
+		int i;
+
+		if (signal_fd >= 0) {
+			fds[nfds].fd = signal_fd;
+			fds[nfds++].events = POLLIN;
+			fds[nfds].fd = d->slave_notify_fd;
+			fds[nfds++].events = POLLIN;
+		}
+		if (slave_waitpid_r >= 0) {
+			fds[nfds].fd = slave_waitpid_r;
+			fds[nfds++].events = POLLIN;
+		}
+		if (read_session_output &&
+		    d->session_output_fd >= 0) {
+			fds[nfds].fd = d->session_output_fd;
+			fds[nfds++].events = POLLIN;
+		}
+		for (i = 0; i < nfds; i++)
+			fds[i].revents = 0;
+
+		timeout = slave_waitpid_timeout ();
 		/* This is a real stupid fallback for a real stupid case */
-		while (wp->pid > 1) {
-			struct timeval tv;
-			/* Wait 5 seconds. */
-			tv.tv_sec = 5;
-			tv.tv_usec = 0;
-			select (0, NULL, NULL, NULL, min_time_to_wait (&tv));
-			
-			/* try to touch an fb auth file */
-			try_to_touch_fb_userauth ();
-
-			if (d->session_output_fd >= 0)
-				run_session_output (FALSE /* read_until_eof */);			
-			check_notifies_now ();
+		if G_UNLIKELY (slave_waitpid_r < 0 && (timeout < 0 || timeout > 5000))
+			timeout = 5000;
+
+		/* the signals are only ever taken from the signalfd while
+		 * they are blocked, and are handled after unblocking so
+		 * that anything forked from the handlers gets our old mask */
+		if (signal_fd >= 0)
+			sigprocmask (SIG_BLOCK, &mask, &omask);
+
+		ret = poll (fds, nfds, timeout);
+		/* draining the signalfd below leaves EAGAIN in errno */
+		poll_errno = errno;
+
+#ifdef HAVE_SYS_SIGNALFD_H
+		if (signal_fd >= 0) {
+			struct signalfd_siginfo info;
+
+			while (read (signal_fd, &info, sizeof (info)) == sizeof (info)) {
+				if (info.ssi_signo == SIGCHLD)
+					got_chld = TRUE;
+				else if (info.ssi_signo == SIGUSR2)
+					got_usr2 = TRUE;
+			}
+			sigprocmask (SIG_SETMASK, &omask, NULL);
 		}
-		check_notifies_now ();
-	} else {
-		gboolean read_session_output = TRUE;
+#endif
 
-		do {
-            // mdm_debug ("slave_waitpid: start loop");
-			char buf[1];
-			fd_set rfds;
-			int ret;
-			struct timeval tv;
-			int maxfd;
-
-			FD_ZERO (&rfds);
-			FD_SET (slave_waitpid_r, &rfds);
-			if (read_session_output &&
-			    d->session_output_fd >= 0) {
-				FD_SET (d->session_output_fd, &rfds);
-                // mdm_debug ("slave_waitpid: no session");
-            }			
-
-			/* unset time */
-			tv.tv_sec = 0;
-			tv.tv_usec = 0;
-			maxfd = MAX (slave_waitpid_r, d->session_output_fd);
-            
-            struct timeval * timetowait = min_time_to_wait (&tv);
-
-            // mdm_debug ("slave_waitpid: ret = %d", (int) ret);
-            // if (timetowait != NULL) {
-            //     mdm_debug ("slave_waitpid: timetowait = %d, %d", (int) timetowait->tv_sec, (int) timetowait->tv_usec);
-            // }
-            // else {
-            //     mdm_debug ("slave_waitpid: timetowait = NULL");
-            // }
-            // mdm_debug ("slave_waitpid: slave_waitpid_r = %d", (int) slave_waitpid_r);
-            // mdm_debug ("slave_waitpid: d->session_output_fd = %d", (int) d->session_output_fd);
-            // mdm_debug ("slave_waitpid: MAX = %d", (int) maxfd);                
-
-			ret = select (maxfd + 1, &rfds, NULL, NULL, timetowait);
-
-            // mdm_debug ("slave_waitpid: ret = %d", (int) ret);
-
-			/* try to touch an fb auth file */
-			try_to_touch_fb_userauth ();
-                                    
-			if (ret > 0) {
-			       	if (FD_ISSET (slave_waitpid_r, &rfds)) {
-					VE_IGNORE_EINTR (read (slave_waitpid_r, buf, 1));
-				}
-				if (d->session_output_fd >= 0 &&
-				    FD_ISSET (d->session_output_fd, &rfds)) {
+		if G_UNLIKELY (ret < 0 && poll_errno != EINTR) {
+			mdm_debug ("slave_waitpid: poll failed: %s", strerror (poll_errno));
+			read_session_output = FALSE;
+		}
+
+		/* try to touch an fb auth file */
+		try_to_touch_fb_userauth ();
+
+		for (i = 0; ret > 0 && i < nfds; i++) {
+			char buf[16];
+
+			if (fds[i].revents == 0)
+				continue;
+
+			if (fds[i].fd == slave_waitpid_r) {
+				VE_IGNORE_EINTR (read (slave_waitpid_r, buf, sizeof (buf)));
+			} else if (fds[i].fd == d->slave_notify_fd) {
+				got_usr2 = TRUE;
+			} else if (fds[i].fd == d->session_output_fd) {
+				if (fds[i].revents & POLLNVAL)
+					read_session_output = FALSE;
+				else
 					run_session_output (FALSE /* read_until_eof */);
-				}				
-			} else if (errno == EBADF) {
-				read_session_output = FALSE;
-                mdm_debug ("slave_waitpid: errno = EBADF");
-			} else if (errno == EINTR) {				
-                mdm_debug ("slave_waitpid: errno = EINTR");   
-            } else if (errno == EINVAL) {				
-                mdm_debug ("slave_waitpid: errno = EINVAL");
-            }
-            else {
-                mdm_debug ("slave_waitpid: errno = unknown error");
-            }
-			check_notifies_now ();
-		} while (wp->pid > 1);
+			}
+		}
+
+		if (got_chld)
+			mdm_slave_child_handler (SIGCHLD);
+		if (got_usr2)
+			mdm_slave_handle_usr2_message ();
+
 		check_notifies_now ();
 	}
+	check_notifies_now ();
 
 	mdm_sigchld_block_push ();
 
@@ -1446,7 +1509,12 @@ mdm_slave_run (MdmDisplay *display)
 		mdm_sleep_no_signal (1);
 
 	if (SERVER_IS_LOCAL (d)) {
-		mdm_slave_send (MDM_SOP_START_NEXT_LOCAL, FALSE);
+		gchar *msg = g_strdup_printf ("%s %ld",
+					      MDM_SOP_START_NEXT_LOCAL,
+					      (long)getpid ());
+
+		mdm_slave_send (msg, FALSE /* wait_for_ack */);
+		g_free (msg);
 	}
 
 	check_notifies_now ();
@@ -1843,6 +1911,8 @@ mdm_slave_wait_for_login (void)
 		NEVER_FAILS_root_set_euid_egid (0, 0);
 
 		mdm_debug ("mdm_slave_wait_for_login: In loop");
+		/* nothing from the last attempt is held any more */
+		mdm_pwcache_trim ();
 		username = d->preset_user;
 		d->preset_user = NULL;
 		login_user = mdm_verify_user (d /* the display */,
@@ -2065,7 +2135,9 @@ run_pictures (void)
 			return;
 		}
 
-		pwent = getpwnam (response);
+		/* nothing from the last picture is held any more */
+		mdm_pwcache_trim ();
+		pwent = mdm_getpwnam (response);
 		if G_UNLIKELY (pwent == NULL) {
 			mdm_slave_greeter_ctl_no_ret (MDM_READPIC, "");
 			continue;
@@ -2324,7 +2396,7 @@ mdm_slave_greeter (void)
 			  MDM_GREETER_PROTOCOL_VERSION, TRUE);
 		g_setenv ("MDM_VERSION", VERSION, TRUE);
 
-		pwent = getpwnam (mdmuser);
+		pwent = mdm_getpwnam (mdmuser);
 		if G_LIKELY (pwent != NULL) {
 			/* Note that usually this doesn't exist */
 			if (pwent->pw_dir != NULL &&
@@ -2516,104 +2588,327 @@ mdm_slave_greeter (void)
 	}
 }
 
-/* This should not call anything that could cause a syslog in case we
- * are in a signal */
+/*
+ * How long the daemon took to ack our messages, in buckets of
+ * 100us, 1ms, 10ms, 100ms, 1s and above.  Logged with debug on once
+ * the session is started.
+ */
+#define ACK_BUCKETS 6
+static const gint64 ack_bucket_limits[ACK_BUCKETS - 1] = { 100, 1000, 10000, 100000, 1000000 };
+static const char  *ack_bucket_names[ACK_BUCKETS] = { "<100us", "<1ms", "<10ms", "<100ms", "<1s", ">=1s" };
+static guint        ack_histogram[ACK_BUCKETS];
+static guint        ack_timeouts = 0;
+static gint64       ack_max_usec = 0;
+
+static void
+slave_count_ack (const char *what, int what_len, gint64 usec)
+{
+	int i;
+
+	for (i = 0; i < ACK_BUCKETS - 1; i++) {
+		if (usec < ack_bucket_limits[i])
+			break;
+	}
+	ack_histogram[i]++;
+	ack_max_usec = MAX (ack_max_usec, usec);
+
+	if (mdm_in_signal == 0)
+		mdm_debug ("Ack for %.*s after %ld.%03ld ms", what_len, what,
+			   (long) (usec / 1000), (long) (usec % 1000));
+}
+
+static void
+slave_log_ack_stats (void)
+{
+	GString *str;
+	int i;
+
+	if ( ! mdm_daemon_config_get_value_bool (MDM_KEY_DEBUG))
+		return;
+
+	str = g_string_new (NULL);
+	for (i = 0; i < ACK_BUCKETS; i++)
+		g_string_append_printf (str, " %s:%u", ack_bucket_names[i], ack_histogram[i]);
+
+	mdm_debug ("Slave ack latency:%s timeouts:%u max:%ld.%03ld ms",
+		   str->str, ack_timeouts,
+		   (long) (ack_max_usec / 1000), (long) (ack_max_usec % 1000));
+	g_string_free (str, TRUE);
+}
+
+/*
+ * Waits until the daemon acks the message str, reading its notifies
+ * from slave_notify_fd as they come in.  SIGUSR2 is blocked meanwhile
+ * so the handler does not take the ack from under us; it finds the
+ * pipe empty when it runs afterwards.  Dialogs wait for the user, so
+ * they have no deadline.
+ *
+ * This should not call anything that could cause a syslog in case we
+ * are in a signal
+ */
+static void
+slave_wait_for_ack (const char *str, gboolean is_dialog)
+{
+	sigset_t mask, omask;
+	gint64 start, deadline, now;
+	int what_len;
+
+	/* just the opcode, the rest may be secret */
+	if (strncmp (str, "opcode=", strlen ("opcode=")) == 0)
+		str += strlen ("opcode=");
+	what_len = strcspn (str, " $");
+
+	sigemptyset (&mask);
+	sigaddset (&mask, SIGUSR2);
+	sigprocmask (SIG_BLOCK, &mask, &omask);
+
+	start = now = g_get_monotonic_time ();
+	deadline = start + (gint64) MAX (1, mdm_daemon_config_get_int_for_id (MDM_ID_SLAVE_ACK_TIMEOUT)) * G_USEC_PER_SEC;
+
+	while ( ! mdm_got_ack) {
+		struct pollfd pfd;
+		int timeout;
+		int ret;
+
+		if (is_dialog) {
+			timeout = -1;
+		} else {
+			if (now >= deadline || ! parent_exists ())
+				break;
+			/* wake up every second to see if the daemon is still there */
+			timeout = MIN ((deadline - now + 999) / 1000, 1000);
+		}
+
+		pfd.fd = d->slave_notify_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		ret = poll (&pfd, 1, timeout);
+		if (ret > 0)
+			mdm_slave_handle_usr2_message ();
+		else if (ret < 0 && errno != EINTR)
+			break;
+
+		now = g_get_monotonic_time ();
+	}
+
+	sigprocmask (SIG_SETMASK, &omask, NULL);
+
+	if G_LIKELY (mdm_got_ack) {
+		if ( ! is_dialog)
+			slave_count_ack (str, what_len, now - start);
+		return;
+	}
+
+	ack_timeouts++;
+	if (mdm_in_signal == 0)
+		mdm_debug ("Timeout occurred for sending message %.*s", what_len, str);
+}
+
+static void
+slave_reset_ack (void)
+{
+	mdm_got_ack = FALSE;
+	g_free (mdm_ack_response);
+	mdm_ack_response = NULL;
+}
+
+/*
+ * Frames waiting to be written as one batch, see
+ * mdm_slave_send_batch_begin.  last_frame is the offset of the newest
+ * frame, whose MDM_SOP_FRAME_MORE flag is cleared on flush.
+ */
+static char     batch_buf[PIPE_BUF];
+static gsize    batch_len = 0;
+static gsize    batch_last_frame = 0;
+static int      batch_depth = 0;
+static const char *batch_what = NULL;	/* for the debug output */
+
+/* Writes frames to the daemon in one piece and waits for the ack */
+static void
+frames_write (const char *buf, gsize len, const char *what)
+{
+	gboolean wait_for_ack = mdm_wait_for_ack;
+	int w;
+
+	if (wait_for_ack)
+		slave_reset_ack ();
+
+	/* below PIPE_BUF, so the daemon gets the frames in one piece */
+	VE_IGNORE_EINTR (w = write (slave_fifo_pipe_fd, buf, len));
+	if G_UNLIKELY (w != (int) len)
+		wait_for_ack = FALSE;
+
+	if (wait_for_ack)
+		slave_wait_for_ack (what, FALSE);
+}
+
+static void
+batch_flush (void)
+{
+	MdmSopFrameHeader *header;
+	gsize len;
+
+	if (batch_len == 0)
+		return;
+
+	header = (MdmSopFrameHeader *) (batch_buf + batch_last_frame);
+	header->flags &= ~MDM_SOP_FRAME_MORE;
+
+	len = batch_len;
+	batch_len = 0;
+	frames_write (batch_buf, len, batch_what);
+}
+
+/*
+ * Collects the messages sent until mdm_slave_send_batch_end into one
+ * write to the daemon, which acks them once.  Only messages that can
+ * be framed are batched, anything else flushes the batch first so the
+ * daemon sees them in order.  SIGCHLD is blocked meanwhile, so the
+ * child handler can neither send into a half built batch nor jump
+ * out of it and leave it open.
+ */
+void
+mdm_slave_send_batch_begin (void)
+{
+	mdm_sigchld_block_push ();
+	batch_depth++;
+}
+
+void
+mdm_slave_send_batch_end (void)
+{
+	g_return_if_fail (batch_depth > 0);
+
+	if (--batch_depth == 0)
+		batch_flush ();
+	mdm_sigchld_block_pop ();
+}
+
 void
 mdm_slave_send (const char *str, gboolean wait_for_ack)
 {
-	int i;
-	uid_t old;
+	gboolean is_dialog;
+
+	/* a signal handler must not touch the batch */
+	if (mdm_in_signal == 0)
+		batch_flush ();
 
 	if ( ! mdm_wait_for_ack)
 		wait_for_ack = FALSE;
 
-	if (wait_for_ack) {
-		mdm_got_ack = FALSE;
-		g_free (mdm_ack_response);
-		mdm_ack_response = NULL;
-	}
+	if (wait_for_ack)
+		slave_reset_ack ();
 
 	mdm_fdprintf (slave_fifo_pipe_fd, "\n%s\n", str);	
 
-#if defined (_POSIX_PRIORITY_SCHEDULING) && defined (HAVE_SCHED_YIELD)
-	if (wait_for_ack && ! mdm_got_ack) {
-		/* let the other process do its stuff */
-		sched_yield ();
-	}
-#endif
+	is_dialog = (strncmp (str, "opcode="MDM_SOP_SHOW_ERROR_DIALOG,
+			      strlen ("opcode="MDM_SOP_SHOW_ERROR_DIALOG)) == 0 ||
+		     strncmp (str, "opcode="MDM_SOP_SHOW_YESNO_DIALOG,
+			      strlen ("opcode="MDM_SOP_SHOW_YESNO_DIALOG)) == 0 ||
+		     strncmp (str, "opcode="MDM_SOP_SHOW_QUESTION_DIALOG,
+			      strlen ("opcode="MDM_SOP_SHOW_QUESTION_DIALOG)) == 0 ||
+		     strncmp (str, "opcode="MDM_SOP_SHOW_ASKBUTTONS_DIALOG,
+			      strlen ("opcode="MDM_SOP_SHOW_ASKBUTTONS_DIALOG)) == 0);
+
+	if (wait_for_ack)
+		slave_wait_for_ack (str, is_dialog);
+}
 
-	/* Wait till you get a response from the daemon */
-	if (strncmp (str, "opcode="MDM_SOP_SHOW_ERROR_DIALOG,
-		     strlen ("opcode="MDM_SOP_SHOW_ERROR_DIALOG)) == 0 ||
-	    strncmp (str, "opcode="MDM_SOP_SHOW_YESNO_DIALOG,
-		     strlen ("opcode="MDM_SOP_SHOW_YESNO_DIALOG)) == 0 ||
-	    strncmp (str, "opcode="MDM_SOP_SHOW_QUESTION_DIALOG,
-		     strlen ("opcode="MDM_SOP_SHOW_QUESTION_DIALOG)) == 0 ||
-	    strncmp (str, "opcode="MDM_SOP_SHOW_ASKBUTTONS_DIALOG,
-		     strlen ("opcode="MDM_SOP_SHOW_ASKBUTTONS_DIALOG)) == 0) {
+static const struct {
+	const char *opcode;
+	int         id;
+} frame_opcodes[] = {
+	{ MDM_SOP_XPID, MDM_SOP_ID_XPID },
+	{ MDM_SOP_SESSPID, MDM_SOP_ID_SESSPID },
+	{ MDM_SOP_GREETPID, MDM_SOP_ID_GREETPID },
+	{ MDM_SOP_LOGGED_IN, MDM_SOP_ID_LOGGED_IN },
+	{ MDM_SOP_LOGIN, MDM_SOP_ID_LOGIN },
+	{ MDM_SOP_COOKIE, MDM_SOP_ID_COOKIE },
+	{ MDM_SOP_AUTHFILE, MDM_SOP_ID_AUTHFILE },
+	{ MDM_SOP_QUERYLOGIN, MDM_SOP_ID_QUERYLOGIN },
+	{ MDM_SOP_MIGRATE, MDM_SOP_ID_MIGRATE },
+	{ MDM_SOP_DISP_NUM, MDM_SOP_ID_DISP_NUM },
+	{ MDM_SOP_VT_NUM, MDM_SOP_ID_VT_NUM },
+	{ MDM_SOP_SERVSTART, MDM_SOP_ID_SERVSTART },
+	{ MDM_SOP_FLEXI_ERR, MDM_SOP_ID_FLEXI_ERR },
+	{ MDM_SOP_FLEXI_OK, MDM_SOP_ID_FLEXI_OK },
+	{ MDM_SOP_WRITE_X_SERVERS, MDM_SOP_ID_WRITE_X_SERVERS },
+	{ MDM_SOP_CHOSEN_THEME, MDM_SOP_ID_CHOSEN_THEME },
+	{ NULL, 0 }
+};
 
-		for (; wait_for_ack && !mdm_got_ack ; ) {
-			fd_set rfds;
+static int
+frame_opcode_id (const char *opcode)
+{
+	int i;
 
-			FD_ZERO (&rfds);
-			FD_SET (d->slave_notify_fd, &rfds);
+	if (slave_fifo_frame_version != MDM_SOP_FRAME_VERSION)
+		return 0;
 
-			if (select (d->slave_notify_fd+1, &rfds, NULL, NULL, NULL) > 0) {
-				mdm_slave_handle_usr2_message ();
-			}
-		}
-        } else {
-		for (i = 0;
-		     wait_for_ack &&
-			     ! mdm_got_ack &&
-			     parent_exists () &&
-			     i < 10;
-		     i++) {
-			if (in_usr2_signal > 0) {
-				fd_set rfds;
-				struct timeval tv;
+	for (i = 0; frame_opcodes[i].opcode != NULL; i++) {
+		if (strcmp (frame_opcodes[i].opcode, opcode) == 0)
+			return frame_opcodes[i].id;
+	}
 
-				FD_ZERO (&rfds);
-				FD_SET (d->slave_notify_fd, &rfds);
+	return 0;
+}
 
-				/* Wait up to 1 second. */
-				tv.tv_sec = 1;
-				tv.tv_usec = 0;
+/* Sends one frame, or adds it to the batch.  Returns FALSE if the
+ * message is too long for a frame. */
+static gboolean
+slave_send_frame (const char *opcode, int id, int type,
+		  const void *payload, gsize payload_len)
+{
+	MdmSopFrameHeader header;
+	gsize length = sizeof (header) + payload_len;
 
-				if (select (d->slave_notify_fd+1, &rfds, NULL, NULL, &tv) > 0) {
-					mdm_slave_handle_usr2_message ();
-				}
-			} else {
-				struct timeval tv;
-				/* Wait 1 second. */
-				tv.tv_sec = 1;
-				tv.tv_usec = 0;
-				select (0, NULL, NULL, NULL, &tv);
-			
-			}
-		}
-	}
+	if (length > sizeof (batch_buf))
+		return FALSE;
 
-	if G_UNLIKELY (wait_for_ack  &&
-		       ! mdm_got_ack &&
-		       mdm_in_signal == 0) {
-		if (strncmp (str, MDM_SOP_COOKIE " ",
-			     strlen (MDM_SOP_COOKIE " ")) == 0) {
-			char *s = g_strndup
-				(str, strlen (MDM_SOP_COOKIE " XXXX XX"));
-			/* cut off most of the cookie for "security" */
-			mdm_debug ("Timeout occurred for sending message %s...", s);
-			g_free (s);
-		} else {
-			mdm_debug ("Timeout occurred for sending message %s", str);
-		}
+	memset (&header, 0, sizeof (header));
+	header.magic = MDM_SOP_FRAME_MAGIC;
+	header.version = MDM_SOP_FRAME_VERSION;
+	header.length = length;
+	header.opcode = id;
+	header.type = type;
+	header.flags = MDM_SOP_FRAME_MORE;
+	header.slave_pid = getpid ();
+
+	/* from a signal handler the frame goes out on its own, the
+	 * batch may be half written */
+	if (mdm_in_signal > 0) {
+		char frame[PIPE_BUF];
+
+		header.flags = 0;
+		memcpy (frame, &header, sizeof (header));
+		if (payload_len > 0)
+			memcpy (frame + sizeof (header), payload, payload_len);
+		frames_write (frame, length, opcode);
+		return TRUE;
 	}
+
+	if (batch_len + length > sizeof (batch_buf))
+		batch_flush ();
+
+	batch_what = (batch_len == 0) ? opcode : "batch";
+	batch_last_frame = batch_len;
+	memcpy (batch_buf + batch_len, &header, sizeof (header));
+	if (payload_len > 0)
+		memcpy (batch_buf + batch_len + sizeof (header), payload, payload_len);
+	batch_len += length;
+
+	if (batch_depth == 0)
+		batch_flush ();
+
+	return TRUE;
 }
 
 void
 mdm_slave_send_num (const char *opcode, long num)
 {
 	char *msg;
+	int id;
 
 	if (mdm_in_signal == 0)
 		mdm_debug ("Sending %s == %ld for slave %ld",
@@ -2621,6 +2916,15 @@ mdm_slave_send_num (const char *opcode, long num)
 			   (long)num,
 			   (long)getpid ());
 
+	id = frame_opcode_id (opcode);
+	if (id > 0) {
+		gint64 value = num;
+
+		slave_send_frame (opcode, id, MDM_SOP_FIELD_NUM,
+				  &value, sizeof (value));
+		return;
+	}
+
 	msg = g_strdup_printf ("%s %ld %ld", opcode,
 			       (long)getpid (), (long)num);
 
@@ -2633,6 +2937,7 @@ void
 mdm_slave_send_string (const char *opcode, const char *str)
 {
 	char *msg;
+	int id;
 
 	if G_UNLIKELY (mdm_daemon_config_get_value_bool (MDM_KEY_DEBUG) && mdm_in_signal == 0) {
 		mdm_debug ("Sending %s == <secret> for slave %ld",
@@ -2640,6 +2945,15 @@ mdm_slave_send_string (const char *opcode, const char *str)
 			   (long)getpid ());
 	}
 
+	id = frame_opcode_id (opcode);
+	if (id > 0) {
+		const char *value = ve_sure_string (str);
+
+		if (slave_send_frame (opcode, id, MDM_SOP_FIELD_STRING,
+				      value, strlen (value)))
+			return;
+	}
+
 	if (strcmp (opcode, MDM_SOP_SHOW_ERROR_DIALOG) == 0 ||
 	    strcmp (opcode, MDM_SOP_SHOW_YESNO_DIALOG) == 0 ||
 	    strcmp (opcode, MDM_SOP_SHOW_QUESTION_DIALOG) == 0 ||
@@ -3597,7 +3911,10 @@ mdm_slave_session_start (void)
 	mdm_debug ("mdm_slave_session_start: Attempting session for user '%s'",
 		   login_user);
 
-	pwent = getpwnam (login_user);
+	/* PAM may have just created or changed the user (or its
+	 * groups), so do not trust anything looked up before auth */
+	mdm_pwcache_invalidate ();
+	pwent = mdm_getpwnam (login_user);
 
 	if G_UNLIKELY (pwent == NULL)  {
 		/* This is sort of an "assert", this should NEVER happen */
@@ -4001,6 +4318,7 @@ mdm_slave_session_start (void)
 				pid);
 
 	mdm_slave_send_num (MDM_SOP_SESSPID, pid);
+	slave_log_ack_stats ();
 
 	mdm_sigchld_block_push ();
 	wp = slave_waitpid_setpid (d->sesspid);
@@ -4129,7 +4447,7 @@ mdm_slave_session_stop (gboolean run_post_session,
 	if (local_login == NULL)
 		pwent = NULL;
 	else
-		pwent = getpwnam (local_login);	/* PAM overwrites our pwent */
+		pwent = mdm_getpwnam (local_login);
 
 	x_servers_file = mdm_make_filename (mdm_daemon_config_get_value_string (MDM_KEY_SERV_AUTHDIR),
 					    d->name, ".Xservers");
@@ -4452,6 +4770,8 @@ mdm_slave_handle_usr2_message (void)
 				mdm_wait_for_go = FALSE;
 			} else if (strcmp (&s[1], MDM_NOTIFY_TWIDDLE_POINTER) == 0) {
 				mdm_twiddle_pointer (d);
+			} else if (strcmp (&s[1], MDM_NOTIFY_CLAIMED) == 0) {
+				d->pooled = FALSE;
 			}
 		} else if (s[0] == MDM_SLAVE_NOTIFY_RESPONSE) {
 			mdm_got_ack = TRUE;
@@ -5230,6 +5550,6 @@ mdm_slave_final_cleanup (void)
 gboolean
 mdm_is_user_valid (const char *username)
 {
-	return (NULL != getpwnam (username));
+	return (NULL != mdm_getpwnam (username));
 }
 
@@ -39,6 +39,8 @@ gboolean mdm_slave_action_pending (void);
 void	 mdm_slave_send		(const char *str, gboolean wait_for_ack);
 void	 mdm_slave_send_num	(const char *opcode, long num);
 void     mdm_slave_send_string	(const char *opcode, const char *str);
+void     mdm_slave_send_batch_begin (void);
+void     mdm_slave_send_batch_end   (void);
 gboolean mdm_slave_final_cleanup (void);
 
 void     mdm_slave_whack_temp_auth_file (void);
@@ -0,0 +1,83 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+/*
+ * Measures how many cookies a second mdm_cookie_generate hands out,
+ * and the slowest single call, with the getrandom () pool and with
+ * the old generator that reads the entropy sources one by one.  Run
+ * it on a freshly booted machine, or with something draining
+ * /dev/random, to see the old path stall on slow sources.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <glib.h>
+
+#include "cookie.h"
+
+static void
+bench (const char *what, gboolean pool, int count)
+{
+	gint64 start, before, after, worst;
+	int i;
+
+	mdm_cookie_set_pool (pool);
+
+	worst = 0;
+	start = g_get_monotonic_time ();
+	for (i = 0; i < count; i++) {
+		char *cookie;
+		char *bcookie;
+
+		before = g_get_monotonic_time ();
+		mdm_cookie_generate (&cookie, &bcookie);
+		after = g_get_monotonic_time ();
+
+		worst = MAX (worst, after - before);
+
+		g_free (cookie);
+		g_free (bcookie);
+	}
+	after = g_get_monotonic_time ();
+
+	printf ("%-8s %8d cookies  %12.0f cookies/s  worst %8ld us\n",
+		what, count,
+		count / ((after - start + 1) / (double) G_USEC_PER_SEC),
+		(long) worst);
+}
+
+int
+main (int argc, char **argv)
+{
+	int count = 100000;
+
+	if (argc > 1)
+		count = atoi (argv[1]);
+	if (count <= 0)
+		count = 1;
+
+	bench ("pool", TRUE, count);
+	/* the old path is slow enough that a few are plenty */
+	bench ("mixed", FALSE, MAX (1, count / 1000));
+
+	return 0;
+}
@@ -0,0 +1,152 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+/*
+ * Pipelines a GET_CONFIG_MULTI between two VERSION requests to a
+ * running daemon and checks that every reply line carries its tag:
+ * the bulk request has to be refused with error 201 rather than
+ * answered with untagged record lines, and the requests around it
+ * still get their replies.  Takes the socket path as an optional
+ * argument and exits non-zero on failure.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <glib.h>
+
+#include "mdm-socket-protocol.h"
+#include "mdm-daemon-config-keys.h"
+
+static const char request[] =
+	MDM_SUP_VERSION " " MDM_SUP_PIPELINE "\n"
+	"0 " MDM_SUP_VERSION "\n"
+	"1 " MDM_SUP_GET_CONFIG_MULTI " - " MDM_KEY_BROWSER " " MDM_KEY_TIMED_LOGIN_ENABLE "\n"
+	"2 " MDM_SUP_VERSION "\n"
+	"close " MDM_SUP_CLOSE "\n";
+
+static int
+connect_to (const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	g_strlcpy (addr.sun_path, path, sizeof (addr.sun_path));
+
+	fd = socket (AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0) {
+		close (fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int
+main (int argc, char **argv)
+{
+	const char *path = MDM_SUP_SOCKET;
+	GString *reply;
+	char buf[1024];
+	char **lines;
+	gboolean seen[3] = { FALSE, FALSE, FALSE };
+	ssize_t n;
+	int failed = 0;
+	int fd;
+	int i;
+
+	if (argc > 1)
+		path = argv[1];
+
+	fd = connect_to (path);
+	if (fd < 0) {
+		fprintf (stderr, "cannot connect to %s, is the daemon running?\n", path);
+		return 77;
+	}
+
+	if (write (fd, request, strlen (request)) != (ssize_t) strlen (request)) {
+		fprintf (stderr, "short write to %s\n", path);
+		close (fd);
+		return 1;
+	}
+
+	/* the daemon hangs up after the close */
+	reply = g_string_new (NULL);
+	while ((n = read (fd, buf, sizeof (buf))) > 0)
+		g_string_append_len (reply, buf, n);
+	close (fd);
+
+	lines = g_strsplit (reply->str, "\n", -1);
+	g_string_free (reply, TRUE);
+
+	if (lines[0] == NULL ||
+	    ! g_str_has_suffix (lines[0], " " MDM_SUP_PIPELINE)) {
+		fprintf (stderr, "no pipelined mode: '%s'\n",
+			 lines[0] != NULL ? lines[0] : "");
+		g_strfreev (lines);
+		return 77;
+	}
+
+	for (i = 1; lines[i] != NULL; i++) {
+		char *p;
+		long tag;
+
+		if (lines[i][0] == '\0')
+			continue;
+
+		tag = strtol (lines[i], &p, 10);
+		if (p == lines[i] || *p != ' ' || tag < 0 || tag > 2 || seen[tag]) {
+			fprintf (stderr, "FAIL: untagged or stray line '%s'\n", lines[i]);
+			failed++;
+			continue;
+		}
+		seen[tag] = TRUE;
+
+		if (tag == 1 && ! g_str_has_prefix (p + 1, "ERROR 201 ")) {
+			fprintf (stderr, "FAIL: GET_CONFIG_MULTI answered '%s'\n", p + 1);
+			failed++;
+		} else if (tag != 1 && ! g_str_has_prefix (p + 1, "MDM ")) {
+			fprintf (stderr, "FAIL: VERSION answered '%s'\n", p + 1);
+			failed++;
+		}
+	}
+	g_strfreev (lines);
+
+	for (i = 0; i < 3; i++) {
+		if ( ! seen[i]) {
+			fprintf (stderr, "FAIL: no reply for tag %d\n", i);
+			failed++;
+		}
+	}
+
+	printf ("%s\n", failed ? "FAIL" : "PASS");
+
+	return failed ? 1 : 0;
+}
@@ -151,7 +151,7 @@ mdm_verify_user (MdmDisplay *d,
 	}
 	mdm_slave_greeter_ctl_no_ret (MDM_SETLOGIN, login);
 
-	pwent = getpwnam (login);
+	pwent = mdm_getpwnam (login);
 
 	ppasswd = (pwent == NULL) ? NULL : g_strdup (pwent->pw_passwd);
 
@@ -403,7 +403,7 @@ mdm_verify_setup_user (MdmDisplay *d,
 
 	*new_login = NULL;
 
-	pwent = getpwnam (login);
+	pwent = mdm_getpwnam (login);
 	if (pwent == NULL) {
 		mdm_debug ("Cannot get passwd structure");
 		return FALSE;
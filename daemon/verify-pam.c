@@ -102,22 +102,15 @@ gboolean mdm_verify_check_selectable_user (const char * user) {
 	}
 
 	// Return if the user belongs to the nopasswdlogin group
-	char result[255];
-	char * command = g_strdup_printf("id '%s' 2>/dev/null | grep nopasswdlogin | wc -l", user);
-	FILE *fp = popen(command, "r");
-	fscanf(fp, "%s", result);
-	pclose(fp);
-	if (strcmp(result, "0") != 0) {
+	if (mdm_user_in_group (user, "nopasswdlogin")) {
 		mdm_debug("mdm_verify_check_selectable_user: user '%s' is part of the nopasswdlogin group.", user);
 		g_free (home_dir);
 		g_free (accounts_service);
-		g_free (command);
 		return FALSE;
 	}
 
 	g_free (home_dir);
 	g_free (accounts_service);
-	g_free (command);
 	return TRUE;
 }
 
@@ -615,7 +608,7 @@ log_to_audit_system(const char *login,
 
 	audit_fd = audit_open ();
 	if (login)
-		pw = getpwnam (login);
+		pw = mdm_getpwnam (login);
 	else {
 		login = "unknown";
 		pw = NULL;
@@ -856,7 +849,7 @@ mdm_verify_user (MdmDisplay *d,
 
 	/* Check if user is root and is allowed to log in */
 
-	pwent = getpwnam (login);
+	pwent = mdm_getpwnam (login);
 	if (( ! mdm_daemon_config_get_value_bool (MDM_KEY_ALLOW_ROOT) ||
             ( ! d->attached )) &&
             (pwent != NULL && pwent->pw_uid == 0)) {
@@ -911,7 +904,7 @@ mdm_verify_user (MdmDisplay *d,
 		goto pamerr;
 	}
 
-	pwent = getpwnam (login);
+	pwent = mdm_getpwnam (login);
 	if (/* paranoia */ pwent == NULL ||
 	    ! mdm_setup_gids (login, pwent->pw_gid)) {
 		mdm_error ("Cannot set user group for %s", login);
@@ -972,7 +965,7 @@ mdm_verify_user (MdmDisplay *d,
 		login = g_strdup ((const char *)p);
 	}
 	if (pwent == NULL && login != NULL) {
-		pwent = getpwnam (login);
+		pwent = mdm_getpwnam (login);
 	}
 
 	/*
@@ -1194,7 +1187,7 @@ mdm_verify_setup_user (MdmDisplay *d, const gchar *login, char **new_login)
 		goto setup_pamerr;
 	}
 
-	pwent = getpwnam (login);
+	pwent = mdm_getpwnam (login);
 	if (/* paranoia */ pwent == NULL ||
 	    ! mdm_setup_gids (login, pwent->pw_gid)) {
 		mdm_error ("Cannot set user group for %s", login);
@@ -1257,7 +1250,7 @@ mdm_verify_setup_user (MdmDisplay *d, const gchar *login, char **new_login)
 	 * Note login is never NULL when this function is called.
 	 */
 	if (pwent == NULL) {
-		pwent = getpwnam (login);
+		pwent = mdm_getpwnam (login);
 	}
 
 	/*
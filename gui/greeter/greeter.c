@@ -588,6 +588,12 @@ mdm_read_config (void)
 	
 	mdmcomm_open_connection_to_daemon ();
 
+	/*
+	 * Seed the caches with a single GET_CONFIG_ALL, so the reads
+	 * below only go to the daemon for keys it did not return.
+	 */
+	mdm_config_prefetch (NULL);
+
 	/*
 	 * Read all the keys at once and close sockets connection so we do
 	 * not have to keep the socket open.
@@ -623,6 +629,8 @@ mdm_read_config (void)
 	mdm_config_get_int    (MDM_KEY_MAX_ICON_HEIGHT);
 	mdm_config_get_int    (MDM_KEY_MAX_ICON_WIDTH);
 	mdm_config_get_int    (MDM_KEY_MINIMAL_UID);
+	mdm_config_get_int    (MDM_KEY_MAX_USERS);
+	mdm_config_get_int    (MDM_KEY_USER_LIST_CACHE_TTL);
 	mdm_config_get_bool   (MDM_KEY_ENTRY_CIRCLES);
 	mdm_config_get_bool   (MDM_KEY_ENTRY_INVISIBLE);
 	mdm_config_get_bool   (MDM_KEY_INCLUDE_ALL);
@@ -679,6 +687,8 @@ greeter_reread_config (int sig, gpointer data)
 	    mdm_config_reload_int    (MDM_KEY_MAX_ICON_HEIGHT) ||
 	    mdm_config_reload_int    (MDM_KEY_MAX_ICON_WIDTH) ||
 	    mdm_config_reload_int    (MDM_KEY_MINIMAL_UID) ||
+	    mdm_config_reload_int    (MDM_KEY_MAX_USERS) ||
+	    mdm_config_reload_int    (MDM_KEY_USER_LIST_CACHE_TTL) ||
 
 	    mdm_config_reload_bool   (MDM_KEY_ENTRY_CIRCLES) ||
 	    mdm_config_reload_bool   (MDM_KEY_ENTRY_INVISIBLE) ||
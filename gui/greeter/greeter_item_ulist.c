@@ -175,49 +175,90 @@ mdm_greeter_users_init (void)
 	mdm_users_init (&users, &users_string, NULL, defface, &size_of_users, MDM_IS_LOCAL, !DOING_MDM_DEVELOPMENT);
 }
 
+static void
+greeter_set_user_row (GtkTreeModel *tm, GtkTreeIter *iter, MdmUser *usr)
+{
+	char       *label;
+	char       *name;
+	gboolean    active;
+
+	if (usr->gecos && strcmp (usr->gecos, "") != 0) {
+		name = mdm_common_text_to_escaped_utf8 (usr->gecos);
+	} else {
+		name = mdm_common_text_to_escaped_utf8 (usr->login);
+	}
+
+	/* the hash is gone once the list is first filled */
+	if (displays_hash != NULL &&
+	    g_hash_table_lookup (displays_hash, usr->login))
+		active = TRUE;
+	else
+		active = FALSE;
+
+	if (active) {
+		label = g_strdup_printf ("<b>%s</b>\n    <i><small>%s</small></i>",
+					 name,
+					 _("Already logged in"));
+	} else {
+		label = g_strdup_printf ("<b>%s</b>\n",
+					 name);
+	}
+
+	g_free (name);
+
+	gtk_list_store_set (GTK_LIST_STORE (tm), iter,
+			    GREETER_ULIST_ICON_COLUMN, usr->picture,
+			    GREETER_ULIST_LOGIN_COLUMN, usr->login,
+			    GREETER_ULIST_LABEL_COLUMN, label,
+			    GREETER_ULIST_ACTIVE_COLUMN, active,
+			    -1);
+	g_free (label);
+}
+
 static void
 greeter_populate_user_list (GtkTreeModel *tm)
 {
 	GList *li;
 
 	for (li = users; li != NULL; li = li->next) {
-		MdmUser    *usr = li->data;
 		GtkTreeIter iter = {0};
-		char       *label;
-		char       *name;
-		gboolean    active;
-
-		if (usr->gecos && strcmp (usr->gecos, "") != 0) {
-			name = mdm_common_text_to_escaped_utf8 (usr->gecos);
-		} else {
-			name = mdm_common_text_to_escaped_utf8 (usr->login);
-		}
 
-		if (g_hash_table_lookup (displays_hash, usr->login))
-			active = TRUE;
-		else
-			active = FALSE;
-
-		if (active) {
-			label = g_strdup_printf ("<b>%s</b>\n    <i><small>%s</small></i>",
-						 name,
-						 _("Already logged in"));
-		} else {
-			label = g_strdup_printf ("<b>%s</b>\n",
-						 name);
-		}
+		gtk_list_store_append (GTK_LIST_STORE (tm), &iter);
+		greeter_set_user_row (tm, &iter, li->data);
+		num_users++;
+	}
+}
 
-		g_free (name);
+/* The user list was refreshed in the background */
+static void
+greeter_user_changed (MdmUser *usr, gboolean removed, gpointer data)
+{
+	GtkTreeModel *tm = data;
+	GtkTreeIter iter = {0};
+	gboolean valid;
 
-		gtk_list_store_append (GTK_LIST_STORE (tm), &iter);
-		gtk_list_store_set (GTK_LIST_STORE (tm), &iter,
-				    GREETER_ULIST_ICON_COLUMN, usr->picture,
-				    GREETER_ULIST_LOGIN_COLUMN, usr->login,
-				    GREETER_ULIST_LABEL_COLUMN, label,
-				    GREETER_ULIST_ACTIVE_COLUMN, active,
-				    -1);
-		g_free (label);
+	if ( ! removed) {
+		gtk_list_store_insert (GTK_LIST_STORE (tm), &iter,
+				       g_list_index (users, usr));
+		greeter_set_user_row (tm, &iter, usr);
 		num_users++;
+		return;
+	}
+
+	valid = gtk_tree_model_get_iter_first (tm, &iter);
+	while (valid) {
+		char *login = NULL;
+
+		gtk_tree_model_get (tm, &iter,
+				    GREETER_ULIST_LOGIN_COLUMN, &login, -1);
+		if (login != NULL && strcmp (login, usr->login) == 0) {
+			g_free (login);
+			gtk_list_store_remove (GTK_LIST_STORE (tm), &iter);
+			num_users--;
+			return;
+		}
+		g_free (login);
+		valid = gtk_tree_model_iter_next (tm, &iter);
 	}
 }
 
@@ -312,6 +353,7 @@ greeter_generate_userlist (GtkWidget *tv, GreeterItemInfo *info)
 		gtk_tree_view_append_column (GTK_TREE_VIEW (tv), column_two);
 
 		greeter_populate_user_list (tm);
+		mdm_users_set_changed_func (greeter_user_changed, tm);
 
 		list = gtk_tree_view_column_get_cell_renderers (column_one);
 		for (li = list; li != NULL; li = li->next) {
@@ -59,11 +59,102 @@ mdmcomm_set_quiet_errors (gboolean enable)
 	quiet = enable;
 }
 
+/*
+ * Replies from the daemon are read a buffer at a time rather than a
+ * byte at a time.  Whatever follows the line that was asked for is
+ * kept for the next read on the same connection, so the buffer has to
+ * be reset whenever that connection is closed.
+ */
+typedef struct {
+	char  data[4096];
+	gsize start;
+	gsize end;
+} ReadBuffer;
+
+static ReadBuffer comm_buf;
+
+static void
+reset_read_buffer (ReadBuffer *buf)
+{
+	buf->start = 0;
+	buf->end   = 0;
+}
+
+static gboolean
+fill_read_buffer (int fd, ReadBuffer *buf)
+{
+	ssize_t n;
+
+	reset_read_buffer (buf);
+
+	VE_IGNORE_EINTR (n = read (fd, buf->data, sizeof (buf->data)));
+	if (n <= 0)
+		return FALSE;
+
+	buf->end = n;
+	return TRUE;
+}
+
+/*
+ * Returns the next line from fd without the trailing newline, or as
+ * much of it as could be read if the connection was closed first.
+ */
 static char *
-do_command (int fd, const char *command, gboolean get_response)
+read_response_line (int fd, ReadBuffer *buf)
 {
 	GString *str;
-	char buf[1];
+
+	str = g_string_new (NULL);
+
+	for (;;) {
+		char *nl;
+
+		if (buf->start == buf->end && ! fill_read_buffer (fd, buf))
+			break;
+
+		nl = memchr (buf->data + buf->start, '\n', buf->end - buf->start);
+		if (nl != NULL) {
+			g_string_append_len (str, buf->data + buf->start,
+					     nl - (buf->data + buf->start));
+			buf->start = nl - buf->data + 1;
+			break;
+		}
+
+		g_string_append_len (str, buf->data + buf->start, buf->end - buf->start);
+		buf->start = buf->end;
+	}
+
+	return g_string_free (str, FALSE);
+}
+
+/*
+ * Reads the n_lines lines that follow an "OK <n>" reply.  Returns NULL
+ * if the connection was closed before all of them arrived.
+ */
+static char **
+read_response_lines (int fd, ReadBuffer *buf, int n_lines)
+{
+	char **lines;
+	int i;
+
+	lines = g_new0 (char *, n_lines + 1);
+
+	for (i = 0; i < n_lines; i++) {
+		/* the daemon never sends an empty line */
+		lines[i] = read_response_line (fd, buf);
+		if (ve_string_empty (lines[i])) {
+			mdm_common_debug ("  Reply ended after %d of %d lines", i, n_lines);
+			g_strfreev (lines);
+			return NULL;
+		}
+	}
+
+	return lines;
+}
+
+static char *
+do_command (int fd, const char *command, gboolean get_response)
+{
 	char *cstr;
 	int ret;
 #ifndef MSG_NOSIGNAL
@@ -95,16 +186,9 @@ do_command (int fd, const char *command, gboolean get_response)
 	if ( ! get_response)
 		return NULL;
 
-	str = g_string_new (NULL);
-	while (read (fd, buf, 1) == 1 &&
-	       buf[0] != '\n') {
-		g_string_append_c (str, buf[0]);
-	}
-
-        mdm_common_debug ("  Got response: '%s'", str->str);
+	cstr = read_response_line (fd, &comm_buf);
 
-	cstr = str->str;
-	g_string_free (str, FALSE);
+        mdm_common_debug ("  Got response: '%s'", cstr);
 
 	/*
 	 * If string is empty, then the daemon likely closed the connection 
@@ -131,9 +215,22 @@ static gboolean allow_sleep          = TRUE;
 static gboolean did_sleep_on_failure = FALSE;
 static int comm_fd                   = 0;
 
+static void
+close_comm_fd (void)
+{
+	VE_IGNORE_EINTR (close (comm_fd));
+	comm_fd = 0;
+	reset_read_buffer (&comm_buf);
+}
+
+/*
+ * If lines is not NULL the reply is expected to be "OK <n>" followed by
+ * n lines, which are returned in lines.
+ */
 static char *
 mdmcomm_call_mdm_real (const char *command,
 		       const char *auth_cookie,
+		       char ***lines,
 		       int tries,
 		       int try_start)
 {
@@ -146,8 +243,7 @@ mdmcomm_call_mdm_real (const char *command,
 	if (num_cmds == (MDM_SUP_MAX_MESSAGES - 1)) {
 		mdm_common_debug ("  Closing and reopening connection.");
 		do_command (comm_fd, MDM_SUP_CLOSE, FALSE);
-		VE_IGNORE_EINTR (close (comm_fd));
-		comm_fd  = 0;
+		close_comm_fd ();
 		num_cmds = 0;
 	}
 
@@ -171,7 +267,7 @@ mdmcomm_call_mdm_real (const char *command,
 			if ( !quiet)
 				mdm_common_debug ("  Failed to open socket");
 
-			return mdmcomm_call_mdm_real (command, auth_cookie, tries - 1, try_start);
+			return mdmcomm_call_mdm_real (command, auth_cookie, lines, tries - 1, try_start);
 		}
 
 		if (connect (comm_fd, (struct sockaddr *)&addr, sizeof (addr)) < 0) {
@@ -204,9 +300,8 @@ mdmcomm_call_mdm_real (const char *command,
 				if ( !quiet)
 					mdm_common_debug ("  Failed to connect to socket, not sleeping");
 			}
-			VE_IGNORE_EINTR (close (comm_fd));
-			comm_fd = 0;
-			return mdmcomm_call_mdm_real (command, auth_cookie,
+			close_comm_fd ();
+			return mdmcomm_call_mdm_real (command, auth_cookie, lines,
 						      tries - 1, try_start);
 		}
 
@@ -226,9 +321,8 @@ mdmcomm_call_mdm_real (const char *command,
 		ret = do_command (comm_fd, auth_cmd, TRUE);
 		g_free (auth_cmd);
 		if (ret == NULL) {
-			VE_IGNORE_EINTR (close (comm_fd));
-			comm_fd = 0;
-			return mdmcomm_call_mdm_real (command, auth_cookie,
+			close_comm_fd ();
+			return mdmcomm_call_mdm_real (command, auth_cookie, lines,
 						      tries - 1, try_start);
 		}
 		/* not auth'ed */
@@ -236,8 +330,7 @@ mdmcomm_call_mdm_real (const char *command,
 			if ( !quiet)
 				mdm_common_debug ("  Error, auth check failed");
 			do_command (comm_fd, MDM_SUP_CLOSE, FALSE);
-			VE_IGNORE_EINTR (close (comm_fd));
-			comm_fd = 0;
+			close_comm_fd ();
 			/* returns the error */
 			return ret;
 		}
@@ -246,12 +339,22 @@ mdmcomm_call_mdm_real (const char *command,
 
 	ret = do_command (comm_fd, command, TRUE);
 	if (ret == NULL) {
-		VE_IGNORE_EINTR (close (comm_fd));
-		comm_fd = 0;
-		return mdmcomm_call_mdm_real (command, auth_cookie,
+		close_comm_fd ();
+		return mdmcomm_call_mdm_real (command, auth_cookie, lines,
 					      tries - 1, try_start);
 	}
 
+	if (lines != NULL && strncmp (ret, "OK ", 3) == 0) {
+		*lines = read_response_lines (comm_fd, &comm_buf,
+					      MAX (atoi (ret + 3), 0));
+		if (*lines == NULL) {
+			g_free (ret);
+			close_comm_fd ();
+			return mdmcomm_call_mdm_real (command, auth_cookie, lines,
+						      tries - 1, try_start);
+		}
+	}
+
 	/*
 	 * We want to leave the connection open if bulk_acs is set to
 	 * true, so clients can read as much config data in one 
@@ -265,8 +368,7 @@ mdmcomm_call_mdm_real (const char *command,
 	 */
 	if (bulk_acs == FALSE) {
 		do_command (comm_fd, MDM_SUP_CLOSE, FALSE);
-		VE_IGNORE_EINTR (close (comm_fd));
-		comm_fd = 0;
+		close_comm_fd ();
 	}
 
 	return ret;
@@ -278,7 +380,7 @@ mdmcomm_send_cmd_to_daemon_with_args (const char *command, const char * auth_coo
 
 	char *retstr;
 
-	retstr = mdmcomm_call_mdm_real (command, auth_cookie, tries, tries);
+	retstr = mdmcomm_call_mdm_real (command, auth_cookie, NULL, tries, tries);
 
 	/*
 	 * Disallow sleeping on future calls if it failed to connect.
@@ -297,6 +399,209 @@ mdmcomm_send_cmd_to_daemon (const char *command)
 	return (mdmcomm_send_cmd_to_daemon_with_args (command, NULL, 5));
 }
 
+/*
+ * For commands like GET_CONFIG_ALL that answer "OK <n>" and then send
+ * n more lines.  Returns the first line of the reply, like
+ * mdmcomm_send_cmd_to_daemon_with_args, and sets lines to the n lines
+ * that followed it if the reply was OK, or to NULL otherwise.
+ */
+char *
+mdmcomm_send_cmd_to_daemon_with_lines (const char *command,
+				       const char *auth_cookie,
+				       int tries,
+				       char ***lines)
+{
+	char *retstr;
+
+	g_return_val_if_fail (lines != NULL, NULL);
+
+	*lines = NULL;
+	retstr = mdmcomm_call_mdm_real (command, auth_cookie, lines, tries, tries);
+
+	if (did_sleep_on_failure == TRUE)
+		allow_sleep = FALSE;
+
+	return (retstr);
+}
+
+static int
+connect_to_daemon (void)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	strcpy (addr.sun_path, MDM_SUP_SOCKET);
+	addr.sun_family = AF_UNIX;
+	fd = socket (AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0) {
+		VE_IGNORE_EINTR (close (fd));
+		return -1;
+	}
+
+	return fd;
+}
+
+static gboolean
+send_all (int fd, const char *data, gsize len)
+{
+#ifndef MSG_NOSIGNAL
+	void (*old_handler)(int);
+#endif
+
+	while (len > 0) {
+		ssize_t ret;
+
+#ifdef MSG_NOSIGNAL
+		VE_IGNORE_EINTR (ret = send (fd, data, len, MSG_NOSIGNAL));
+#else
+		old_handler = signal (SIGPIPE, SIG_IGN);
+		VE_IGNORE_EINTR (ret = send (fd, data, len, 0));
+		signal (SIGPIPE, old_handler);
+#endif
+		if (ret < 0)
+			return FALSE;
+
+		data += ret;
+		len  -= ret;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Sends one batch of commands in pipelined mode, all in a single
+ * write, and collects the tagged replies into replies.  Returns FALSE
+ * if the batch could not be sent that way, in which case none of the
+ * commands were run.
+ */
+static gboolean
+pipeline_batch (const char * const *commands,
+		int                 n_commands,
+		const char         *auth_cookie,
+		char              **replies)
+{
+	ReadBuffer buf;
+	GString *request;
+	char *line;
+	gboolean sent;
+	int fd;
+	int i;
+
+	fd = connect_to_daemon ();
+	if (fd < 0) {
+		if ( !quiet)
+			mdm_common_debug ("  Failed to connect to socket");
+		return FALSE;
+	}
+
+	request = g_string_new (MDM_SUP_VERSION " " MDM_SUP_PIPELINE "\n");
+	if (auth_cookie != NULL)
+		g_string_append_printf (request, "auth " MDM_SUP_AUTH_LOCAL " %s\n",
+					auth_cookie);
+	for (i = 0; i < n_commands; i++) {
+		mdm_common_debug ("Sending command: '%s'", commands[i]);
+		g_string_append_printf (request, "%d %s\n", i, commands[i]);
+	}
+	g_string_append (request, "close " MDM_SUP_CLOSE "\n");
+
+	sent = send_all (fd, request->str, request->len);
+	g_string_free (request, TRUE);
+
+	reset_read_buffer (&buf);
+
+	/* older daemons hang up on us here */
+	line = sent ? read_response_line (fd, &buf) : NULL;
+	if (line == NULL || ! g_str_has_suffix (line, " " MDM_SUP_PIPELINE)) {
+		mdm_common_debug ("  Pipelining not supported, sending commands one by one");
+		g_free (line);
+		VE_IGNORE_EINTR (close (fd));
+		return FALSE;
+	}
+	g_free (line);
+
+	if (auth_cookie != NULL) {
+		line = read_response_line (fd, &buf);
+		if (strcmp (line, "auth OK") != 0) {
+			if ( !quiet)
+				mdm_common_debug ("  Error, auth check failed");
+			/* every command gets the error */
+			for (i = 0; i < n_commands; i++) {
+				if (g_str_has_prefix (line, "auth "))
+					replies[i] = g_strdup (line + strlen ("auth "));
+			}
+			g_free (line);
+			VE_IGNORE_EINTR (close (fd));
+			return TRUE;
+		}
+		g_free (line);
+	}
+
+	/* replies come back in order, but go by the tag anyway */
+	for (;;) {
+		char *p;
+
+		line = read_response_line (fd, &buf);
+		if (ve_string_empty (line)) {
+			g_free (line);
+			break;
+		}
+
+		mdm_common_debug ("  Got response: '%s'", line);
+
+		i = strtol (line, &p, 10);
+		if (p != line && *p == ' ' &&
+		    i >= 0 && i < n_commands && replies[i] == NULL)
+			replies[i] = g_strdup (p + 1);
+		g_free (line);
+	}
+
+	VE_IGNORE_EINTR (close (fd));
+	return TRUE;
+}
+
+/*
+ * Sends all of commands to the daemon without waiting for the reply to
+ * one before sending the next, so the whole lot takes about one round
+ * trip.  Returns an array of n_commands replies, in the same order; a
+ * reply is NULL if the daemon hung up before answering that command.
+ * Free each reply and then the array with g_free.  Falls back to
+ * sending the commands one at a time when the daemon does not support
+ * pipelining.
+ */
+char **
+mdmcomm_send_cmds_to_daemon (const char * const *commands,
+			     int                 n_commands,
+			     const char         *auth_cookie)
+{
+	char **replies;
+	int batch;
+	int i;
+
+	replies = g_new0 (char *, n_commands + 1);
+
+	/* leave room for the VERSION, AUTH_LOCAL and CLOSE lines */
+	for (i = 0; i < n_commands; i += batch) {
+		batch = MIN (n_commands - i, MDM_SUP_MAX_PIPELINED_MESSAGES - 3);
+		if ( ! pipeline_batch (commands + i, batch, auth_cookie, replies + i))
+			break;
+	}
+
+	if (i < n_commands) {
+		gboolean was_bulk = bulk_acs;
+
+		bulk_acs = TRUE;
+		for (; i < n_commands; i++)
+			replies[i] = mdmcomm_send_cmd_to_daemon_with_args (commands[i], auth_cookie, 5);
+		if ( ! was_bulk)
+			mdmcomm_close_connection_to_daemon ();
+	}
+
+	return replies;
+}
+
 void
 mdmcomm_set_allow_sleep (gboolean val)
 {
@@ -315,7 +620,7 @@ mdmcomm_close_connection_to_daemon (void)
 	/* Close the connection */
 	if (comm_fd > 0) {
 		do_command (comm_fd, MDM_SUP_CLOSE, FALSE);
-		VE_IGNORE_EINTR (close (comm_fd));
+		close_comm_fd ();
 	}
 	comm_fd  = 0;
 	num_cmds = 0;
@@ -644,6 +949,8 @@ mdmcomm_get_error_message (const char *ret)
 	} else if (strncmp (ret, "ERROR 200 ", strlen ("ERROR 200 ")) == 0) {
 		return _("Too many messages were sent to MDM and it hung up "
 			 "on us.");
+	} else if (strncmp (ret, "ERROR 201 ", strlen ("ERROR 201 ")) == 0) {
+		return _("This command cannot be pipelined.");
 	} else {
 		return _("Unknown error occurred.");
 	}
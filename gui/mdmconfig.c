@@ -35,6 +35,8 @@
 #include "mdmconfig.h"
 
 #include "mdm-common.h"
+#include "mdm-config-snapshot.h"
+#include "mdm-daemon-config-keys.h"
 #include "mdm-log.h"
 #include "mdm-socket-protocol.h"
 
@@ -43,6 +45,8 @@
 static GHashTable *int_hash       = NULL;
 static GHashTable *bool_hash      = NULL;
 static GHashTable *string_hash    = NULL;
+static GHashTable *translated_hash = NULL;
+static MdmConfigSnapshot *snapshot = NULL;
 static gboolean mdm_never_cache   = FALSE;
 static int comm_tries             = 5;
 
@@ -123,6 +127,39 @@ mdm_config_add_hash (GHashTable *hash,
 	g_hash_table_insert (hash, newkey, value);
 }
 
+/**
+ * mdm_config_ensure_snapshot
+ *
+ * Maps the configuration snapshot the daemon publishes, remapping it
+ * if the daemon has written a new one since.  Returns FALSE if there
+ * is no snapshot this code understands.
+ */
+static gboolean
+mdm_config_ensure_snapshot (void)
+{
+	if (snapshot != NULL && mdm_config_snapshot_is_stale (snapshot)) {
+		mdm_config_snapshot_close (snapshot);
+		snapshot = NULL;
+	}
+
+	if (snapshot == NULL) {
+		snapshot = mdm_config_snapshot_open (MDM_CONFIG_SNAPSHOT);
+		if (snapshot != NULL)
+			mdm_common_debug ("Using configuration snapshot %u",
+					  mdm_config_snapshot_get_serial (snapshot));
+	}
+
+	return snapshot != NULL;
+}
+
+/* Keys the daemon can override with a per-display file */
+static gboolean
+mdm_config_is_per_display_key (const gchar *key)
+{
+	return (strncmp (key, "greeter/", strlen ("greeter/")) == 0 ||
+		strncmp (key, "gui/", strlen ("gui/")) == 0);
+}
+
 /**
  * mdm_config_get_result
  *
@@ -144,6 +181,26 @@ mdm_config_get_result (const gchar *key)
 		*p = '\0';
 
 	display = g_strdup (g_getenv ("DISPLAY"));
+
+	/*
+	 * Read it from the snapshot if possible, saving the round trip.
+	 * Per-display values are only taken from it while the display's
+	 * file is unchanged, the daemon only notices edits on lookup.
+	 */
+	if (mdm_config_ensure_snapshot () &&
+	    (! mdm_config_is_per_display_key (newkey) ||
+	     mdm_config_snapshot_display_is_current (snapshot, display))) {
+		const gchar *value;
+
+		value = mdm_config_snapshot_lookup (snapshot, display, newkey, NULL);
+		if (value != NULL) {
+			result = g_strdup_printf ("OK %s", value);
+			g_free (display);
+			g_free (newkey);
+			return result;
+		}
+	}
+
 	if (display == NULL)
 		command = g_strdup_printf ("%s %s", MDM_SUP_GET_CONFIG, newkey);
 	else
@@ -157,6 +214,154 @@ mdm_config_get_result (const gchar *key)
 	return result;
 }
 
+/**
+ * mdm_config_add_bulk_record
+ *
+ * Adds one "<type>:<group/key>=<value>" record of a GET_CONFIG_ALL
+ * reply to the caches.  Keys that are already cached are left alone,
+ * since callers may still hold the strings returned for them.
+ */
+static void
+mdm_config_add_bulk_record (const gchar *record)
+{
+	gchar *key;
+	gchar *value;
+	const gchar *p;
+
+	if (record[0] == '\0' || record[1] != ':')
+		return;
+
+	p = strchr (record + 2, '=');
+	if (p == NULL)
+		return;
+
+	key   = g_strndup (record + 2, p - (record + 2));
+	value = g_strcompress (p + 1);
+
+	if (record[0] == 'i' && g_hash_table_lookup (int_hash, key) == NULL) {
+		gint *intval = g_new0 (gint, 1);
+		*intval      = atoi (value);
+		mdm_config_add_hash (int_hash, key, intval);
+	} else if (record[0] == 'b' && g_hash_table_lookup (bool_hash, key) == NULL) {
+		gboolean *boolval = g_new0 (gboolean, 1);
+		*boolval          = (strcmp (value, "true") == 0);
+		mdm_config_add_hash (bool_hash, key, boolval);
+	}
+
+	if (g_hash_table_lookup (string_hash, key) == NULL)
+		mdm_config_add_hash (string_hash, key, value);
+	else
+		g_free (value);
+
+	g_free (key);
+}
+
+/*
+ * GET_CONFIG_ALL only returns the greeter and gui groups, the other
+ * keys the greeters read are asked for by name with GET_CONFIG_MULTI.
+ */
+static const gchar *prefetch_keys[] = {
+	MDM_GREETER_DAEMON_KEYS,
+	NULL
+};
+
+/*
+ * Sends a GET_CONFIG_ALL or GET_CONFIG_MULTI command and adds the
+ * records in the reply to the caches.
+ */
+static gboolean
+mdm_config_prefetch_command (const gchar *command)
+{
+	gchar  *result;
+	gchar **records;
+	int i;
+
+	result = mdmcomm_send_cmd_to_daemon_with_lines (command, NULL, comm_tries, &records);
+
+	if (records == NULL) {
+		mdm_common_debug ("Could not prefetch configuration, got <%s>",
+				  ve_sure_string (result));
+		g_free (result);
+		return FALSE;
+	}
+
+	for (i = 0; records[i] != NULL; i++)
+		mdm_config_add_bulk_record (records[i]);
+
+	mdm_common_debug ("Prefetched %d configuration keys", i);
+
+	g_strfreev (records);
+	g_free (result);
+
+	return TRUE;
+}
+
+/**
+ * mdm_config_prefetch
+ *
+ * Reads every key in group, which has to be "greeter" or "gui", with
+ * a single GET_CONFIG_ALL command and seeds the caches with the
+ * result.  If group is NULL both groups are read, and the other keys
+ * the greeters use are read with one GET_CONFIG_MULTI.  This way the
+ * mdm_config_get_* calls a greeter makes at startup do not each cost
+ * a round trip.  Nothing needs to be fetched when the daemon publishes
+ * a snapshot.  Returns FALSE if the daemon did not answer, in which
+ * case the getters just fall back to GET_CONFIG.
+ */
+gboolean
+mdm_config_prefetch (const gchar *group)
+{
+	GString *command;
+	const gchar *display;
+	gboolean ret;
+	int i;
+
+	if (mdm_never_cache == TRUE)
+		return FALSE;
+
+	/* Every lookup is already local when there is a snapshot */
+	if (mdm_config_ensure_snapshot ())
+		return TRUE;
+
+	if (string_hash == NULL)
+		string_hash = g_hash_table_new (g_str_hash, g_str_equal);
+	if (int_hash == NULL)
+		int_hash = g_hash_table_new (g_str_hash, g_str_equal);
+	if (bool_hash == NULL)
+		bool_hash = g_hash_table_new (g_str_hash, g_str_equal);
+
+	display = g_getenv ("DISPLAY");
+	if (ve_string_empty (display))
+		display = "-";
+
+	command = g_string_new (NULL);
+	if (group == NULL)
+		g_string_printf (command, "%s %s", MDM_SUP_GET_CONFIG_ALL, display);
+	else
+		g_string_printf (command, "%s %s %s", MDM_SUP_GET_CONFIG_ALL, display, group);
+
+	ret = mdm_config_prefetch_command (command->str);
+
+	if (ret && group == NULL) {
+		g_string_printf (command, "%s %s", MDM_SUP_GET_CONFIG_MULTI, display);
+		for (i = 0; prefetch_keys[i] != NULL; i++) {
+			const gchar *p = strchr (prefetch_keys[i], '=');
+
+			g_string_append_c (command, ' ');
+			if (p != NULL)
+				g_string_append_len (command, prefetch_keys[i], p - prefetch_keys[i]);
+			else
+				g_string_append (command, prefetch_keys[i]);
+		}
+
+		ret = mdm_config_prefetch_command (command->str);
+	}
+
+	g_string_free (command, TRUE);
+
+	return ret;
+}
+
 /**
  * mdm_config_get_string
  *
@@ -249,11 +454,12 @@ mdm_config_get_string (const gchar *key)
  * mdm_config_get_translated_string
  *
  * Gets translated string configuration value from daemon via
- * GET_CONFIG socket command.  It stores the value in a hash so
- * subsequent access is faster.  This does similar logic to
- * ve_config_get_trasnlated_string, requesting the value for 
- * each language and returning the default value if none is
- * found.
+ * GET_CONFIG_TRANSLATED socket command, which picks the best
+ * translation for the current languages in one round trip.  The
+ * value is stored in a hash keyed by key and locale so subsequent
+ * access is faster.  If the daemon does not understand the command,
+ * this falls back to requesting the value for each language with
+ * GET_CONFIG and returning the default value if none is found.
  */ 
 static gchar *
 _mdm_config_get_translated_string (const gchar *key,
@@ -261,18 +467,67 @@ _mdm_config_get_translated_string (const gchar *key,
 				   gboolean *changed)
 {
 	const char * const *langs;
+	GString *command;
+	const gchar *display;
+	gchar *hashkey;
+	gchar *hashretval;
+	gchar *result;
+	gchar *temp;
         char *newkey;
         char *def;
 	int   i;
 
+        if (translated_hash == NULL)
+		translated_hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
 	/* Strip key */
 	newkey = g_strdup (key);
+	g_strstrip (newkey);
 	def    = strchr (newkey, '=');
 	if (def != NULL)
 		*def = '\0';
 
 	langs = g_get_language_names ();
 
+	hashkey = g_strdup_printf ("%s[%s]", newkey, langs[0]);
+	hashretval = g_hash_table_lookup (translated_hash, hashkey);
+
+	if (reload == FALSE && hashretval != NULL) {
+		g_free (hashkey);
+		g_free (newkey);
+		return hashretval;
+	}
+
+	display = g_getenv ("DISPLAY");
+	if (ve_string_empty (display))
+		display = "-";
+
+	command = g_string_new (NULL);
+	g_string_printf (command, "%s %s %s", MDM_SUP_GET_CONFIG_TRANSLATED, display, newkey);
+	for (i = 0; langs[i] != NULL; i++)
+		g_string_append_printf (command, " %s", langs[i]);
+
+	result = mdmcomm_send_cmd_to_daemon_with_args (command->str, NULL, comm_tries);
+	g_string_free (command, TRUE);
+
+	if (result != NULL && strncmp (result, "OK ", 3) == 0) {
+		/* skip the "OK " */
+		temp = g_strdup (result + 3);
+		g_free (result);
+		g_free (newkey);
+
+		if (changed != NULL)
+			*changed = (hashretval == NULL ||
+				    strcmp (hashretval, temp) != 0);
+
+		/* callers may still hold the old value, so it is not freed */
+		g_hash_table_replace (translated_hash, hashkey, temp);
+		return temp;
+	}
+
+	g_free (result);
+	g_free (hashkey);
+
 	for (i = 0; langs[i] != NULL; i++) {
                 gchar *full;
 		gchar *val;
@@ -27,6 +27,7 @@
 
 void		mdm_config_never_cache			(gboolean never_cache);
 void		mdm_config_set_comm_retries		(int tries);
+gboolean	mdm_config_prefetch			(const gchar *group);
 gchar *		mdm_config_get_string			(const gchar *key);
 gchar *		mdm_config_get_translated_string	(const gchar *key);
 gint		mdm_config_get_int     			(const gchar *key);
@@ -57,32 +57,37 @@ GOptionEntry options [] = {
 	{ NULL }
 };
 
-static int
-get_cur_vt (void)
-{
-	char           *result;
-	static int      cur_vt;
-	static gboolean checked = FALSE;
-	char           *ret = NULL;
-
-	result = NULL;
-
-	if (checked) {
-		return cur_vt;
-	}
+static int      cur_vt         = -1;
+static gboolean cur_vt_checked = FALSE;
 
-	ret = mdmcomm_send_cmd_to_daemon_with_args (MDM_SUP_QUERY_VT, auth_cookie, 5);
+/* Remembers the VT from a QUERY_VT reply, returns FALSE if it failed */
+static gboolean
+parse_cur_vt (const char *ret)
+{
 	if (ve_string_empty (ret) || strncmp (ret, "OK ", 3) != 0) {
-		goto out;
+		return FALSE;
 	}
 
 	if (sscanf (ret, "OK %d", &cur_vt) != 1) {
 		cur_vt = -1;
 	}
 
-	checked = TRUE;
+	cur_vt_checked = TRUE;
+
+	return TRUE;
+}
+
+static int
+get_cur_vt (void)
+{
+	char *ret;
+
+	if (cur_vt_checked) {
+		return cur_vt;
+	}
 
- out:
+	ret = mdmcomm_send_cmd_to_daemon_with_args (MDM_SUP_QUERY_VT, auth_cookie, 5);
+	parse_cur_vt (ret);
 	g_free (ret);
 
 	return cur_vt;
@@ -234,17 +239,28 @@ maybe_lock_screen (void)
 static void
 check_for_users (void)
 {
+	const char *commands[] = { MDM_SUP_QUERY_VT, MDM_SUP_ATTACHED_SERVERS };
+	char **replies;
 	char *result_string;
 	char **servers;
 	int i;
 
+	if (auth_cookie == NULL) {
+		return;
+	}
+
+	// Ask for the current VT and the running servers in one round trip
+	replies = mdmcomm_send_cmds_to_daemon (commands, G_N_ELEMENTS (commands), auth_cookie);
+	parse_cur_vt (replies[0]);
+	g_free (replies[0]);
+	result_string = replies[1];
+	g_free (replies);
+
 	// Return if we're not on a VT
-	if (auth_cookie == NULL || get_cur_vt () < 0) {
+	if (get_cur_vt () < 0) {
+		g_free (result_string);
 		return;
 	}
-		
-    // Get the list of running servers from the daemon
-	result_string = mdmcomm_send_cmd_to_daemon_with_args (MDM_SUP_ATTACHED_SERVERS, auth_cookie, 5);
 
 	// Return if the daemon didn't send us the list
 	if (ve_string_empty (result_string) || strncmp (result_string, "OK ", 3) != 0) {
@@ -1379,35 +1379,74 @@ process_operation (guchar       op_code,
 }
 
 
+static void
+mdm_login_browser_set_row (GtkTreeIter *iter, MdmUser *usr)
+{
+    char *label;
+    char *login, *gecos;
+
+    login = mdm_common_text_to_escaped_utf8 (usr->login);
+    gecos = mdm_common_text_to_escaped_utf8 (usr->gecos);
+
+    label = g_strdup_printf ("<b>%s</b>\n%s",
+			     login,
+			     gecos);
+
+    g_free (login);
+    g_free (gecos);
+    gtk_list_store_set (GTK_LIST_STORE (browser_model), iter,
+			GREETER_ULIST_ICON_COLUMN, usr->picture,
+			GREETER_ULIST_LOGIN_COLUMN, usr->login,
+			GREETER_ULIST_LABEL_COLUMN, label,
+			-1);
+    g_free (label);
+}
+
 static void
 mdm_login_browser_populate (void)
 {
     GList *li;
 
     for (li = users; li != NULL; li = li->next) {
-	    MdmUser *usr = li->data;
 	    GtkTreeIter iter = {0};
-	    char *label;
-	    char *login, *gecos;
 
-	    login = mdm_common_text_to_escaped_utf8 (usr->login);
-	    gecos = mdm_common_text_to_escaped_utf8 (usr->gecos);
+	    gtk_list_store_append (GTK_LIST_STORE (browser_model), &iter);
+	    mdm_login_browser_set_row (&iter, li->data);
+    }
+    return;
+}
+
+/* The user list was refreshed in the background */
+static void
+mdm_login_browser_user_changed (MdmUser *usr, gboolean removed, gpointer data)
+{
+    GtkTreeIter iter = {0};
+    gboolean valid;
+
+    if (browser_model == NULL)
+	    return;
+
+    if ( ! removed) {
+	    gtk_list_store_insert (GTK_LIST_STORE (browser_model), &iter,
+				   g_list_index (users, usr));
+	    mdm_login_browser_set_row (&iter, usr);
+	    return;
+    }
 
-	    label = g_strdup_printf ("<b>%s</b>\n%s",
-				     login,
-				     gecos);
+    valid = gtk_tree_model_get_iter_first (browser_model, &iter);
+    while (valid) {
+	    char *login = NULL;
 
+	    gtk_tree_model_get (browser_model, &iter,
+				GREETER_ULIST_LOGIN_COLUMN, &login, -1);
+	    if (login != NULL && strcmp (login, usr->login) == 0) {
+		    g_free (login);
+		    gtk_list_store_remove (GTK_LIST_STORE (browser_model), &iter);
+		    return;
+	    }
 	    g_free (login);
-	    g_free (gecos);
-	    gtk_list_store_append (GTK_LIST_STORE (browser_model), &iter);
-	    gtk_list_store_set (GTK_LIST_STORE (browser_model), &iter,
-				GREETER_ULIST_ICON_COLUMN, usr->picture,
-				GREETER_ULIST_LOGIN_COLUMN, usr->login,
-				GREETER_ULIST_LABEL_COLUMN, label,
-				-1);
-	    g_free (label);
+	    valid = gtk_tree_model_iter_next (browser_model, &iter);
     }
-    return;
 }
 
 static void
@@ -2196,6 +2235,12 @@ mdm_read_config (void)
 		
 	mdmcomm_open_connection_to_daemon ();
 
+	/*
+	 * Seed the caches with a single GET_CONFIG_ALL, so the reads
+	 * below only go to the daemon for keys it did not return.
+	 */
+	mdm_config_prefetch (NULL);
+
 	/*
 	 * Read all the keys at once and close sockets connection so we do
 	 * not have to keep the socket open. 
@@ -2233,6 +2278,8 @@ mdm_read_config (void)
 	mdm_config_get_int    (MDM_KEY_MAX_ICON_HEIGHT);
 	mdm_config_get_int    (MDM_KEY_MAX_ICON_WIDTH);
 	mdm_config_get_int    (MDM_KEY_MINIMAL_UID);
+	mdm_config_get_int    (MDM_KEY_MAX_USERS);
+	mdm_config_get_int    (MDM_KEY_USER_LIST_CACHE_TTL);
 	mdm_config_get_int    (MDM_KEY_TIMED_LOGIN_DELAY);
 	mdm_config_get_string    (MDM_KEY_PRIMARY_MONITOR);
 
@@ -2296,6 +2343,8 @@ mdm_reread_config (int sig, gpointer data)
 	    mdm_config_reload_int    (MDM_KEY_MAX_ICON_WIDTH) ||
 	    mdm_config_reload_int    (MDM_KEY_MAX_ICON_HEIGHT) ||
 	    mdm_config_reload_int    (MDM_KEY_MINIMAL_UID) ||
+	    mdm_config_reload_int    (MDM_KEY_MAX_USERS) ||
+	    mdm_config_reload_int    (MDM_KEY_USER_LIST_CACHE_TTL) ||
 	    mdm_config_reload_int    (MDM_KEY_TIMED_LOGIN_DELAY) ||
 	    mdm_config_reload_string    (MDM_KEY_PRIMARY_MONITOR) ||
 
@@ -2427,6 +2476,7 @@ main (int argc, char *argv[])
 
     if (mdm_config_get_bool (MDM_KEY_BROWSER)) {
 		mdm_login_browser_populate ();
+		mdm_users_set_changed_func (mdm_login_browser_user_changed, NULL);
 	}
 
     ve_signal_add (SIGHUP, mdm_reread_config, NULL);
@@ -26,9 +26,14 @@
 #include <glib/gi18n.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include <pwd.h>
 
+#include <glib/gstdio.h>
+
 #include "mdm.h"
 #include "mdm-common.h"
 #include "mdmcommon.h"
@@ -38,53 +43,19 @@
 #include "mdm-socket-protocol.h"
 #include "mdm-daemon-config-keys.h"
 
-static time_t time_started;
+static char *mdm_user_cache_save_face (MdmUser *user, GdkPixbuf *img);
 
-static MdmUser * 
-mdm_user_alloc (const gchar *logname,
-		uid_t uid,
-		const gchar *homedir,
-		const char *gecos,
-		GdkPixbuf *defface,
-		gboolean read_faces)
+/*
+ * Asks the slave for the face of user.  The slave sends MDM_NEEDPIC
+ * when it is ready for a login, and answers it with MDM_READPIC.
+ */
+static void
+mdm_user_ask_face (MdmUser *user)
 {
-	MdmUser *user;
 	GdkPixbuf *img = NULL;
 	gchar buf[PIPE_SIZE];
 	size_t size;
 	int bufsize;
-	char *p;
-
-	user = g_new0 (MdmUser, 1);
-
-	user->uid = uid;
-	user->login = g_strdup (logname);
-	if (!g_utf8_validate (gecos, -1, NULL))
-		user->gecos = ve_locale_to_utf8 (gecos);
-	else
-		user->gecos = g_strdup (gecos);
-
-	/* Cut up to first comma since those are ugly arguments and
-	 * not the name anymore, but only if more then 1 comma is found,
-	 * since otherwise it might be part of the actual comment,
-	 * this is sort of "heurestic" because there seems to be no
-	 * real standard, it's all optional */
-	p = strchr (user->gecos, ',');
-	if (p != NULL) {
-		if (strchr (p+1, ',') != NULL)
-			*p = '\0';
-	}
-
-	user->homedir = g_strdup (homedir);
-	if (defface != NULL)
-		user->picture = (GdkPixbuf *)g_object_ref (G_OBJECT (defface));
-
-	if (ve_string_empty (logname))
-		return user;
-
-	/* don't read faces, since that requires the daemon */
-	if (!read_faces)
-		return user;
 
 	/* read initial request */
 	do {
@@ -93,10 +64,10 @@ mdm_user_alloc (const gchar *logname,
 				break;
 		size = read (STDIN_FILENO, buf, sizeof (buf));
 		if (size <= 0)
-			return user;
+			return;
 	} while (buf[0] != MDM_NEEDPIC);
 
-	printf ("%c%s\n", STX, logname);
+	printf ("%c%s\n", STX, user->login);
 	fflush (stdout);
 
 	do {
@@ -105,12 +76,15 @@ mdm_user_alloc (const gchar *logname,
 				break;
 		size = read (STDIN_FILENO, buf, sizeof (buf));
 		if (size <= 0)
-			return user;
+			return;
 	} while (buf[0] != MDM_READPIC);
 
 	/* both nul terminate and wipe the trailing \n */
 	buf[size-1] = '\0';
 
+	g_free (user->facefile);
+	user->facefile = NULL;
+
 	if (size < 2) {
 		img = NULL;
 	} else if (sscanf (&buf[1], "buffer:%d", &bufsize) == 1) {
@@ -153,11 +127,17 @@ mdm_user_alloc (const gchar *logname,
 
 		/* read the "done" bit, but don't check */
 		read (STDIN_FILENO, buf, sizeof (buf));
+
+		/* the face is in the user's home, keep a copy we can read */
+		if (img != NULL)
+			user->facefile = mdm_user_cache_save_face (user, img);
 	} else if (g_access (&buf[1], R_OK) == 0) {
 		img = mdm_common_get_face (&buf[1],
 					   NULL,
 					   mdm_config_get_int (MDM_KEY_MAX_ICON_WIDTH),
 					   mdm_config_get_int (MDM_KEY_MAX_ICON_HEIGHT));
+		if (img != NULL)
+			user->facefile = g_strdup (&buf[1]);
 	} else {
 		img = NULL;
 	}
@@ -166,133 +146,813 @@ mdm_user_alloc (const gchar *logname,
 	printf ("%c\n", STX);
 	fflush (stdout);
 
+	/* a face we could not keep is asked for again next time */
+	user->face_known = (img == NULL || user->facefile != NULL);
+	user->face_time = time (NULL);
+
 	if (img != NULL) {
 		if (user->picture != NULL)
 			g_object_unref (G_OBJECT (user->picture));
 
 		user->picture = img;
 	}
+}
+
+static MdmUser * 
+mdm_user_alloc (const gchar *logname,
+		uid_t uid,
+		const gchar *homedir,
+		const char *gecos,
+		GdkPixbuf *defface,
+		gboolean read_faces)
+{
+	MdmUser *user;
+	char *p;
+
+	user = g_new0 (MdmUser, 1);
+
+	user->uid = uid;
+	user->login = g_strdup (logname);
+	if (!g_utf8_validate (gecos, -1, NULL))
+		user->gecos = ve_locale_to_utf8 (gecos);
+	else
+		user->gecos = g_strdup (gecos);
+
+	/* Cut up to first comma since those are ugly arguments and
+	 * not the name anymore, but only if more then 1 comma is found,
+	 * since otherwise it might be part of the actual comment,
+	 * this is sort of "heurestic" because there seems to be no
+	 * real standard, it's all optional */
+	p = strchr (user->gecos, ',');
+	if (p != NULL) {
+		if (strchr (p+1, ',') != NULL)
+			*p = '\0';
+	}
+
+	user->homedir = g_strdup (homedir);
+	if (defface != NULL)
+		user->picture = (GdkPixbuf *)g_object_ref (G_OBJECT (defface));
+
+	/* don't read faces, since that requires the daemon */
+	if (read_faces && ! ve_string_empty (logname))
+		mdm_user_ask_face (user);
 
 	return user;
 }
 
+/* State for one pass over the user database */
+typedef struct {
+	GHashTable *shells;	/* from /etc/shells, read once */
+	GHashTable *excludes;	/* case-insensitive */
+	GHashTable *seen;	/* logins already listed */
+	GPtrArray  *users;	/* sorted once at the end */
+	char      **includes;
+	char      **exclude_list;
+	gboolean    found_include;
+	const char *exclude_user;
+	GdkPixbuf  *defface;
+	gboolean    read_faces;
+	gboolean    allow_root;
+	int         minimal_uid;
+	int         max_users;
+	time_t      time_started;
+	int         time_limit;	/* seconds, 0 for none */
+} MdmUserScan;
+
+static guint
+mdm_str_case_hash (gconstpointer key)
+{
+	const char *p;
+	guint h = 5381;
+
+	for (p = key; *p != '\0'; p++)
+		h = (h << 5) + h + g_ascii_tolower (*p);
+
+	return h;
+}
+
 static gboolean
-mdm_check_exclude (struct passwd *pwent, char **excludes, gboolean is_local)
+mdm_str_case_equal (gconstpointer a, gconstpointer b)
 {
-	const char * const lockout_passes[] = { "!!", NULL };
-	gint i;
+	return (g_ascii_strcasecmp (a, b) == 0);
+}
+
+static GHashTable *
+mdm_read_shells (void)
+{
+	GHashTable *shells;
+	gchar *csh;
+
+	shells = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
-        if ( ! mdm_config_get_bool (MDM_KEY_ALLOW_ROOT) && pwent->pw_uid == 0)
-                return TRUE;       
+	setusershell ();
+	while ((csh = getusershell ()) != NULL)
+		g_hash_table_insert (shells, g_strdup (csh), GINT_TO_POINTER (1));
+	endusershell ();
 
-	if (pwent->pw_uid < mdm_config_get_int (MDM_KEY_MINIMAL_UID))
+	return shells;
+}
+
+static gboolean
+mdm_check_exclude (MdmUserScan *scan, struct passwd *pwent)
+{
+	if ( ! scan->allow_root && pwent->pw_uid == 0)
 		return TRUE;
 
-	for (i=0 ; lockout_passes[i] != NULL ; i++)  {
-		if (strcmp (lockout_passes[i], pwent->pw_passwd) == 0) {
-			return TRUE;
-		}
-	}
+	if (pwent->pw_uid < scan->minimal_uid)
+		return TRUE;
 
-	if (excludes != NULL) {
-		for (i=0 ; excludes[i] != NULL ; i++)  {
-			if (g_ascii_strcasecmp (excludes[i],
-						pwent->pw_name) == 0) {
-				return TRUE;
-			}
-		}
-	}
+	/* locked out */
+	if (pwent->pw_passwd != NULL && strcmp (pwent->pw_passwd, "!!") == 0)
+		return TRUE;
 
-	return FALSE;
+	return (g_hash_table_lookup (scan->excludes, pwent->pw_name) != NULL);
 }
 
 static gboolean
-mdm_check_shell (const gchar *usersh)
+mdm_check_shell (MdmUserScan *scan, const gchar *usersh)
 {
-    gint found = 0;
-    gchar *csh;
-
     if (strcmp (usersh, NOLOGIN) == 0 ||
 	strcmp (usersh, "/bin/true") == 0 ||
 	strcmp (usersh, "/bin/false") == 0) {
-      return 0;
+      return FALSE;
     }
 
-    setusershell ();
-
-    while ((csh = getusershell ()) != NULL)
-        if (! strcmp (csh, usersh))
-            found = 1;
+    return (g_hash_table_lookup (scan->shells, usersh) != NULL);
+}
 
-    endusershell ();
+static gint
+mdm_user_compare (gconstpointer d1, gconstpointer d2)
+{
+    const MdmUser *a = d1;
+    const MdmUser *b = d2;
 
-    return (found);
+    return (strcmp (a->login, b->login));
 }
 
 static gint
-mdm_sort_func (gpointer d1, gpointer d2)
+mdm_sort_func (gconstpointer d1, gconstpointer d2)
 {
-    MdmUser *a = d1;
-    MdmUser *b = d2;
+    return mdm_user_compare (*(MdmUser * const *)d1, *(MdmUser * const *)d2);
+}
 
-    if (!d1 || !d2)
-        return (0);
+static gboolean
+mdm_user_same (const MdmUser *a, const MdmUser *b)
+{
+    return (a->uid == b->uid &&
+	    strcmp (a->login, b->login) == 0 &&
+	    strcmp (a->gecos, b->gecos) == 0 &&
+	    strcmp (ve_sure_string (a->homedir), ve_sure_string (b->homedir)) == 0);
+}
 
-    return (strcmp (a->login, b->login));
+static void
+mdm_user_free (MdmUser *user)
+{
+    if (user->picture != NULL)
+	    g_object_unref (G_OBJECT (user->picture));
+    g_free (user->login);
+    g_free (user->homedir);
+    g_free (user->gecos);
+    g_free (user->facefile);
+    g_free (user);
+}
+
+static void
+mdm_user_scan_begin (MdmUserScan *scan,
+		     const char *exclude_user,
+		     GdkPixbuf *defface,
+		     gboolean read_faces)
+{
+    int i;
+
+    memset (scan, 0, sizeof (MdmUserScan));
+    scan->exclude_user = ve_string_empty (exclude_user) ? NULL : exclude_user;
+    scan->defface = defface;
+    scan->read_faces = read_faces;
+    scan->allow_root = mdm_config_get_bool (MDM_KEY_ALLOW_ROOT);
+    scan->minimal_uid = mdm_config_get_int (MDM_KEY_MINIMAL_UID);
+    scan->max_users = mdm_config_get_int (MDM_KEY_MAX_USERS);
+    scan->time_started = time (NULL);
+    scan->time_limit = 5;
+
+    scan->shells = mdm_read_shells ();
+    scan->excludes = g_hash_table_new (mdm_str_case_hash, mdm_str_case_equal);
+    scan->seen = g_hash_table_new (g_str_hash, g_str_equal);
+    scan->users = g_ptr_array_new ();
+
+    scan->includes = g_strsplit (mdm_config_get_string (MDM_KEY_INCLUDE), ",", 0);
+    for (i=0 ; scan->includes != NULL && scan->includes[i] != NULL ; i++) {
+	g_strstrip (scan->includes[i]);
+        if (scan->includes[i] != NULL)
+           scan->found_include = TRUE;
+    }
+
+    scan->exclude_list = g_strsplit (mdm_config_get_string (MDM_KEY_EXCLUDE), ",", 0);
+    for (i=0 ; scan->exclude_list != NULL && scan->exclude_list[i] != NULL ; i++) {
+	g_strstrip (scan->exclude_list[i]);
+	g_hash_table_insert (scan->excludes, scan->exclude_list[i], scan->exclude_list[i]);
+    }
 }
 
+/* Frees the scan, but not the users it found */
+static void
+mdm_user_scan_end (MdmUserScan *scan)
+{
+    g_ptr_array_free (scan->users, TRUE);
+    g_hash_table_destroy (scan->seen);
+    g_hash_table_destroy (scan->excludes);
+    g_hash_table_destroy (scan->shells);
+    g_strfreev (scan->includes);
+    g_strfreev (scan->exclude_list);
+}
+
+static void
+mdm_user_scan_add (MdmUserScan *scan, MdmUser *user)
+{
+    g_ptr_array_add (scan->users, user);
+    g_hash_table_insert (scan->seen, user->login, user);
+}
 
 static gboolean
-setup_user (struct passwd *pwent,
-	    GList **users,
-	    GList **users_string,
-	    char **excludes,
-	    char *exclude_user,
-	    GdkPixbuf *defface,
-	    int *size_of_users,
-	    gboolean is_local,
-	    gboolean read_faces)
+setup_user (MdmUserScan *scan, struct passwd *pwent)
 {
     MdmUser *user;
-    int cnt = 0;
-
-    if (pwent->pw_shell && 
-	mdm_check_shell (pwent->pw_shell) &&
-	!mdm_check_exclude (pwent, excludes, is_local) &&
-	(exclude_user == NULL ||
-	strcmp (ve_sure_string (exclude_user), pwent->pw_name)) != 0) {
-
-	    user = mdm_user_alloc (pwent->pw_name,
-				   pwent->pw_uid,
-				   pwent->pw_dir,
-				   ve_sure_string (pwent->pw_gecos),
-				   defface, read_faces);
-
-	    if ((user) &&
-		(! g_list_find_custom (*users, user, (GCompareFunc) mdm_sort_func))) {
-		cnt++;
-		*users = g_list_insert_sorted (*users, user,
-		     (GCompareFunc) mdm_sort_func);
-		*users_string = g_list_prepend (*users_string, g_strdup (pwent->pw_name));
-
-		if (user->picture != NULL) {
-			*size_of_users +=
-				gdk_pixbuf_get_height (user->picture) + 2;
-		} else {
-			*size_of_users += mdm_config_get_int (MDM_KEY_MAX_ICON_HEIGHT);
-		}
-	    }
 
-	    if (cnt > 1000 || time_started + 5 <= time (NULL)) {
-		*users = g_list_append (*users,
-			g_strdup (_("Too many users to list here...")));
-		*users_string = g_list_append (*users_string,
-			g_strdup (_("Too many users to list here...")));
+    if (pwent->pw_shell == NULL || pwent->pw_name == NULL ||
+	g_hash_table_lookup (scan->seen, pwent->pw_name) != NULL ||
+	! mdm_check_shell (scan, pwent->pw_shell) ||
+	mdm_check_exclude (scan, pwent) ||
+	(scan->exclude_user != NULL &&
+	 strcmp (scan->exclude_user, pwent->pw_name) == 0))
+	    return TRUE;
+
+    if ((scan->max_users > 0 && scan->users->len >= (guint) scan->max_users) ||
+	(scan->time_limit > 0 &&
+	 scan->time_started + scan->time_limit <= time (NULL))) {
+	    mdm_common_warning ("Too many users to list, stopped at %d",
+				scan->users->len);
+	    return FALSE;
+    }
 
-		return (FALSE);
+    user = mdm_user_alloc (pwent->pw_name,
+			   pwent->pw_uid,
+			   pwent->pw_dir,
+			   ve_sure_string (pwent->pw_gecos),
+			   scan->defface, scan->read_faces);
+    if (user != NULL)
+	    mdm_user_scan_add (scan, user);
+
+    return TRUE;
+}
+
+static void
+mdm_user_scan_enumerate (MdmUserScan *scan)
+{
+    struct passwd *pwent;
+    int i;
+
+    if (mdm_config_get_bool (MDM_KEY_INCLUDE_ALL) == TRUE) {
+	    setpwent ();
+	    while ((pwent = getpwent ()) != NULL) {
+		if (! setup_user (scan, pwent))
+			break;
 	    }
+	    endpwent ();
+
+    } else if (scan->found_include == TRUE) {
+	for (i=0 ; scan->includes != NULL && scan->includes[i] != NULL ; i++) {
+		pwent = getpwnam (scan->includes[i]);
+
+		if (pwent != NULL && ! setup_user (scan, pwent))
+			break;
+	}
     }
-    return (TRUE);
+}
+
+/*
+ * The user list cache.  Enumerating a big directory, and asking the
+ * slave for every face, takes a while, and the list rarely changes.
+ * So the greeter keeps the last list in ServAuthDir and shows that
+ * right away, then lists the users again in a child process and
+ * applies whatever changed once the child is done.
+ *
+ * The file is a header, the records sorted by login and a block of
+ * NUL terminated strings the records point into, all in host byte
+ * order.  It is thrown away when /etc/passwd, /etc/shells or the
+ * settings deciding who is listed change, and after UserListCacheTTL
+ * seconds, which is what catches changes in a network directory.
+ * Faces that came as a buffer from the user's home are kept as PNGs
+ * next to it.  Each face is asked for again once it is older than
+ * UserListCacheTTL, the background refresh keeps the time it was
+ * asked for rather than restamping it.
+ */
+#define MDM_USER_CACHE_MAGIC      0x554d444d /* "MDMU" */
+#define MDM_USER_CACHE_VERSION    2
+#define MDM_USER_CACHE_FACE_KNOWN 1
+
+typedef struct {
+	guint32 magic;
+	guint32 version;
+	guint32 config_hash;
+	guint32 n_records;
+	gint64  passwd_mtime;
+	gint64  shells_mtime;
+	gint64  written;
+	guint32 strings_offset;
+	guint32 strings_size;
+} MdmUserCacheHeader;
+
+typedef struct {
+	guint32 login;		/* offsets into the string block */
+	guint32 gecos;
+	guint32 homedir;
+	guint32 facefile;
+	guint32 uid;
+	guint32 flags;
+	gint64  face_time;
+} MdmUserCacheRecord;
+
+typedef struct {
+	gint64  passwd_mtime;
+	gint64  shells_mtime;
+	guint32 config_hash;
+} MdmUserCacheStamp;
+
+static char *user_cache_file = NULL;
+static char *user_cache_faces = NULL;
+
+/* where to apply the background refresh */
+static GList **refresh_users = NULL;
+static GList **refresh_users_string = NULL;
+static int *refresh_size_of_users = NULL;
+static char *refresh_exclude_user = NULL;
+static GdkPixbuf *refresh_defface = NULL;
+static pid_t refresh_pid = -1;
+static MdmUsersChangedFunc users_changed_func = NULL;
+static gpointer users_changed_data = NULL;
+
+static void
+mdm_user_cache_stamp (MdmUserCacheStamp *stamp)
+{
+	struct stat s;
+	char *config;
+
+	memset (stamp, 0, sizeof (MdmUserCacheStamp));
+
+	if (g_stat ("/etc/passwd", &s) == 0)
+		stamp->passwd_mtime = s.st_mtime;
+	if (g_stat ("/etc/shells", &s) == 0)
+		stamp->shells_mtime = s.st_mtime;
+
+	config = g_strdup_printf ("%s|%s|%d|%d|%d|%d",
+				  mdm_config_get_string (MDM_KEY_INCLUDE),
+				  mdm_config_get_string (MDM_KEY_EXCLUDE),
+				  mdm_config_get_bool (MDM_KEY_INCLUDE_ALL),
+				  mdm_config_get_bool (MDM_KEY_ALLOW_ROOT),
+				  mdm_config_get_int (MDM_KEY_MINIMAL_UID),
+				  mdm_config_get_int (MDM_KEY_MAX_USERS));
+	stamp->config_hash = g_str_hash (config);
+	g_free (config);
+}
+
+static char *
+mdm_user_cache_save_face (MdmUser *user, GdkPixbuf *img)
+{
+	char *base;
+	char *filename;
+
+	if (user_cache_faces == NULL)
+		return NULL;
+
+	if (g_mkdir (user_cache_faces, 0700) != 0 && errno != EEXIST)
+		return NULL;
+
+	base = g_strdup_printf ("%u.png", (guint) user->uid);
+	filename = g_build_filename (user_cache_faces, base, NULL);
+	g_free (base);
+
+	if ( ! gdk_pixbuf_save (img, filename, "png", NULL, NULL)) {
+		g_free (filename);
+		return NULL;
+	}
+
+	return filename;
+}
+
+static void
+mdm_user_cache_load_face (MdmUser *user)
+{
+	GdkPixbuf *img;
+
+	if ( ! user->face_known || user->facefile == NULL)
+		return;
+
+	img = mdm_common_get_face (user->facefile,
+				   NULL,
+				   mdm_config_get_int (MDM_KEY_MAX_ICON_WIDTH),
+				   mdm_config_get_int (MDM_KEY_MAX_ICON_HEIGHT));
+	if (img == NULL) {
+		/* gone, ask again next time */
+		user->face_known = FALSE;
+		return;
+	}
+
+	if (user->picture != NULL)
+		g_object_unref (G_OBJECT (user->picture));
+	user->picture = img;
+}
+
+static guint32
+mdm_user_cache_add_string (GString *strings, const char *str)
+{
+	guint32 offset;
+
+	if (ve_string_empty (str))
+		return 0;
+
+	offset = strings->len;
+	g_string_append_len (strings, str, strlen (str) + 1);
+
+	return offset;
+}
+
+static void
+mdm_user_cache_write (const MdmUserCacheStamp *stamp, GPtrArray *users)
+{
+	MdmUserCacheHeader  header;
+	MdmUserCacheRecord *records;
+	GString            *strings;
+	GString            *contents;
+	GError             *error = NULL;
+	guint               i;
+
+	strings = g_string_new (NULL);
+	records = g_new0 (MdmUserCacheRecord, MAX (users->len, 1));
+
+	/* offset 0 is the empty string */
+	g_string_append_c (strings, '\0');
+
+	for (i = 0; i < users->len; i++) {
+		MdmUser *user = g_ptr_array_index (users, i);
+
+		records[i].login = mdm_user_cache_add_string (strings, user->login);
+		records[i].gecos = mdm_user_cache_add_string (strings, user->gecos);
+		records[i].homedir = mdm_user_cache_add_string (strings, user->homedir);
+		records[i].facefile = mdm_user_cache_add_string (strings, user->facefile);
+		records[i].uid = user->uid;
+		records[i].flags = user->face_known ? MDM_USER_CACHE_FACE_KNOWN : 0;
+		records[i].face_time = user->face_time;
+	}
+
+	memset (&header, 0, sizeof (header));
+	header.magic = MDM_USER_CACHE_MAGIC;
+	header.version = MDM_USER_CACHE_VERSION;
+	header.config_hash = stamp->config_hash;
+	header.n_records = users->len;
+	header.passwd_mtime = stamp->passwd_mtime;
+	header.shells_mtime = stamp->shells_mtime;
+	header.written = time (NULL);
+	header.strings_offset = sizeof (header) + users->len * sizeof (MdmUserCacheRecord);
+	header.strings_size = strings->len;
+
+	contents = g_string_sized_new (header.strings_offset + strings->len);
+	g_string_append_len (contents, (const char *)&header, sizeof (header));
+	g_string_append_len (contents, (const char *)records,
+			     users->len * sizeof (MdmUserCacheRecord));
+	g_string_append_len (contents, strings->str, strings->len);
+
+	/* replaced atomically, another greeter may be reading it */
+	if (g_file_set_contents (user_cache_file, contents->str, contents->len, &error)) {
+		g_chmod (user_cache_file, 0600);
+	} else {
+		mdm_common_debug ("Could not write user list cache: %s", error->message);
+		g_error_free (error);
+	}
+
+	g_string_free (contents, TRUE);
+	g_string_free (strings, TRUE);
+	g_free (records);
+}
+
+static gboolean
+mdm_user_cache_is_valid (const char *contents, gsize length)
+{
+	const MdmUserCacheHeader *header;
+	const MdmUserCacheRecord *records;
+	guint32                   i;
+
+	if (length < sizeof (MdmUserCacheHeader))
+		return FALSE;
+
+	header = (const MdmUserCacheHeader *)contents;
+	if (header->magic != MDM_USER_CACHE_MAGIC ||
+	    header->version != MDM_USER_CACHE_VERSION)
+		return FALSE;
+
+	if (header->n_records > (length - sizeof (MdmUserCacheHeader)) / sizeof (MdmUserCacheRecord) ||
+	    header->strings_offset != sizeof (MdmUserCacheHeader) + header->n_records * sizeof (MdmUserCacheRecord) ||
+	    header->strings_size == 0 ||
+	    header->strings_size > length - header->strings_offset ||
+	    contents[header->strings_offset + header->strings_size - 1] != '\0')
+		return FALSE;
+
+	records = (const MdmUserCacheRecord *)(contents + sizeof (MdmUserCacheHeader));
+	for (i = 0; i < header->n_records; i++) {
+		if (records[i].login >= header->strings_size ||
+		    records[i].gecos >= header->strings_size ||
+		    records[i].homedir >= header->strings_size ||
+		    records[i].facefile >= header->strings_size)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Adds the users in the cache to the scan, if the cache is still good.
+ * Their faces are only loaded, or asked for, if the scan reads faces.
+ */
+static gboolean
+mdm_user_cache_load (MdmUserScan *scan)
+{
+	const MdmUserCacheHeader *header;
+	const MdmUserCacheRecord *records;
+	const char               *strings;
+	const char               *contents;
+	MdmUserCacheStamp         stamp;
+	GMappedFile              *file;
+	time_t                    now;
+	int                       ttl;
+	guint32                   i;
+
+	file = g_mapped_file_new (user_cache_file, FALSE, NULL);
+	if (file == NULL)
+		return FALSE;
+
+	contents = g_mapped_file_get_contents (file);
+	if (contents == NULL ||
+	    ! mdm_user_cache_is_valid (contents, g_mapped_file_get_length (file))) {
+		g_mapped_file_unref (file);
+		return FALSE;
+	}
+
+	header = (const MdmUserCacheHeader *)contents;
+	records = (const MdmUserCacheRecord *)(contents + sizeof (MdmUserCacheHeader));
+	strings = contents + header->strings_offset;
+
+	mdm_user_cache_stamp (&stamp);
+	now = time (NULL);
+	ttl = mdm_config_get_int (MDM_KEY_USER_LIST_CACHE_TTL);
+
+	if (header->passwd_mtime != stamp.passwd_mtime ||
+	    header->shells_mtime != stamp.shells_mtime ||
+	    header->config_hash != stamp.config_hash ||
+	    header->written > now ||
+	    now - header->written >= ttl) {
+		mdm_common_debug ("User list cache %s is out of date", user_cache_file);
+		g_mapped_file_unref (file);
+		return FALSE;
+	}
+
+	for (i = 0; i < header->n_records; i++) {
+		const char *login = strings + records[i].login;
+		MdmUser *user;
+
+		if (g_hash_table_lookup (scan->seen, login) != NULL ||
+		    (scan->exclude_user != NULL &&
+		     strcmp (scan->exclude_user, login) == 0))
+			continue;
+
+		user = mdm_user_alloc (login,
+				       records[i].uid,
+				       strings + records[i].homedir,
+				       strings + records[i].gecos,
+				       scan->defface, FALSE);
+		user->face_known = (records[i].flags & MDM_USER_CACHE_FACE_KNOWN) != 0;
+		user->face_time = records[i].face_time;
+		if (records[i].facefile != 0)
+			user->facefile = g_strdup (strings + records[i].facefile);
+
+		/* the face may have changed in the user's home */
+		if (user->face_time > now ||
+		    now - user->face_time >= ttl)
+			user->face_known = FALSE;
+
+		if (scan->read_faces) {
+			if (user->face_known)
+				mdm_user_cache_load_face (user);
+			else
+				mdm_user_ask_face (user);
+		}
+
+		mdm_user_scan_add (scan, user);
+	}
+
+	mdm_common_debug ("Read %u users from %s", header->n_records, user_cache_file);
+
+	g_mapped_file_unref (file);
+	return TRUE;
+}
+
+static void
+mdm_users_add_size (int *size_of_users, MdmUser *user, int sign)
+{
+	if (user->picture != NULL)
+		*size_of_users += sign * (gdk_pixbuf_get_height (user->picture) + 2);
+	else
+		*size_of_users += sign * mdm_config_get_int (MDM_KEY_MAX_ICON_HEIGHT);
+}
+
+static void
+mdm_users_refresh_remove (MdmUser *user)
+{
+	GList *li;
+
+	*refresh_users = g_list_remove (*refresh_users, user);
+
+	li = g_list_find_custom (*refresh_users_string, user->login,
+				 (GCompareFunc) strcmp);
+	if (li != NULL) {
+		g_free (li->data);
+		*refresh_users_string = g_list_delete_link (*refresh_users_string, li);
+	}
+
+	mdm_users_add_size (refresh_size_of_users, user, -1);
+
+	if (users_changed_func != NULL)
+		(*users_changed_func) (user, TRUE, users_changed_data);
+
+	mdm_user_free (user);
+}
+
+static void
+mdm_users_refresh_add (MdmUser *user)
+{
+	mdm_user_cache_load_face (user);
+
+	*refresh_users = g_list_insert_sorted (*refresh_users, user, mdm_user_compare);
+	*refresh_users_string = g_list_prepend (*refresh_users_string,
+						g_strdup (user->login));
+	mdm_users_add_size (refresh_size_of_users, user, 1);
+
+	if (users_changed_func != NULL)
+		(*users_changed_func) (user, FALSE, users_changed_data);
+}
+
+/* Applies the difference between the listed users and the fresh cache */
+static void
+mdm_users_refresh_apply (void)
+{
+	MdmUserScan scan;
+	GHashTable *old;
+	GList *li, *next;
+	guint i, added = 0, removed = 0;
+
+	mdm_user_scan_begin (&scan, refresh_exclude_user, refresh_defface, FALSE);
+	if ( ! mdm_user_cache_load (&scan)) {
+		mdm_user_scan_end (&scan);
+		return;
+	}
+
+	old = g_hash_table_new (g_str_hash, g_str_equal);
+	for (li = *refresh_users; li != NULL; li = li->next) {
+		MdmUser *user = li->data;
+		g_hash_table_insert (old, user->login, user);
+	}
+
+	/* gone, or changed and added back below */
+	for (li = *refresh_users; li != NULL; li = next) {
+		MdmUser *user = li->data;
+		MdmUser *fresh = g_hash_table_lookup (scan.seen, user->login);
+
+		next = li->next;
+		if (fresh != NULL && mdm_user_same (user, fresh))
+			continue;
+
+		g_hash_table_remove (old, user->login);
+		mdm_users_refresh_remove (user);
+		removed++;
+	}
+
+	for (i = 0; i < scan.users->len; i++) {
+		MdmUser *user = g_ptr_array_index (scan.users, i);
+
+		if (g_hash_table_lookup (old, user->login) != NULL) {
+			mdm_user_free (user);
+			continue;
+		}
+
+		mdm_users_refresh_add (user);
+		added++;
+	}
+
+	mdm_common_debug ("User list refreshed, %u added, %u removed", added, removed);
+
+	g_hash_table_destroy (old);
+	mdm_user_scan_end (&scan);
+}
+
+static gboolean
+mdm_users_refresh_done (GIOChannel *source, GIOCondition cond, gpointer data)
+{
+	char c;
+	gsize len = 0;
+
+	g_io_channel_read_chars (source, &c, 1, &len, NULL);
+	g_io_channel_shutdown (source, FALSE, NULL);
+	g_io_channel_unref (source);
+
+	VE_IGNORE_EINTR (waitpid (refresh_pid, NULL, 0));
+	refresh_pid = -1;
+
+	/* the child writes one byte once the cache is written */
+	if (len == 1)
+		mdm_users_refresh_apply ();
+	else
+		mdm_common_debug ("User list refresh failed");
+
+	return FALSE;
+}
+
+static gboolean
+mdm_users_refresh_start (gpointer data)
+{
+	GIOChannel *channel;
+	int p[2];
+
+	if (pipe (p) != 0)
+		return FALSE;
+
+	refresh_pid = fork ();
+	if (refresh_pid < 0) {
+		mdm_common_debug ("Could not fork to refresh the user list");
+		VE_IGNORE_EINTR (close (p[0]));
+		VE_IGNORE_EINTR (close (p[1]));
+		return FALSE;
+	}
+
+	if (refresh_pid == 0) {
+		MdmUserCacheStamp stamp;
+		MdmUserScan scan;
+		GHashTable *old;
+		GList *li;
+		guint i;
+
+		VE_IGNORE_EINTR (close (p[0]));
+
+		/* stamp first, so a change while we list is not missed */
+		mdm_user_cache_stamp (&stamp);
+
+		mdm_user_scan_begin (&scan, refresh_exclude_user, NULL, FALSE);
+		scan.time_limit = 0;
+		mdm_user_scan_enumerate (&scan);
+
+		/* the slave no longer answers, so keep the faces we know */
+		old = g_hash_table_new (g_str_hash, g_str_equal);
+		for (li = *refresh_users; li != NULL; li = li->next) {
+			MdmUser *user = li->data;
+			g_hash_table_insert (old, user->login, user);
+		}
+		for (i = 0; i < scan.users->len; i++) {
+			MdmUser *user = g_ptr_array_index (scan.users, i);
+			MdmUser *known = g_hash_table_lookup (old, user->login);
+
+			if (known != NULL && known->face_known &&
+			    mdm_user_same (user, known)) {
+				user->face_known = TRUE;
+				user->face_time = known->face_time;
+				user->facefile = g_strdup (known->facefile);
+			}
+		}
+
+		g_ptr_array_sort (scan.users, mdm_sort_func);
+		mdm_user_cache_write (&stamp, scan.users);
+
+		VE_IGNORE_EINTR (write (p[1], "1", 1));
+		_exit (0);
+	}
+
+	VE_IGNORE_EINTR (close (p[1]));
+
+	channel = g_io_channel_unix_new (p[0]);
+	g_io_channel_set_close_on_unref (channel, TRUE);
+	g_io_channel_set_encoding (channel, NULL, NULL);
+	g_io_add_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+			mdm_users_refresh_done, NULL);
+
+	return FALSE;
+}
+
+/*
+ * Called for every user the background refresh adds or removes, after
+ * the lists given to mdm_users_init have been updated.  A changed user
+ * is removed and added again.  The user is freed right after a removal.
+ */
+void
+mdm_users_set_changed_func (MdmUsersChangedFunc func, gpointer data)
+{
+    users_changed_func = func;
+    users_changed_data = data;
 }
 
 gboolean
@@ -338,54 +998,74 @@ mdm_users_init (GList **users,
 		gboolean is_local,
 		gboolean read_faces)
 {
-    struct passwd *pwent;
-    char **includes;
-    char **excludes;
-    gboolean found_include = FALSE;
+    MdmUserScan scan;
+    MdmUserCacheStamp stamp;
+    gboolean from_cache = FALSE;
+    GList *li;
     int i;
 
-    time_started = time (NULL);
-	
-    includes = g_strsplit (mdm_config_get_string (MDM_KEY_INCLUDE), ",", 0);
-    for (i=0 ; includes != NULL && includes[i] != NULL ; i++) {
-	g_strstrip (includes[i]);
-        if (includes[i] != NULL)
-           found_include = TRUE;
-    }
+    mdm_user_scan_begin (&scan, exclude_user, defface, read_faces);
 
-    excludes = g_strsplit (mdm_config_get_string (MDM_KEY_EXCLUDE), ",", 0);
-    for (i=0 ; excludes != NULL && excludes[i] != NULL ; i++)
-	g_strstrip (excludes[i]);
+    /* whatever the caller already has stays, and is not listed twice */
+    for (li = *users; li != NULL; li = li->next) {
+	MdmUser *user = li->data;
 
-    if (mdm_config_get_bool (MDM_KEY_INCLUDE_ALL) == TRUE) {
-	    setpwent ();
-	    pwent = getpwent ();
-	    while (pwent != NULL) {
+	g_ptr_array_add (scan.users, user);
+	g_hash_table_insert (scan.seen, user->login, GINT_TO_POINTER (1));
+    }
+    g_list_free (*users);
+    *users = NULL;
+
+    /* only the greeters, which get faces from the slave, use the cache */
+    g_free (user_cache_file);
+    g_free (user_cache_faces);
+    user_cache_file = NULL;
+    user_cache_faces = NULL;
+    if (read_faces && mdm_config_get_int (MDM_KEY_USER_LIST_CACHE_TTL) > 0) {
+	const char *dir = mdm_config_get_string (MDM_KEY_SERV_AUTHDIR);
+
+	user_cache_file = g_build_filename (dir, ".mdm-users", NULL);
+	user_cache_faces = g_build_filename (dir, ".mdm-faces", NULL);
+    }
 
-		if (! setup_user (pwent, users, users_string, excludes,
-			exclude_user, defface, size_of_users, is_local,
-			read_faces))
-			break;
+    if (user_cache_file != NULL)
+	from_cache = mdm_user_cache_load (&scan);
 
-		pwent = getpwent ();
+    if ( ! from_cache) {
+	mdm_user_cache_stamp (&stamp);
+	mdm_user_scan_enumerate (&scan);
+    }
+
+    g_ptr_array_sort (scan.users, mdm_sort_func);
+
+    if (user_cache_file != NULL) {
+	if (from_cache) {
+	    /* list again once the greeter is up */
+	    refresh_users = users;
+	    refresh_users_string = users_string;
+	    refresh_size_of_users = size_of_users;
+	    g_free (refresh_exclude_user);
+	    refresh_exclude_user = g_strdup (scan.exclude_user);
+	    refresh_defface = defface;
+	    if (refresh_pid < 0)
+		g_idle_add_full (G_PRIORITY_LOW, mdm_users_refresh_start, NULL, NULL);
+	} else {
+	    mdm_user_cache_write (&stamp, scan.users);
 	}
-	endpwent ();
+    }
 
-    } else if (found_include == TRUE) {
-	for (i=0 ; includes != NULL && includes[i] != NULL ; i++) {
-		pwent = getpwnam (includes[i]);
+    /* build the lists back to front so they come out sorted */
+    for (i = (int) scan.users->len - 1; i >= 0; i--) {
+	MdmUser *user = g_ptr_array_index (scan.users, i);
 
-		if (pwent != NULL) {
-			if (!setup_user (pwent, users, users_string, excludes,
-			    exclude_user, defface, size_of_users, is_local,
-			    read_faces))
-			break;
+	*users = g_list_prepend (*users, user);
+	/* the caller's own entries are already accounted for */
+	if (g_hash_table_lookup (scan.seen, user->login) != user)
+		continue;
+	*users_string = g_list_prepend (*users_string, g_strdup (user->login));
 
-		}
-	}
+	mdm_users_add_size (size_of_users, user, 1);
     }
 
-    g_strfreev (includes);
-    g_strfreev (excludes);
+    mdm_user_scan_end (&scan);
 }
-
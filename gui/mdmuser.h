@@ -31,8 +31,13 @@ struct _MdmUser {
     char *homedir;
     char *gecos;
     GdkPixbuf *picture;
+    char *facefile;		/* where picture came from */
+    gboolean face_known;	/* FALSE if the slave was not asked yet */
+    time_t face_time;		/* when the slave was last asked */
 };
 
+typedef void (*MdmUsersChangedFunc) (MdmUser *user, gboolean removed, gpointer data);
+
 gboolean    mdm_is_user_valid		(const char *username);
 gint        mdm_user_uid                (const char *username);
 const char *get_root_user               (void);
@@ -40,5 +45,6 @@ void        mdm_users_init              (GList **users, GList **users_string,
 					char *exclude_user, GdkPixbuf *defface,
 					int *size_of_users, gboolean is_local,
 					gboolean read_faces);
+void        mdm_users_set_changed_func  (MdmUsersChangedFunc func, gpointer data);
 
 #endif /* MDM_USER_H */
@@ -1182,6 +1182,10 @@ int main (int argc, char *argv[]) {
     gtk_init (&argc, &argv);
 
     mdm_common_log_init ();
+
+    /* Pull the whole configuration in one round trip rather than one per key */
+    mdm_config_prefetch (NULL);
+
     mdm_common_log_set_debug (mdm_config_get_bool (MDM_KEY_DEBUG));
 
     setlocale (LC_ALL, "");